@@ -0,0 +1,203 @@
+// What keeping cached contents in huge pages buys: blocks the sizes of typical
+// cached files are allocated and filled, as the file cache does when it loads, then
+// read at random offsets, as serving them from the cache does. Each heap is run in
+// a process of its own, and reports
+//   - the page faults taken while filling the blocks,
+//   - AnonHugePages of the process and the bytes mapped for the blocks,
+//   - the time of a random read, and the dTLB load misses of the reads from the
+//     hardware counters, or "unsupported" where the CPU or VM does not expose them.
+// The heaps are new/delete, and HugePageHeap with transparent huge pages and with
+// them turned off.
+//
+// Linux only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Icpp_server -o huge_pages_bench bench/huge_pages_bench.cpp cpp_server/HugePageHeap.cpp
+//   ./huge_pages_bench [blocks] [reads]
+// Defaults: 40000 blocks of 64 B to 64 KiB, spread evenly over the powers of two
+// (about 380 MB), and 20 million reads. dTLB counters need perf_event_paranoid at
+// 2 or less, or CAP_PERFMON.
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "HugePageHeap.h"
+
+static const size_t MIN_BLOCK = 64;
+static const size_t MAX_BLOCK = 64 << 10;
+
+// A hardware cache counter of this process, or -1 with errno set
+static int open_counter(uint64_t result)
+{
+  perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// AnonHugePages of this process in KiB, or -1
+static long anon_huge_kib()
+{
+  std::ifstream rollup("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(rollup, line)) {
+	if (line.compare(0, 14, "AnonHugePages:") == 0) {
+	  return std::atol(line.c_str() + 14);
+	}
+  }
+  return -1;
+}
+
+static long minor_faults()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+// Sizes spread evenly over the powers of two from MIN_BLOCK to MAX_BLOCK
+static std::vector<size_t> block_sizes(size_t count)
+{
+  std::vector<size_t> sizes(count);
+  uint64_t x = 88172645463325252ull;
+  double span = std::log2(double(MAX_BLOCK) / MIN_BLOCK);
+  for (size_t& size : sizes) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	size = size_t(MIN_BLOCK * std::exp2(span * double(x % 1000000) / 1000000));
+  }
+  return sizes;
+}
+
+static void run(const char* name, std::pmr::memory_resource& heap, size_t count, size_t reads)
+{
+  std::vector<size_t> sizes = block_sizes(count);
+  std::vector<char*> blocks(count);
+  size_t total = 0;
+  long faults = minor_faults();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i != count; i++) {
+	blocks[i] = static_cast<char*>(heap.allocate(sizes[i]));
+	memset(blocks[i], int(i), sizes[i]);
+	total += sizes[i];
+  }
+  double load = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  faults = minor_faults() - faults;
+  long huge = anon_huge_kib();
+
+  int misses = open_counter(PERF_COUNT_HW_CACHE_RESULT_MISS);
+  std::string unsupported = misses == -1 ? strerror(errno) : "";
+  int accesses = misses == -1 ? -1 : open_counter(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+  if (misses != -1) {
+	ioctl(misses, PERF_EVENT_IOC_RESET, 0);
+	ioctl(misses, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  if (accesses != -1) {
+	ioctl(accesses, PERF_EVENT_IOC_RESET, 0);
+	ioctl(accesses, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  uint64_t x = 2463534242ull, sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i != reads; i++) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	size_t block = size_t(x % count);
+	uint64_t word;
+	size_t offset = size_t(x >> 32) % (sizes[block] - sizeof(word) + 1);
+	memcpy(&word, blocks[block] + offset, sizeof(word));
+	sum += word;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint64_t missed = 0, accessed = 0;
+  if (misses != -1) {
+	ioctl(misses, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(misses, &missed, sizeof(missed)) != sizeof(missed)) {
+	  missed = 0;
+	}
+	close(misses);
+  }
+  if (accesses != -1) {
+	ioctl(accesses, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(accesses, &accessed, sizeof(accessed)) != sizeof(accessed)) {
+	  accessed = 0;
+	}
+	close(accesses);
+  }
+
+  printf("%s\n", name);
+  printf("  filled %.1f MB in %.2f s: %ld page faults, AnonHugePages %ld MiB\n", total / 1e6, load, faults,
+	huge < 0 ? -1 : huge >> 10);
+  printf("  random reads: %.1f ns each", seconds * 1e9 / double(reads));
+  if (misses == -1) {
+	printf(", dTLB load misses unsupported (%s)\n", unsupported.c_str());
+  } else {
+	printf(", dTLB load misses %llu, %.3f per read", (unsigned long long)missed, double(missed) / double(reads));
+	if (accessed != 0) {
+	  printf(" (%.2f%% of dTLB loads)", 100.0 * double(missed) / double(accessed));
+	}
+	printf("\n");
+  }
+  // Keeps the reads from being optimized away
+  if (sum == 42) {
+	printf("\n");
+  }
+  if (HugePageHeap* pages = dynamic_cast<HugePageHeap*>(&heap)) {
+	std::ostringstream report;
+	pages->report(report);
+	std::string line;
+	std::istringstream lines(report.str());
+	while (std::getline(lines, line)) {
+	  printf("  %s\n", line.c_str());
+	}
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = argc > 1 ? size_t(strtoull(argv[1], nullptr, 10)) : 40000;
+  size_t reads = argc > 2 ? size_t(strtoull(argv[2], nullptr, 10)) : 20000000;
+  if (count == 0) {
+	fprintf(stderr, "usage: %s [blocks] [reads]\n", argv[0]);
+	return 2;
+  }
+  // One process per heap, so that each starts from nothing mapped
+  for (int heap = 0; heap != 3; heap++) {
+	pid_t child = fork();
+	if (child == 0) {
+	  if (heap == 0) {
+		run("new/delete", *std::pmr::new_delete_resource(), count, reads);
+	  } else {
+		HugePageHeap::configure(heap == 1 ? HugePageHeap::transparent : HugePageHeap::off);
+		HugePageHeap pages;
+		run(heap == 1 ? "HugePageHeap, transparent huge pages" : "HugePageHeap, huge pages off", pages, count, reads);
+	  }
+	  _exit(0);
+	}
+	int status;
+	if (child == -1 || waitpid(child, &status, 0) != child || status != 0) {
+	  fprintf(stderr, "run failed\n");
+	  return 1;
+	}
+  }
+  return 0;
+}
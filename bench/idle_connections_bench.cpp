@@ -0,0 +1,263 @@
+// What idle keep-alive connections cost the server: it is started on a temporary
+// directory, a number of connections is opened to it over loopback, each making
+// one request and then staying open, and the harness reports
+//   - the accept rate: connections opened and answered per second,
+//   - the resident memory the server gained, per connection,
+//   - the request rate of one more connection while the others are idle.
+// Run it twice, once giving the server a --config file with a short idle_timeout
+// and once without, to see that idle connections cost nothing to keep or to expire.
+//
+// Linux only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -o idle_connections_bench bench/idle_connections_bench.cpp
+//   ./idle_connections_bench path/to/cpp_server [connections] [port] [-- server options]
+// Defaults: 10000 connections, port 18445. The file descriptor limit is raised as
+// far as allowed; sources are spread over 127.0.0.0/8 so that the ephemeral ports
+// do not run out.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char REQUEST[] = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char BODY[] = "<!doctype html><title>idle</title>\n";
+// Connections per source address, below the ephemeral port range
+static const int PER_SOURCE = 20000;
+// Connections being opened at once
+static const size_t IN_FLIGHT = 256;
+static const int MEASURED_REQUESTS = 5000;
+
+// Resident memory of process pid in KiB, or -1
+static long resident_kib(pid_t pid)
+{
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+	if (line.compare(0, 6, "VmRSS:") == 0) {
+	  return std::atol(line.c_str() + 6);
+	}
+  }
+  return -1;
+}
+
+static int connect_from(int index, int port, bool blocking)
+{
+  int sock = socket(AF_INET, SOCK_STREAM | (blocking ? 0 : SOCK_NONBLOCK), 0);
+  if (sock == -1) {
+	return -1;
+  }
+  // The port is chosen on connect, so that it can be shared with the TIME_WAIT
+  // sockets of earlier runs to other server ports
+  int no_port = 1;
+  setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &no_port, sizeof(no_port));
+  sockaddr_in source = {};
+  source.sin_family = AF_INET;
+  source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + uint32_t(index / PER_SOURCE));
+  sockaddr_in server = {};
+  server.sin_family = AF_INET;
+  server.sin_port = htons(uint16_t(port));
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, reinterpret_cast<sockaddr*>(&source), sizeof(source)) != 0 ||
+	(connect(sock, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0 && errno != EINPROGRESS)) {
+	close(sock);
+	return -1;
+  }
+  return sock;
+}
+
+// Reads a whole response from a blocking socket; false on error
+static bool read_response(int sock)
+{
+  char buf[4096];
+  size_t received = 0;
+  while (true) {
+	ssize_t got = recv(sock, buf + received, sizeof(buf) - 1 - received, 0);
+	if (got <= 0) {
+	  return false;
+	}
+	received += size_t(got);
+	buf[received] = '\0';
+	const char* end = strstr(buf, "\r\n\r\n");
+	const char* length = strstr(buf, "Content-Length: ");
+	if (end && length && received >= size_t(end + 4 - buf) + strtoul(length + 16, nullptr, 10)) {
+	  return true;
+	}
+  }
+}
+
+// Opens count connections into open, each making one request, and returns once
+// all are answered; false on error
+static bool open_idle(int count, int port, std::vector<int>& open, double& seconds)
+{
+  int epoll = epoll_create1(0);
+  size_t pending = 0;
+  int next = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<epoll_event> events(IN_FLIGHT);
+  while (int(open.size()) < count) {
+	for (; pending < IN_FLIGHT && next < count; next++) {
+	  int sock = connect_from(next, port, false);
+	  if (sock == -1) {
+		perror("connect");
+		return false;
+	  }
+	  // Writable once connected, then readable once answered
+	  epoll_event e = {};
+	  e.events = EPOLLOUT;
+	  e.data.fd = sock;
+	  epoll_ctl(epoll, EPOLL_CTL_ADD, sock, &e);
+	  pending++;
+	}
+	int ready = epoll_wait(epoll, events.data(), int(events.size()), 5000);
+	if (ready <= 0) {
+	  fprintf(stderr, "timed out with %zu connections pending\n", pending);
+	  return false;
+	}
+	for (int i = 0; i != ready; i++) {
+	  int sock = events[i].data.fd;
+	  if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+		fprintf(stderr, "connection refused or reset\n");
+		return false;
+	  }
+	  if (events[i].events & EPOLLOUT) {
+		send(sock, REQUEST, sizeof(REQUEST) - 1, 0);
+		epoll_event e = {};
+		e.events = EPOLLIN;
+		e.data.fd = sock;
+		epoll_ctl(epoll, EPOLL_CTL_MOD, sock, &e);
+		continue;
+	  }
+	  // The response is small enough to arrive at once
+	  char buf[4096];
+	  if (recv(sock, buf, sizeof(buf), 0) <= 0) {
+		fprintf(stderr, "connection closed before its response\n");
+		return false;
+	  }
+	  epoll_ctl(epoll, EPOLL_CTL_DEL, sock, nullptr);
+	  open.push_back(sock);
+	  pending--;
+	}
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  close(epoll);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+	fprintf(stderr, "usage: %s path/to/cpp_server [connections] [port] [-- server options]\n", argv[0]);
+	return 2;
+  }
+  int count = 10000;
+  int port = 18445;
+  int arg = 2;
+  if (arg < argc && strcmp(argv[arg], "--") != 0) {
+	count = atoi(argv[arg++]);
+  }
+  if (arg < argc && strcmp(argv[arg], "--") != 0) {
+	port = atoi(argv[arg++]);
+  }
+  if (arg < argc) {
+	arg++;
+  }
+
+  rlimit files;
+  getrlimit(RLIMIT_NOFILE, &files);
+  files.rlim_cur = files.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &files);
+  if (rlim_t(count) + 64 > files.rlim_cur) {
+	fprintf(stderr, "at most %llu descriptors allowed\n", (unsigned long long)files.rlim_cur);
+	return 1;
+  }
+
+  char root[] = "/tmp/idle_bench.XXXXXX";
+  if (!mkdtemp(root)) {
+	perror("mkdtemp");
+	return 1;
+  }
+  std::string index = std::string(root) + "/index.html";
+  std::ofstream(index) << BODY;
+
+  std::string port_text = std::to_string(port);
+  std::vector<char*> server_args = { argv[1], const_cast<char*>("-p"), &port_text[0], const_cast<char*>("-d"), root };
+  for (; arg < argc; arg++) {
+	server_args.push_back(argv[arg]);
+  }
+  server_args.push_back(nullptr);
+  pid_t server = fork();
+  if (server == 0) {
+	freopen("/dev/null", "w", stdout);
+	execv(argv[1], server_args.data());
+	perror("execv");
+	_exit(127);
+  }
+
+  // Waits for the server, and warms it up with one connection
+  int probe = -1;
+  for (int tries = 0; probe == -1 && tries != 50; tries++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	probe = connect_from(0, port, true);
+  }
+  int status = 1;
+  if (probe == -1 || send(probe, REQUEST, sizeof(REQUEST) - 1, 0) <= 0 || !read_response(probe)) {
+	fprintf(stderr, "server did not answer on port %d\n", port);
+  } else {
+	long before = resident_kib(server);
+	std::vector<int> idle;
+	double seconds;
+	if (open_idle(count, port, idle, seconds)) {
+	  // Lets the server settle, and any idle timeout expire
+	  std::this_thread::sleep_for(std::chrono::seconds(1));
+	  long after = resident_kib(server);
+	  printf("%d connections opened and answered in %.2f s: %.0f per second\n", count, seconds, count / seconds);
+	  printf("resident memory %+ld KiB: %.0f bytes per connection\n", after - before, (after - before) * 1024.0 / count);
+
+	  int timed = connect_from(count, port, true);
+	  int nodelay = 1;
+	  setsockopt(timed, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	  auto start = std::chrono::steady_clock::now();
+	  int answered = 0;
+	  for (; answered != MEASURED_REQUESTS; answered++) {
+		if (send(timed, REQUEST, sizeof(REQUEST) - 1, 0) <= 0 || !read_response(timed)) {
+		  break;
+		}
+	  }
+	  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	  printf("one more connection: %.0f requests per second, %.1f us each\n", answered / elapsed, elapsed * 1e6 / answered);
+	  status = answered == MEASURED_REQUESTS ? 0 : 1;
+	  if (timed != -1) {
+		close(timed);
+	  }
+	}
+	// The server closes first, so that the TIME_WAIT sockets left behind do not
+	// hold ports of the sources of the next run
+	kill(server, SIGTERM);
+	waitpid(server, nullptr, 0);
+	for (int sock : idle) {
+	  close(sock);
+	}
+  }
+  if (probe != -1) {
+	close(probe);
+  }
+  if (kill(server, SIGTERM) == 0) {
+	waitpid(server, nullptr, 0);
+  }
+  remove(index.c_str());
+  rmdir(root);
+  return status;
+}
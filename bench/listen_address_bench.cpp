@@ -0,0 +1,241 @@
+// Loopback TCP against a Unix socket: the server is started listening on both, and
+// each workload is timed request by request over each
+//   - a new connection per request of a 1 KiB file, from connect to the last byte,
+//   - keep-alive requests of 1 KiB, 100 KiB and 2 MB files, from send to last byte,
+// with the median latency in microseconds and the server's CPU time per request,
+// from /proc in clock ticks (so to 5 us at the default counts), reported.
+//
+// Linux only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -o listen_address_bench bench/listen_address_bench.cpp
+//   ./listen_address_bench path/to/cpp_server [requests] [port]
+// Defaults: 2000 requests per workload (a tenth of that for 2 MB), port 18458.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct workload {
+  const char* name;
+  const char* file;
+  size_t size;
+  bool new_connection;
+  // Requests are divided by this
+  int share;
+};
+
+static const workload WORKLOADS[] = {
+  { "new connection, 1 KiB", "1k.bin", 1 << 10, true, 1 },
+  { "keep-alive, 1 KiB", "1k.bin", 1 << 10, false, 1 },
+  { "keep-alive, 100 KiB", "100k.bin", 100 << 10, false, 1 },
+  { "keep-alive, 2 MB", "2m.bin", 2000000, false, 10 },
+};
+
+// Where the server listens: a TCP port on loopback, or a Unix socket path
+struct endpoint {
+  int port;
+  std::string path;
+};
+
+static int open_connection(const endpoint& to)
+{
+  if (!to.path.empty()) {
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, to.path.c_str(), sizeof(address.sun_path) - 1);
+	if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+	  close(sock);
+	  return -1;
+	}
+	return sock;
+  }
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(to.port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+	close(sock);
+	return -1;
+  }
+  return sock;
+}
+
+static bool send_request(int sock, const std::string& request)
+{
+  return send(sock, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+}
+
+// Reads one whole response of a body of size bytes; false on error
+static bool read_response(int sock, size_t size)
+{
+  static char buf[1 << 16];
+  std::string head;
+  size_t body = 0;
+  while (true) {
+	ssize_t got = recv(sock, buf, sizeof(buf), 0);
+	if (got <= 0) {
+	  return false;
+	}
+	if (head.find("\r\n\r\n") == std::string::npos) {
+	  head.append(buf, size_t(got));
+	  size_t end = head.find("\r\n\r\n");
+	  if (end == std::string::npos) {
+		continue;
+	  }
+	  body = head.size() - end - 4;
+	} else {
+	  body += size_t(got);
+	}
+	if (body >= size) {
+	  return true;
+	}
+  }
+}
+
+// User and system time of process pid in seconds, or -1
+static double cpu_seconds(pid_t pid)
+{
+  std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+  std::string line;
+  if (!std::getline(stat, line) || line.rfind(')') == std::string::npos) {
+	return -1;
+  }
+  // Fields after the command name, which may hold spaces; utime and stime are
+  // the 14th and 15th
+  const char* p = line.c_str() + line.rfind(')') + 2;
+  for (int field = 3; field != 14; field++) {
+	p = strchr(p, ' ') + 1;
+  }
+  char* end;
+  double ticks = double(strtoull(p, &end, 10));
+  ticks += double(strtoull(end, nullptr, 10));
+  return ticks / double(sysconf(_SC_CLK_TCK));
+}
+
+// Times count requests of w; false if one failed
+static bool measure(const workload& w, const endpoint& to, int count, std::vector<double>& micros)
+{
+  std::string request = std::string("GET /") + w.file + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  int sock = -1;
+  if (!w.new_connection) {
+	sock = open_connection(to);
+	// Warms the connection and the file up
+	if (sock == -1 || !send_request(sock, request) || !read_response(sock, w.size)) {
+	  return false;
+	}
+  }
+  for (int i = 0; i != count; i++) {
+	auto start = std::chrono::steady_clock::now();
+	if (w.new_connection) {
+	  sock = open_connection(to);
+	}
+	if (sock == -1 || !send_request(sock, request) || !read_response(sock, w.size)) {
+	  if (sock != -1) {
+		close(sock);
+	  }
+	  return false;
+	}
+	micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	if (w.new_connection) {
+	  close(sock);
+	}
+  }
+  if (!w.new_connection) {
+	close(sock);
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+	fprintf(stderr, "usage: %s path/to/cpp_server [requests] [port]\n", argv[0]);
+	return 2;
+  }
+  int requests = argc > 2 ? atoi(argv[2]) : 2000;
+  int port = argc > 3 ? atoi(argv[3]) : 18458;
+
+  char root[] = "/tmp/listen_address_bench.XXXXXX";
+  if (!mkdtemp(root)) {
+	perror("mkdtemp");
+	return 1;
+  }
+  std::vector<std::string> files;
+  for (const workload& w : WORKLOADS) {
+	std::string path = std::string(root) + "/" + w.file;
+	if (std::find(files.begin(), files.end(), path) == files.end()) {
+	  std::ofstream(path, std::ios::binary) << std::string(w.size, 'x');
+	  files.push_back(path);
+	}
+  }
+  // Outside the served directory
+  std::string socket_path = std::string(root) + ".sock";
+
+  std::string tcp_listen = "127.0.0.1:" + std::to_string(port);
+  std::string unix_listen = "unix:" + socket_path;
+  std::vector<char*> server_args = { argv[1], const_cast<char*>("-d"), root, const_cast<char*>("--listen"),
+	&tcp_listen[0], const_cast<char*>("--listen"), &unix_listen[0], nullptr };
+  fflush(stdout);
+  pid_t server = fork();
+  if (server == 0) {
+	freopen("/dev/null", "w", stdout);
+	execv(argv[1], server_args.data());
+	perror("execv");
+	_exit(127);
+  }
+
+  const endpoint endpoints[] = { { port, "" }, { 0, socket_path } };
+  int status = 0;
+  int probe = -1;
+  for (int tries = 0; probe == -1 && tries != 50; tries++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	probe = open_connection(endpoints[1]);
+  }
+  if (probe == -1) {
+	fprintf(stderr, "server did not come up on %s\n", socket_path.c_str());
+	status = 1;
+  } else {
+	close(probe);
+	printf("%-24s %-6s %10s %16s\n", "workload", "socket", "p50 us", "server CPU us");
+	for (const workload& w : WORKLOADS) {
+	  for (const endpoint& to : endpoints) {
+		std::vector<double> micros;
+		int count = std::max(requests / w.share, 1);
+		double cpu = cpu_seconds(server);
+		if (!measure(w, to, count, micros)) {
+		  fprintf(stderr, "%s over %s failed\n", w.name, to.path.empty() ? "TCP" : "Unix");
+		  status = 1;
+		  break;
+		}
+		cpu = cpu_seconds(server) - cpu;
+		std::sort(micros.begin(), micros.end());
+		printf("%-24s %-6s %10.1f %16.1f\n", w.name, to.path.empty() ? "TCP" : "Unix", micros[micros.size() / 2],
+		  cpu * 1e6 / count);
+	  }
+	}
+  }
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  remove(socket_path.c_str());
+  for (const std::string& path : files) {
+	remove(path.c_str());
+  }
+  rmdir(root);
+  return status;
+}
@@ -0,0 +1,99 @@
+// Lookup throughput of the MIME registry as reader threads are added, while a
+// writer keeps adding mappings: ConcurrentMimeMapper, whose readers follow an
+// RcuPointer, against a MimeMapper behind a mutex.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o mime_lookup_bench bench/mime_lookup_bench.cpp cpp_server/MimeMapper.cpp cpp_server/DefaultMimeMapper.cpp cpp_server/Rcu.cpp
+//   ./mime_lookup_bench [max_threads] [seconds_per_run]
+// Threads double from 1 up to max_threads (default: the hardware threads). The
+// RCU figures should grow with the threads as long as they have cores of their
+// own; the mutex figures should not.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MimeMapper.h"
+
+static const char* const PATHS[] = { "index.html", "site.css", "app.js", "logo.png", "photo.jpg",
+  "data.json", "icon.svg", "font.woff2" };
+static const size_t PATH_COUNT = sizeof(PATHS) / sizeof(PATHS[0]);
+// Lookups between two checks of the clock, and quiescent states of a reader
+static const size_t BATCH = 1024;
+
+// Runs threads readers and one writer for seconds, returning the lookups per second
+template<class Lookup, class Write>
+static double measure(unsigned threads, double seconds, Lookup lookup, Write write)
+{
+  std::vector<std::string> paths(PATHS, PATHS + PATH_COUNT);
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> total(0);
+  std::vector<std::thread> readers;
+  for (unsigned t = 0; t != threads; t++) {
+	readers.emplace_back([&] {
+	  Rcu::reader reader;
+	  uint64_t count = 0;
+	  size_t checksum = 0;
+	  while (!stop.load(std::memory_order_relaxed)) {
+		for (size_t i = 0; i != BATCH; i++) {
+		  checksum += lookup(paths[i % PATH_COUNT]);
+		}
+		count += BATCH;
+		reader.quiescent();
+	  }
+	  // Keeps the lookups from being optimized away
+	  total += count + (checksum == 1 ? 1 : 0);
+	});
+  }
+  std::thread writer([&] {
+	for (unsigned i = 0; !stop.load(std::memory_order_relaxed); i++) {
+	  write("file.x" + std::to_string(i % 64), "application/x-bench");
+	  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+  });
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (std::thread& reader : readers) {
+	reader.join();
+  }
+  writer.join();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return double(total.load()) / elapsed;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned max_threads = argc > 1 ? unsigned(std::atoi(argv[1])) : std::thread::hardware_concurrency();
+  double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+  if (max_threads == 0) {
+	max_threads = 1;
+  }
+
+  std::unique_ptr<ConcurrentMimeMapper> concurrent(ConcurrentMimeMapper::createDefault());
+  std::unique_ptr<MimeMapper> locked(MimeMapper::createDefault());
+  std::mutex lock;
+
+  std::printf("%8s %16s %16s\n", "threads", "rcu M/s", "mutex M/s");
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+	double rcu = measure(threads, seconds,
+	  [&](const std::string& path) { return concurrent->findMime(path).size(); },
+	  [&](const std::string& extension, const std::string& mime) { concurrent->addMapping(extension, mime); });
+	double mutex = measure(threads, seconds,
+	  [&](const std::string& path) {
+		std::lock_guard<std::mutex> guard(lock);
+		return locked->findMime(path).size();
+	  },
+	  [&](const std::string& extension, const std::string& mime) {
+		std::lock_guard<std::mutex> guard(lock);
+		locked->addMapping(extension, mime);
+	  });
+	std::printf("%8u %16.1f %16.1f\n", threads, rcu / 1e6, mutex / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+// What sending a file body costs the sender, by the way it goes to the socket:
+// read()+write() through a user buffer, sendfile(), and splice() through a pipe,
+// as --splice does. A cached file is sent over a loopback connection to a thread
+// that drains it, in 256 KiB chunks, and the sender's CPU time per 100 MB and the
+// throughput are reported.
+//
+// Given the path of the server, the file is also downloaded through it, started
+// with sendfile (the default) and with --splice, and the throughput of each
+// reported.
+//
+// Linux only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -o send_path_bench bench/send_path_bench.cpp
+//   ./send_path_bench [megabytes] [path/to/cpp_server [port]]
+// Defaults: a 300 MB file sent 3 times per way, port 18456.
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const size_t CHUNK = 256 << 10;
+static const int ROUNDS = 3;
+
+enum send_path { read_write, send_file, splice_pipe };
+static const char* const PATH_NAMES[] = { "read+write", "sendfile", "splice" };
+
+static double thread_cpu_seconds()
+{
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return double(now.tv_sec) + double(now.tv_nsec) / 1e9;
+}
+
+// A connected loopback TCP pair: first the sender, then the receiver
+static bool connected_pair(int sockets[2])
+{
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+	getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+	close(listener);
+	return false;
+  }
+  sockets[0] = socket(AF_INET, SOCK_STREAM, 0);
+  bool ok = connect(sockets[0], reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+	(sockets[1] = accept(listener, nullptr, nullptr)) != -1;
+  close(listener);
+  return ok;
+}
+
+// Sends size bytes of file to sock; false on error
+static bool send_body(send_path path, int file, int sock, size_t size, int pipe_ends[2], std::vector<char>& buffer)
+{
+  off_t offset = 0;
+  while (size_t(offset) < size) {
+	size_t chunk = std::min(CHUNK, size - size_t(offset));
+	ssize_t sent;
+	if (path == read_write) {
+	  ssize_t got = pread(file, buffer.data(), chunk, offset);
+	  if (got <= 0) {
+		return false;
+	  }
+	  for (ssize_t written = 0; written < got; written += sent) {
+		sent = write(sock, buffer.data() + written, size_t(got - written));
+		if (sent <= 0) {
+		  return false;
+		}
+	  }
+	  offset += got;
+	} else if (path == send_file) {
+	  sent = sendfile(sock, file, &offset, chunk);
+	  if (sent <= 0) {
+		return false;
+	  }
+	} else {
+	  loff_t from = offset;
+	  ssize_t got = splice(file, &from, pipe_ends[1], nullptr, chunk, SPLICE_F_MOVE);
+	  if (got <= 0) {
+		return false;
+	  }
+	  for (ssize_t moved = 0; moved < got; moved += sent) {
+		sent = splice(pipe_ends[0], nullptr, sock, nullptr, size_t(got - moved), SPLICE_F_MOVE);
+		if (sent <= 0) {
+		  return false;
+		}
+	  }
+	  offset += got;
+	}
+  }
+  return true;
+}
+
+static bool measure_direct(send_path path, int file, size_t size)
+{
+  int sockets[2];
+  int pipe_ends[2];
+  if (!connected_pair(sockets) || pipe(pipe_ends) != 0) {
+	perror("socket");
+	return false;
+  }
+  fcntl(pipe_ends[1], F_SETPIPE_SZ, int(CHUNK));
+  std::thread receiver([&] {
+	std::vector<char> sink(CHUNK);
+	while (read(sockets[1], sink.data(), sink.size()) > 0) {
+	}
+  });
+  std::vector<char> buffer(CHUNK);
+  double cpu = thread_cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  bool ok = true;
+  for (int round = 0; round != ROUNDS && ok; round++) {
+	ok = send_body(path, file, sockets[0], size, pipe_ends, buffer);
+  }
+  shutdown(sockets[0], SHUT_WR);
+  receiver.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  cpu = thread_cpu_seconds() - cpu;
+  double sent = double(size) * ROUNDS;
+  printf("%-12s %7.1f ms CPU per 100 MB, %5.2f GB/s\n", PATH_NAMES[path], cpu * 1e3 * 1e8 / sent, sent / seconds / 1e9);
+  for (int fd : { sockets[0], sockets[1], pipe_ends[0], pipe_ends[1] }) {
+	close(fd);
+  }
+  return ok;
+}
+
+// Downloads the file from a server started with option, ROUNDS times on one connection
+static bool measure_server(const char* server_path, const char* option, const std::string& root, size_t size, int port)
+{
+  std::string port_text = std::to_string(port);
+  std::vector<char*> args = { const_cast<char*>(server_path), const_cast<char*>("-p"), &port_text[0],
+	const_cast<char*>("-d"), const_cast<char*>(root.c_str()) };
+  if (option != nullptr) {
+	args.push_back(const_cast<char*>(option));
+  }
+  args.push_back(nullptr);
+  fflush(stdout);
+  pid_t server = fork();
+  if (server == 0) {
+	freopen("/dev/null", "w", stdout);
+	execv(server_path, args.data());
+	perror("execv");
+	_exit(127);
+  }
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int sock = -1;
+  for (int tries = 0; sock == -1 && tries != 50; tries++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+	  close(sock);
+	  sock = -1;
+	}
+  }
+  bool ok = sock != -1;
+  std::vector<char> sink(CHUNK);
+  auto start = std::chrono::steady_clock::now();
+  const char request[] = "GET /body.bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  for (int round = 0; round != ROUNDS && ok; round++) {
+	ok = send(sock, request, sizeof(request) - 1, 0) == ssize_t(sizeof(request) - 1);
+	std::string head;
+	size_t body = 0;
+	while (ok && body < size) {
+	  ssize_t got = recv(sock, sink.data(), sink.size(), 0);
+	  if (got <= 0) {
+		ok = false;
+	  } else if (head.find("\r\n\r\n") == std::string::npos) {
+		head.append(sink.data(), size_t(got));
+		size_t end = head.find("\r\n\r\n");
+		body = end == std::string::npos ? 0 : head.size() - end - 4;
+	  } else {
+		body += size_t(got);
+	  }
+	}
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (ok) {
+	printf("server, %-9s %5.2f GB/s\n", option != nullptr ? option : "sendfile", double(size) * ROUNDS / seconds / 1e9);
+  } else {
+	fprintf(stderr, "download through the server failed\n");
+  }
+  if (sock != -1) {
+	close(sock);
+  }
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  size_t size = size_t(argc > 1 ? atoi(argv[1]) : 300) << 20;
+  const char* server_path = argc > 2 ? argv[2] : nullptr;
+  int port = argc > 3 ? atoi(argv[3]) : 18456;
+  if (size == 0) {
+	fprintf(stderr, "usage: %s [megabytes] [path/to/cpp_server [port]]\n", argv[0]);
+	return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  char root[] = "/tmp/send_path_bench.XXXXXX";
+  if (!mkdtemp(root)) {
+	perror("mkdtemp");
+	return 1;
+  }
+  std::string path = std::string(root) + "/body.bin";
+  int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  std::vector<char> block(CHUNK);
+  for (size_t i = 0; i != block.size(); i++) {
+	block[i] = char(i * 7);
+  }
+  bool ok = file != -1;
+  for (size_t written = 0; ok && written < size; written += block.size()) {
+	ok = write(file, block.data(), std::min(block.size(), size - written)) > 0;
+  }
+  // Just written, so in the page cache, as a file served often is
+
+  for (send_path p : { read_write, send_file, splice_pipe }) {
+	ok = ok && measure_direct(p, file, size);
+  }
+  if (ok && server_path != nullptr) {
+	ok = measure_server(server_path, nullptr, root, size, port) && measure_server(server_path, "--splice", root, size, port + 1);
+  }
+  if (file != -1) {
+	close(file);
+  }
+  remove(path.c_str());
+  rmdir(root);
+  return ok ? 0 : 1;
+}
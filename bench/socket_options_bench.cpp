@@ -0,0 +1,256 @@
+// Latency of requests over loopback under each of the socket tuning options: the
+// server is started once per option set on a temporary directory, and each
+// workload is timed request by request
+//   - a new connection per request of a 1 KiB file, from connect to the last byte,
+//   - keep-alive requests of 1 KiB, 100 KiB and 2 MB files, from send to last byte,
+// with the median and the 99th percentile reported in microseconds. With
+// --fastopen the client asks for fast open too, and the bench reports how many
+// connections the kernel accepted with data in the SYN (TCPFastOpenPassive).
+//
+// Linux only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -o socket_options_bench bench/socket_options_bench.cpp
+//   ./socket_options_bench path/to/cpp_server [requests] [port]
+// Defaults: 2000 requests per workload (a tenth of that for 2 MB), ports from
+// 18449 up, one per option set. Busy polling cannot show on loopback, which has
+// no device queue to poll.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct option_set {
+  const char* name;
+  std::vector<const char*> args;
+  bool fastopen;
+};
+
+static const option_set OPTION_SETS[] = {
+  { "default", {}, false },
+  { "--defer-accept 5", { "--defer-accept", "5" }, false },
+  { "--fastopen 256", { "--fastopen", "256" }, true },
+  { "--no-nodelay", { "--no-nodelay" }, false },
+  { "--cork", { "--cork" }, false },
+  { "--sndbuf-kb 64", { "--sndbuf-kb", "64" }, false },
+  { "--busy-poll-us 50", { "--busy-poll-us", "50" }, false },
+};
+
+struct workload {
+  const char* name;
+  const char* file;
+  size_t size;
+  bool new_connection;
+  // Requests are divided by this
+  int share;
+};
+
+static const workload WORKLOADS[] = {
+  { "new connection, 1 KiB", "1k.bin", 1 << 10, true, 1 },
+  { "keep-alive, 1 KiB", "1k.bin", 1 << 10, false, 1 },
+  { "keep-alive, 100 KiB", "100k.bin", 100 << 10, false, 1 },
+  { "keep-alive, 2 MB", "2m.bin", 2000000, false, 10 },
+};
+
+static sockaddr_in server_address(int port)
+{
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return address;
+}
+
+// A connected socket, or -1. With fast open, the request goes out with the SYN
+// once the client has a cookie.
+static int open_connection(int port, bool fastopen)
+{
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (fastopen) {
+	setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+  }
+  sockaddr_in address = server_address(port);
+  if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+	close(sock);
+	return -1;
+  }
+  return sock;
+}
+
+static bool send_request(int sock, const std::string& request)
+{
+  return send(sock, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+}
+
+// Reads one whole response of a body of size bytes; false on error
+static bool read_response(int sock, size_t size)
+{
+  static char buf[1 << 16];
+  std::string head;
+  size_t body = 0;
+  while (true) {
+	ssize_t got = recv(sock, buf, sizeof(buf), 0);
+	if (got <= 0) {
+	  return false;
+	}
+	if (head.empty() || head.find("\r\n\r\n") == std::string::npos) {
+	  head.append(buf, size_t(got));
+	  size_t end = head.find("\r\n\r\n");
+	  if (end == std::string::npos) {
+		continue;
+	  }
+	  body = head.size() - end - 4;
+	} else {
+	  body += size_t(got);
+	}
+	if (body >= size) {
+	  return true;
+	}
+  }
+}
+
+static long fastopen_passive()
+{
+  std::ifstream netstat("/proc/net/netstat");
+  std::string names, values;
+  while (std::getline(netstat, names) && std::getline(netstat, values)) {
+	if (names.compare(0, 7, "TcpExt:") != 0) {
+	  continue;
+	}
+	std::istringstream name_fields(names), value_fields(values);
+	std::string name, value;
+	while (name_fields >> name && value_fields >> value) {
+	  if (name == "TCPFastOpenPassive") {
+		return std::atol(value.c_str());
+	  }
+	}
+  }
+  return -1;
+}
+
+// Times count requests of w; false if one failed
+static bool measure(const workload& w, int port, bool fastopen, int count, std::vector<double>& micros)
+{
+  std::string request = std::string("GET /") + w.file + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  int sock = -1;
+  if (!w.new_connection) {
+	sock = open_connection(port, false);
+	// Warms the connection and the file up
+	if (sock == -1 || !send_request(sock, request) || !read_response(sock, w.size)) {
+	  return false;
+	}
+  }
+  for (int i = 0; i != count; i++) {
+	auto start = std::chrono::steady_clock::now();
+	if (w.new_connection) {
+	  sock = open_connection(port, fastopen);
+	}
+	if (sock == -1 || !send_request(sock, request) || !read_response(sock, w.size)) {
+	  if (sock != -1) {
+		close(sock);
+	  }
+	  return false;
+	}
+	micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	if (w.new_connection) {
+	  close(sock);
+	}
+  }
+  if (!w.new_connection) {
+	close(sock);
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+	fprintf(stderr, "usage: %s path/to/cpp_server [requests] [port]\n", argv[0]);
+	return 2;
+  }
+  int requests = argc > 2 ? atoi(argv[2]) : 2000;
+  int first_port = argc > 3 ? atoi(argv[3]) : 18449;
+
+  char root[] = "/tmp/socket_options_bench.XXXXXX";
+  if (!mkdtemp(root)) {
+	perror("mkdtemp");
+	return 1;
+  }
+  std::vector<std::string> files;
+  for (const workload& w : WORKLOADS) {
+	std::string path = std::string(root) + "/" + w.file;
+	if (std::find(files.begin(), files.end(), path) == files.end()) {
+	  std::ofstream(path, std::ios::binary) << std::string(w.size, 'x');
+	  files.push_back(path);
+	}
+  }
+
+  printf("%-20s %-24s %10s %10s\n", "options", "workload", "p50 us", "p99 us");
+  int status = 0;
+  for (size_t set = 0; set != sizeof(OPTION_SETS) / sizeof(OPTION_SETS[0]) && status == 0; set++) {
+	const option_set& options = OPTION_SETS[set];
+	std::string port_text = std::to_string(first_port + int(set));
+	std::vector<char*> server_args = { argv[1], const_cast<char*>("-p"), &port_text[0], const_cast<char*>("-d"), root };
+	for (const char* arg : options.args) {
+	  server_args.push_back(const_cast<char*>(arg));
+	}
+	server_args.push_back(nullptr);
+	// The child must not write out what is buffered here
+	fflush(stdout);
+	pid_t server = fork();
+	if (server == 0) {
+	  freopen("/dev/null", "w", stdout);
+	  execv(argv[1], server_args.data());
+	  perror("execv");
+	  _exit(127);
+	}
+	int probe = -1;
+	for (int tries = 0; probe == -1 && tries != 50; tries++) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	  probe = open_connection(first_port + int(set), false);
+	}
+	if (probe == -1) {
+	  fprintf(stderr, "server did not come up on port %s\n", port_text.c_str());
+	  status = 1;
+	} else {
+	  close(probe);
+	  long passive = fastopen_passive();
+	  for (const workload& w : WORKLOADS) {
+		std::vector<double> micros;
+		if (!measure(w, first_port + int(set), options.fastopen, std::max(requests / w.share, 1), micros)) {
+		  fprintf(stderr, "%s: %s failed\n", options.name, w.name);
+		  status = 1;
+		  break;
+		}
+		std::sort(micros.begin(), micros.end());
+		printf("%-20s %-24s %10.1f %10.1f\n", options.name, w.name, micros[micros.size() / 2],
+		  micros[std::min(micros.size() - 1, micros.size() * 99 / 100)]);
+	  }
+	  if (options.fastopen && passive >= 0) {
+		printf("%-20s %ld connections accepted with data in the SYN\n", "", fastopen_passive() - passive);
+	  }
+	  fflush(stdout);
+	}
+	kill(server, SIGTERM);
+	waitpid(server, nullptr, 0);
+  }
+  for (const std::string& path : files) {
+	remove(path.c_str());
+  }
+  rmdir(root);
+  return status;
+}
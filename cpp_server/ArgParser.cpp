@@ -170,12 +170,15 @@ ArgParser::parse_result ArgParser::parse(int argc, char** argv) const {
 	  string::size_type equalSignIndex = argument.find_first_of('=', 2);
 	  string flag = equalSignIndex == string::npos ? argument : argument.substr(0, equalSignIndex);
 	  bool option_found = false;
+	  bool option_taken = false;
 	  if (i + 1 != argc || equalSignIndex != string::npos) {
-		string option = equalSignIndex == string::npos ? argv[++i] : argument.substr(equalSignIndex + 1);
+		option_taken = equalSignIndex == string::npos;
+		string option = option_taken ? argv[++i] : argument.substr(equalSignIndex + 1);
 		option_found = readOption(flag, option);
 	  }
 	  bool flag_found = readFlag(flag, prevPriorities);
-	  if (!option_found) {
+	  // The next argument was not this flag's value after all
+	  if (!option_found && option_taken) {
 		i--;
 	  }
 	  if (!(flag_found || option_found)) {
@@ -0,0 +1,251 @@
+#include "AssetBundle.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <vector>
+#include "MappedFile.h"
+
+static const char BUNDLE_MAGIC[8] = { 'C', 'S', 'B', 'U', 'N', 'D', 'L', 'E' };
+static const uint32_t BUNDLE_VERSION = 1;
+// Reads back byte-swapped when the bundle was packed on a host of the other byte order
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Bodies at least this large start on a page of their own
+static const uint64_t BODY_PAGE_SIZE = 4096;
+
+static bool within(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+// FNV-1a of the body, quoted
+static std::string make_etag(const std::string& body) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : body) {
+	hash ^= c;
+	hash *= 1099511628211ull;
+  }
+  char etag[20];
+  snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+  return etag;
+}
+
+static bool read_whole_file(const std::filesystem::path& path, std::string& contents) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+	return false;
+  }
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg();
+  if (size < 0) {
+	return false;
+  }
+  in.seekg(0);
+  contents.resize(size_t(size));
+  return bool(in.read(&contents[0], size));
+}
+
+bool AssetBundle::pack(const std::string& dir, const std::string& output, const IMimeMapper& mime_mapper, std::string& error)
+{
+  namespace fs = std::filesystem;
+
+  // Canonical request path -> file, in the order of the index
+  std::map<std::string, fs::path> files;
+  std::error_code ec;
+  fs::recursive_directory_iterator it(dir, ec);
+  for (fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+	if (it->is_regular_file(ec)) {
+	  files["/" + it->path().lexically_relative(dir).generic_string()] = it->path();
+	}
+  }
+  if (ec) {
+	error = "cannot read " + dir + ": " + ec.message();
+	return false;
+  }
+
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  if (!out) {
+	error = "cannot create " + output;
+	return false;
+  }
+  header head = {};
+  out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+  uint64_t position = sizeof(head);
+  std::vector<record> index;
+  // Offsets into strings are made absolute once the bodies are written
+  std::string strings;
+  auto add_string = [&strings](const std::string& value) {
+	uint64_t offset = strings.size();
+	strings += value;
+	return offset;
+  };
+  auto pad_to = [&](uint64_t alignment) {
+	static const char zeros[BODY_PAGE_SIZE] = {};
+	uint64_t padding = (alignment - position % alignment) % alignment;
+	out.write(zeros, std::streamsize(padding));
+	position += padding;
+  };
+  auto add_representation = [&](const std::string& body, const std::string& type, bool gzip, bool varies, representation& r) {
+	pad_to(body.size() >= BODY_PAGE_SIZE ? BODY_PAGE_SIZE : 8);
+	r.body_offset = position;
+	r.body_size = body.size();
+	out.write(body.data(), std::streamsize(body.size()));
+	position += body.size();
+
+	std::string etag = make_etag(body);
+	std::string fields;
+	if (!type.empty()) {
+	  fields += "Content-Type: " + type + "\r\n";
+	}
+	fields += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	fields += "ETag: " + etag + "\r\n";
+	if (gzip) {
+	  fields += "Content-Encoding: gzip\r\n";
+	}
+	if (varies) {
+	  fields += "Vary: Accept-Encoding\r\n";
+	}
+	r.fields_offset = add_string(fields);
+	r.fields_size = uint32_t(fields.size());
+	r.etag_offset = add_string(etag);
+	r.etag_size = uint32_t(etag.size());
+  };
+
+  std::string body;
+  for (const auto& file : files) {
+	const std::string& path = file.first;
+	std::string name = file.second.filename().string();
+	if (name.find('.') == std::string::npos) {
+	  continue;
+	}
+	record r = {};
+	std::string type = mime_mapper.getMime(name);
+	r.path_offset = add_string(path);
+	r.path_size = uint32_t(path.size());
+	r.type_offset = add_string(type);
+	r.type_size = uint32_t(type.size());
+	auto compressed = files.find(path + ".gz");
+	bool varies = compressed != files.end();
+	if (!read_whole_file(file.second, body)) {
+	  error = "cannot read " + file.second.string();
+	  return false;
+	}
+	add_representation(body, type, false, varies, r.plain);
+	if (varies) {
+	  if (!read_whole_file(compressed->second, body)) {
+		error = "cannot read " + compressed->second.string();
+		return false;
+	  }
+	  add_representation(body, type, true, true, r.gzip);
+	}
+	index.push_back(r);
+  }
+
+  uint64_t strings_offset = position;
+  out.write(strings.data(), std::streamsize(strings.size()));
+  position += strings.size();
+  for (record& r : index) {
+	r.path_offset += strings_offset;
+	r.type_offset += strings_offset;
+	for (representation* rep : { &r.plain, &r.gzip }) {
+	  if (rep->fields_size != 0) {
+		rep->fields_offset += strings_offset;
+		rep->etag_offset += strings_offset;
+	  }
+	}
+  }
+  pad_to(8);
+  memcpy(head.magic, BUNDLE_MAGIC, sizeof(head.magic));
+  head.version = BUNDLE_VERSION;
+  head.byte_order = BYTE_ORDER_MARK;
+  head.count = index.size();
+  head.index_offset = position;
+  out.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size() * sizeof(record)));
+  position += index.size() * sizeof(record);
+  head.size = position;
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+  out.close();
+  if (!out) {
+	error = "cannot write " + output;
+	return false;
+  }
+  return true;
+}
+
+bool AssetBundle::valid(const representation& r, uint64_t size) const
+{
+  return r.fields_size != 0 && within(r.body_offset, r.body_size, size) &&
+	within(r.fields_offset, r.fields_size, size) && within(r.etag_offset, r.etag_size, size);
+}
+
+bool AssetBundle::load(const std::string& path, std::string& error)
+{
+  // The whole bundle is mapped in one go; pages are read in as they are served
+  uint64_t size;
+  std::shared_ptr<const char> mapped = map_file(path, size, error);
+  if (!mapped) {
+	return false;
+  }
+  if (size < sizeof(header)) {
+	error = path + " is not a bundle";
+	return false;
+  }
+  const header& head = *reinterpret_cast<const header*>(mapped.get());
+  if (memcmp(head.magic, BUNDLE_MAGIC, sizeof(head.magic)) != 0) {
+	error = path + " is not a bundle";
+	return false;
+  }
+  if (head.version != BUNDLE_VERSION || head.byte_order != BYTE_ORDER_MARK) {
+	error = path + " was packed by another version or on a host of another byte order";
+	return false;
+  }
+  if (head.size != size || head.index_offset % 8 != 0 || !within(head.index_offset, 0, size) ||
+	head.count > (size - head.index_offset) / sizeof(record)) {
+	error = path + " is truncated or damaged";
+	return false;
+  }
+  // Lookups trust the index from here on
+  const record* index = reinterpret_cast<const record*>(mapped.get() + head.index_offset);
+  for (uint64_t i = 0; i != head.count; i++) {
+	const record& r = index[i];
+	bool ok = within(r.path_offset, r.path_size, size) && within(r.type_offset, r.type_size, size) &&
+	  valid(r.plain, size) && (r.gzip.fields_size == 0 || valid(r.gzip, size));
+	if (ok && i != 0) {
+	  const record& previous = index[i - 1];
+	  ok = std::string_view(mapped.get() + previous.path_offset, previous.path_size) <
+		std::string_view(mapped.get() + r.path_offset, r.path_size);
+	}
+	if (!ok) {
+	  error = path + " is truncated or damaged";
+	  return false;
+	}
+  }
+  mapping = std::move(mapped);
+  records = index;
+  count = size_t(head.count);
+  return true;
+}
+
+bool AssetBundle::open(std::string_view path, bool gzip, Resource& resource) const
+{
+  const record* end = records + count;
+  const record* it = std::lower_bound(records, end, path, [this](const record& r, std::string_view key) {
+	return string_at(r.path_offset, r.path_size) < key;
+  });
+  if (it == end || string_at(it->path_offset, it->path_size) != path) {
+	return false;
+  }
+  resource.varies = it->gzip.fields_size != 0;
+  const representation& r = gzip && resource.varies ? it->gzip : it->plain;
+  if (&r == &it->gzip) {
+	resource.content_encoding = "gzip";
+  }
+  resource.content_type = string_at(it->type_offset, it->type_size);
+  resource.data = std::shared_ptr<const char>(mapping, mapping.get() + r.body_offset);
+  resource.size = r.body_size;
+  resource.etag = string_at(r.etag_offset, r.etag_size);
+  resource.header_fields = string_at(r.fields_offset, r.fields_size);
+  return true;
+}
@@ -0,0 +1,73 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "MimeMapper.h"
+#include "Resource.h"
+
+// A read-only bundle of the files under a directory, packed ahead of time and
+// mapped into memory whole.
+//
+// For every file the bundle holds its Content-Type, its ETag and the HTTP/1.1
+// header fields of the response, and for a file X with a sibling X.gz, that file
+// as the gzip representation of X. Paths are kept sorted, so a lookup is a
+// binary search and serving needs neither open() nor stat(): bodies are handed
+// out as pointers into the mapping, which stays mapped while any of them is in use.
+//
+// The layout, in host byte order:
+//   header   magic, version, byte order mark, record count, index offset, file size
+//   bodies   8-byte aligned, page-aligned from 4 KiB up
+//   strings  paths, types, header fields and ETags
+//   index    records sorted by path
+class AssetBundle {
+private:
+  struct representation {
+	uint64_t body_offset;
+	uint64_t body_size;
+	uint64_t fields_offset;
+	uint64_t etag_offset;
+	// 0 when the representation is absent
+	uint32_t fields_size;
+	uint32_t etag_size;
+  };
+  struct record {
+	uint64_t path_offset;
+	uint64_t type_offset;
+	uint32_t path_size;
+	uint32_t type_size;
+	representation plain;
+	representation gzip;
+  };
+  struct header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t count;
+	uint64_t index_offset;
+	uint64_t size;
+  };
+  // Owns the mapping
+  std::shared_ptr<const char> mapping;
+  const record* records = nullptr;
+  size_t count = 0;
+
+  std::string_view string_at(uint64_t offset, uint32_t size) const {
+	return std::string_view(mapping.get() + offset, size);
+  }
+  bool valid(const representation& r, uint64_t size) const;
+public:
+  // Packs the regular files under dir into output; files without an extension are left out
+  static bool pack(const std::string& dir, const std::string& output, const IMimeMapper& mime_mapper, std::string& error);
+  // Maps the bundle at path and checks its index
+  bool load(const std::string& path, std::string& error);
+  size_t size() const { return count; }
+  // Looks up a canonical path such as "/index.html", preferring the gzip
+  // representation when gzip is accepted. The body is not copied.
+  bool open(std::string_view path, bool gzip, Resource& resource) const;
+};
+
+#endif // ASSET_BUNDLE_H
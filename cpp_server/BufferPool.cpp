@@ -0,0 +1,37 @@
+#include "BufferPool.h"
+
+void BufferPool::buffer::reset()
+{
+  if (bytes) {
+	owner->free_buffers.push_back(bytes);
+	owner = nullptr;
+	bytes = nullptr;
+  }
+}
+
+BufferPool::BufferPool(size_t buffer_size, size_t slab_buffers, std::pmr::memory_resource* memory) :
+  buffer_size(buffer_size), slab_buffers(slab_buffers), memory(memory)
+{
+}
+
+BufferPool::~BufferPool()
+{
+  for (char* slab : slabs) {
+	memory->deallocate(slab, buffer_size * slab_buffers);
+  }
+}
+
+BufferPool::buffer BufferPool::acquire()
+{
+  if (free_buffers.empty()) {
+	char* slab = (char*)memory->allocate(buffer_size * slab_buffers);
+	slabs.push_back(slab);
+	// Lent from the front of the slab first
+	for (size_t i = slab_buffers; i-- != 0;) {
+	  free_buffers.push_back(slab + i * buffer_size);
+	}
+  }
+  char* bytes = free_buffers.back();
+  free_buffers.pop_back();
+  return buffer(this, bytes);
+}
@@ -0,0 +1,63 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Fixed-size buffers carved out of slabs and lent out one at a time.
+//
+// A returned buffer goes on a free list and is lent again before any new slab is
+// allocated, so memory settles at the largest number of buffers on loan at once,
+// however many holders come and go. Not thread-safe: each event loop has its own.
+class BufferPool {
+public:
+  // A buffer on loan, given back when reset, reassigned or destroyed. The pool
+  // must outlive it.
+  class buffer {
+	friend BufferPool;
+	BufferPool* owner = nullptr;
+	char* bytes = nullptr;
+	buffer(BufferPool* owner, char* bytes) : owner(owner), bytes(bytes) {}
+  public:
+	buffer() {}
+	buffer(buffer&& other) noexcept : owner(other.owner), bytes(other.bytes) {
+	  other.owner = nullptr;
+	  other.bytes = nullptr;
+	}
+	buffer& operator=(buffer&& other) noexcept {
+	  if (this != &other) {
+		reset();
+		owner = other.owner;
+		bytes = other.bytes;
+		other.owner = nullptr;
+		other.bytes = nullptr;
+	  }
+	  return *this;
+	}
+	~buffer() { reset(); }
+	void reset();
+	char* data() const { return bytes; }
+	size_t capacity() const { return owner ? owner->buffer_size : 0; }
+	explicit operator bool() const { return bytes != nullptr; }
+  };
+private:
+  size_t buffer_size;
+  size_t slab_buffers;
+  std::pmr::memory_resource* memory;
+  std::vector<char*> slabs;
+  std::vector<char*> free_buffers;
+public:
+  // Slabs come from memory, which must outlive the pool
+  explicit BufferPool(size_t buffer_size, size_t slab_buffers = 64,
+	std::pmr::memory_resource* memory = std::pmr::new_delete_resource());
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  ~BufferPool();
+  buffer acquire();
+  size_t capacity() const { return buffer_size; }
+  size_t allocated() const { return slabs.size() * slab_buffers; }
+  size_t in_use() const { return allocated() - free_buffers.size(); }
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,143 @@
+#include "CanonicalPath.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANONICAL_PATH_SSE2
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace {
+  int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+	  return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+	  return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+	  return c - 'A' + 10;
+	}
+	return -1;
+  }
+
+#ifdef CANONICAL_PATH_SSE2
+  unsigned lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return unsigned(__builtin_ctz(mask));
+#endif
+  }
+
+  // Copies the longest prefix of target that is already canonical into out:
+  // no escapes, query, fragment, NUL or backslash, and no segment that is
+  // empty or starts with a dot. Returns its length.
+  size_t copy_plain_prefix(const char* target, size_t length, char* out, size_t capacity) {
+	const __m128i percent = _mm_set1_epi8('%');
+	const __m128i question = _mm_set1_epi8('?');
+	const __m128i hash = _mm_set1_epi8('#');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i dot = _mm_set1_epi8('.');
+	size_t limit = length < capacity ? length : capacity;
+	unsigned carry = 0;
+	size_t i = 0;
+	for (; i + 16 <= limit; i += 16) {
+	  __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+	  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), chunk);
+	  __m128i special = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, question)),
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, hash), _mm_cmpeq_epi8(chunk, backslash)),
+		  _mm_cmpeq_epi8(chunk, zero)));
+	  unsigned slashes = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, slash)));
+	  unsigned dots = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, dot)));
+	  unsigned after_slash = (slashes << 1) | carry;
+	  unsigned stop = (unsigned(_mm_movemask_epi8(special)) | ((slashes | dots) & after_slash)) & 0xffff;
+	  if (stop != 0) {
+		return i + lowest_bit(stop);
+	  }
+	  carry = slashes >> 15;
+	}
+	return i;
+  }
+#endif
+}
+
+CanonicalPath::status CanonicalPath::assign(const char* target, size_t target_length)
+{
+  if (target_length == 0 || target[0] != '/') {
+	return reject(status::malformed);
+  }
+
+  size_t out = 1;
+  size_t i = 1;
+  buffer[0] = '/';
+#ifdef CANONICAL_PATH_SSE2
+  size_t plain = copy_plain_prefix(target, target_length, buffer, max_length);
+  if (plain > 1) {
+	i = out = plain;
+  }
+#endif
+  // start of the segment being written
+  size_t segment = out;
+  while (buffer[segment - 1] != '/') {
+	segment--;
+  }
+
+  for (;; i++) {
+	bool end = i == target_length || target[i] == '?' || target[i] == '#';
+	char c = end ? '/' : target[i];
+	if (!end && c == '%') {
+	  int high = i + 2 < target_length ? hex_value(target[i + 1]) : -1;
+	  int low = i + 2 < target_length ? hex_value(target[i + 2]) : -1;
+	  if (high < 0 || low < 0) {
+		return reject(status::malformed);
+	  }
+	  c = char(high * 16 + low);
+	  i += 2;
+	}
+	if (c == '\0' || c == '\\') {
+	  return reject(status::malformed);
+	}
+	if (c != '/') {
+	  if (out == max_length) {
+		return reject(status::too_long);
+	  }
+	  buffer[out++] = c;
+	  continue;
+	}
+
+	// A segment is complete: drop ".", pop the previous segment for ".."
+	size_t segment_length = out - segment;
+	if (segment_length == 1 && buffer[segment] == '.') {
+	  out = segment;
+	} else if (segment_length == 2 && buffer[segment] == '.' && buffer[segment + 1] == '.') {
+	  if (segment == 1) {
+		return reject(status::traversal);
+	  }
+	  out = segment - 1;
+	  while (buffer[out - 1] != '/') {
+		out--;
+	  }
+	  segment = out;
+	}
+	if (end) {
+	  break;
+	}
+	if (out != segment) {
+	  if (out == max_length) {
+		return reject(status::too_long);
+	  }
+	  buffer[out++] = '/';
+	  segment = out;
+	}
+  }
+  buffer[out] = '\0';
+  length = out;
+  return status::ok;
+}
@@ -0,0 +1,41 @@
+#ifndef CANONICAL_PATH_H
+#define CANONICAL_PATH_H
+
+#include <cstddef>
+#include <string_view>
+
+// Canonical form of a request target, usable as a cache key.
+//
+// assign() percent-decodes, drops the query and fragment, collapses "//", "." and ".."
+// and rejects NUL bytes, backslashes and any ".." that would climb above the root.
+// It makes a single pass over the target and writes into the fixed buffer below,
+// so it never allocates. Runs of plain characters are copied 16 bytes at a time
+// when SSE2 is available.
+class CanonicalPath {
+public:
+  static const size_t max_length = 1024;
+  enum class status {
+	ok,
+	malformed,
+	traversal,
+	too_long,
+  };
+private:
+  char buffer[max_length + 1];
+  size_t length = 0;
+  status reject(status s) {
+	buffer[0] = '\0';
+	length = 0;
+	return s;
+  }
+public:
+  CanonicalPath() { buffer[0] = '\0'; }
+  status assign(const char* target, size_t target_length);
+  status assign(std::string_view target) { return assign(target.data(), target.size()); }
+  const char* c_str() const { return buffer; }
+  size_t size() const { return length; }
+  std::string_view view() const { return std::string_view(buffer, length); }
+  bool is_directory() const { return length != 0 && buffer[length - 1] == '/'; }
+};
+
+#endif // CANONICAL_PATH_H
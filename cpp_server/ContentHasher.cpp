@@ -0,0 +1,358 @@
+#include "ContentHasher.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Files queued beyond this are dropped; they are queued again when next requested
+static const size_t MAX_QUEUED = 1 << 16;
+static const size_t READ_CHUNK_SIZE = 256 << 10;
+// Slots of the hash table to start with; a power of two
+static const size_t INITIAL_CAPACITY = 1024;
+// Separates, in the index, what a run kept from what it used
+static const char RUN_MARKER[] = "-";
+
+// XXH64, fed in pieces
+class Xxh64 {
+private:
+  static const uint64_t PRIME1 = 11400714785074694791ull;
+  static const uint64_t PRIME2 = 14029467366897019727ull;
+  static const uint64_t PRIME3 = 1609587929392839161ull;
+  static const uint64_t PRIME4 = 9650029242287828579ull;
+  static const uint64_t PRIME5 = 2870177450012600261ull;
+  uint64_t lanes[4];
+  uint64_t length = 0;
+  unsigned char pending[32];
+  size_t pending_size = 0;
+
+  static uint64_t rotate(uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+  static uint64_t read64(const unsigned char* p) {
+	uint64_t value = 0;
+	for (int i = 8; i-- != 0;) {
+	  value = value << 8 | p[i];
+	}
+	return value;
+  }
+  static uint64_t round(uint64_t lane, uint64_t input) {
+	return rotate(lane + input * PRIME2, 31) * PRIME1;
+  }
+  static uint64_t merge(uint64_t hash, uint64_t lane) {
+	return (hash ^ round(0, lane)) * PRIME1 + PRIME4;
+  }
+  void stripe(const unsigned char* p) {
+	for (int i = 0; i != 4; i++) {
+	  lanes[i] = round(lanes[i], read64(p + 8 * i));
+	}
+  }
+public:
+  Xxh64() : lanes{ PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 } {}
+  void update(const unsigned char* data, size_t size) {
+	length += size;
+	if (pending_size != 0) {
+	  size_t taken = std::min(size, sizeof(pending) - pending_size);
+	  memcpy(pending + pending_size, data, taken);
+	  pending_size += taken;
+	  data += taken;
+	  size -= taken;
+	  if (pending_size != sizeof(pending)) {
+		return;
+	  }
+	  stripe(pending);
+	  pending_size = 0;
+	}
+	for (; size >= 32; data += 32, size -= 32) {
+	  stripe(data);
+	}
+	memcpy(pending, data, size);
+	pending_size = size;
+  }
+  uint64_t digest() const {
+	uint64_t hash;
+	if (length >= 32) {
+	  hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+	  for (int i = 0; i != 4; i++) {
+		hash = merge(hash, lanes[i]);
+	  }
+	} else {
+	  hash = PRIME5;
+	}
+	hash += length;
+	const unsigned char* p = pending;
+	const unsigned char* end = pending + pending_size;
+	for (; end - p >= 8; p += 8) {
+	  hash = rotate(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+	}
+	if (end - p >= 4) {
+	  uint64_t word = uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24;
+	  hash = rotate(hash ^ word * PRIME1, 23) * PRIME2 + PRIME3;
+	  p += 4;
+	}
+	for (; p != end; p++) {
+	  hash = rotate(hash ^ *p * PRIME5, 11) * PRIME1;
+	}
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+  }
+};
+
+std::string_view ContentHasher::metadata_etag(uint64_t inode, uint64_t size, int64_t modified, char* etag)
+{
+  int length = snprintf(etag, metadata_etag_size, "\"%llx-%llx-%llx\"", (unsigned long long)inode,
+	(unsigned long long)size, (unsigned long long)modified);
+  return std::string_view(etag, size_t(length));
+}
+
+ContentHasher::table::table(size_t capacity) :
+  mask(capacity - 1), slots(new std::atomic<entry*>[capacity])
+{
+  for (size_t i = 0; i != capacity; i++) {
+	slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+std::atomic<ContentHasher::entry*>& ContentHasher::table::slot(std::string_view metadata) const
+{
+  for (size_t i = std::hash<std::string_view>()(metadata) & mask;; i = (i + 1) & mask) {
+	entry* e = slots[i].load(std::memory_order_acquire);
+	if (!e || e->metadata == metadata) {
+	  return slots[i];
+	}
+  }
+}
+
+ContentHasher::entry* ContentHasher::table::find(std::string_view metadata) const
+{
+  return slot(metadata).load(std::memory_order_acquire);
+}
+
+ContentHasher::ContentHasher(const std::string& index_path, unsigned thread_count) :
+  hashes(new table(INITIAL_CAPACITY))
+{
+  // Later lines win. The index was last written as what the run before kept, a
+  // marker line, then what its run hashed or looked up; the files below the marker
+  // are those kept now. An index without the marker, or with nothing below it, is
+  // kept whole.
+  {
+	std::ifstream in(index_path);
+	std::unordered_map<std::string, std::pair<std::string, bool>> loaded;
+	bool marked = false;
+	bool touched = false;
+	std::string line;
+	while (std::getline(in, line)) {
+	  if (line == RUN_MARKER) {
+		marked = true;
+		continue;
+	  }
+	  std::istringstream fields(line);
+	  std::string metadata, content;
+	  if (fields >> metadata >> content) {
+		loaded[metadata] = std::make_pair(content, marked);
+		touched = touched || marked;
+	  }
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	for (const auto& file : loaded) {
+	  if (!touched || file.second.second) {
+		insert(file.first, file.second.first, false);
+	  }
+	}
+  }
+  index.open(index_path, std::ios::trunc);
+  for (const entry& e : entries) {
+	index << e.metadata << ' ' << e.content << '\n';
+  }
+  index << RUN_MARKER << '\n';
+  index.flush();
+  for (unsigned i = 0; i != thread_count; i++) {
+	threads.emplace_back(&ContentHasher::hash_files, this);
+  }
+}
+
+ContentHasher::~ContentHasher()
+{
+  {
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = true;
+  }
+  work.notify_all();
+  for (std::thread& thread : threads) {
+	thread.join();
+  }
+}
+
+void ContentHasher::insert(const std::string& metadata, const std::string& content, bool used)
+{
+  entries.emplace_back(metadata, content, used);
+  entry* added = &entries.back();
+  table* current = hashes.operator->();
+  std::atomic<entry*>& slot = current->slot(metadata);
+  if (slot.load(std::memory_order_relaxed)) {
+	// Readers holding the old entry may still use it
+	slot.store(added, std::memory_order_release);
+	return;
+  }
+  count++;
+  if (count * 2 <= current->mask + 1) {
+	slot.store(added, std::memory_order_release);
+	return;
+  }
+  // At half full, the entries move to a table twice as large, which replaces this one
+  table* grown = new table((current->mask + 1) * 2);
+  for (size_t i = 0; i <= current->mask; i++) {
+	if (entry* e = current->slots[i].load(std::memory_order_relaxed)) {
+	  grown->slot(e->metadata).store(e, std::memory_order_relaxed);
+	}
+  }
+  grown->slot(metadata).store(added, std::memory_order_relaxed);
+  hashes.publish(grown);
+}
+
+void ContentHasher::touch(entry& found)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (!found.used.load(std::memory_order_relaxed)) {
+	found.used.store(true, std::memory_order_relaxed);
+	index << found.metadata << ' ' << found.content << '\n';
+	index.flush();
+  }
+}
+
+void ContentHasher::lookup(std::string_view path, std::pmr::string& etag)
+{
+  if (entry* found = hashes->find(etag)) {
+	if (!found->used.load(std::memory_order_relaxed)) {
+	  touch(*found);
+	}
+	etag = found->content;
+	return;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  // Only a file not queued yet is copied
+  if (queue.size() < MAX_QUEUED && queued.find(etag) == queued.end()) {
+	queued.emplace(etag);
+	queue.emplace_back(std::string(path), std::string(etag));
+	work.notify_one();
+  }
+}
+
+size_t ContentHasher::size()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return count;
+}
+
+// The metadata ETag of an open file
+static bool describe(int fd, std::string& metadata) {
+  char etag[ContentHasher::metadata_etag_size];
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_fstat64(fd, &st) != 0) {
+	return false;
+  }
+  metadata = ContentHasher::metadata_etag(0, uint64_t(st.st_size), int64_t(st.st_mtime), etag);
+#else
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+	return false;
+  }
+#ifdef __linux__
+  metadata = ContentHasher::metadata_etag(uint64_t(st.st_ino), uint64_t(st.st_size),
+	int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, etag);
+#else
+  metadata = ContentHasher::metadata_etag(uint64_t(st.st_ino), uint64_t(st.st_size), int64_t(st.st_mtime), etag);
+#endif
+#endif
+  return true;
+}
+
+// Hashes the file at path, setting the metadata ETag of what was read; false if
+// it could not be read or changed while it was
+bool ContentHasher::hash_file(const std::string& path, std::string& metadata, uint64_t& hash)
+{
+#ifdef _WIN32
+  int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+  if (fd == -1) {
+	return false;
+  }
+  Xxh64 state;
+  std::vector<unsigned char> chunk(READ_CHUNK_SIZE);
+  std::string after;
+  bool complete = describe(fd, metadata);
+  while (complete) {
+#ifdef _WIN32
+	int got = _read(fd, chunk.data(), unsigned(chunk.size()));
+#else
+	ssize_t got = read(fd, chunk.data(), chunk.size());
+#endif
+	if (got <= 0) {
+	  complete = got == 0 && describe(fd, after) && after == metadata;
+	  break;
+	}
+	state.update(chunk.data(), size_t(got));
+  }
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+  hash = state.digest();
+  return complete;
+}
+
+void ContentHasher::hash_files()
+{
+  // Requests come first, both for the CPU and for the disk
+#ifdef _WIN32
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+  setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 19);
+  // IOPRIO_WHO_PROCESS of this thread, IOPRIO_CLASS_IDLE
+  syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+	work.wait(guard, [this] { return stopping || !queue.empty(); });
+	if (stopping) {
+	  return;
+	}
+	std::pair<std::string, std::string> file = std::move(queue.front());
+	queue.pop_front();
+	guard.unlock();
+	std::string metadata;
+	uint64_t hash;
+	bool hashed = hash_file(file.first, metadata, hash);
+	guard.lock();
+	queued.erase(std::pmr::string(file.second));
+	// A file changed since it was queued is hashed under its new metadata
+	if (hashed) {
+	  char etag[20];
+	  snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+	  insert(metadata, etag, true);
+	  index << metadata << ' ' << etag << '\n';
+	  index.flush();
+	}
+  }
+}
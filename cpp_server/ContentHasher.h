@@ -0,0 +1,96 @@
+#ifndef CONTENT_HASHER_H
+#define CONTENT_HASHER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "Rcu.h"
+
+// Strong ETags from file contents, computed off the request path.
+//
+// Files are known by their metadata ETag (inode, size and modification time).
+// A lookup of a file whose contents have been hashed yields the XXH64 of the
+// contents, which stays the same across servers and redeploys. Otherwise the file
+// is queued for the background threads, which run at the lowest CPU and I/O
+// priority, and the caller keeps the metadata ETag meanwhile. Every hash is
+// appended to a sidecar index, read back at startup, so a restart does not hash
+// unchanged files again. The index only keeps, from one run to the next, the
+// files that were hashed or looked up during the run.
+//
+// Hits take no lock: the hashes are in an open-addressing table that only the
+// hashing threads change, one at a time, and that is replaced through an
+// RcuPointer when it grows.
+class ContentHasher {
+private:
+  struct entry {
+	std::string metadata;
+	std::string content;
+	// Hashed or looked up during this run, and so kept by the next
+	std::atomic<bool> used;
+	entry(const std::string& metadata, const std::string& content, bool used) :
+	  metadata(metadata), content(content), used(used) {}
+  };
+  struct table {
+	size_t mask;
+	std::unique_ptr<std::atomic<entry*>[]> slots;
+	// capacity is a power of two
+	explicit table(size_t capacity);
+	entry* find(std::string_view metadata) const;
+	// The slot of metadata, or the empty one it would take
+	std::atomic<entry*>& slot(std::string_view metadata) const;
+  };
+  // Metadata ETag -> content ETag
+  RcuPointer<table> hashes;
+  // Owns the entries of the table, including replaced ones that readers may still
+  // hold; stable addresses
+  std::deque<entry> entries;
+  // Files in the table
+  size_t count = 0;
+  std::mutex lock;
+  // Files waiting for a thread, with their metadata ETags
+  std::deque<std::pair<std::string, std::string>> queue;
+  std::unordered_set<std::pmr::string> queued;
+  std::condition_variable work;
+  bool stopping = false;
+  std::ofstream index;
+  std::vector<std::thread> threads;
+
+  // Adds or replaces the hash of a file, growing the table; the lock must be held
+  void insert(const std::string& metadata, const std::string& content, bool used);
+  // Records in the index that a file from an earlier run was looked up
+  void touch(entry& found);
+  void hash_files();
+  static bool hash_file(const std::string& path, std::string& metadata, uint64_t& hash);
+public:
+  // Room for a metadata ETag and a terminating NUL
+  static const size_t metadata_etag_size = 56;
+
+  // Reads the index at index_path and starts the threads
+  ContentHasher(const std::string& index_path, unsigned thread_count);
+  ContentHasher(const ContentHasher&) = delete;
+  ContentHasher& operator=(const ContentHasher&) = delete;
+  // Abandons queued files and waits for the threads
+  ~ContentHasher();
+  // Replaces the metadata ETag of the file at path with its content ETag when that
+  // is known; queues the file for hashing otherwise. The caller must be a
+  // registered Rcu reader.
+  void lookup(std::string_view path, std::pmr::string& etag);
+  size_t size();
+  // The ETag of a file as far as its metadata tells, written to etag, which holds
+  // metadata_etag_size chars; modified in nanoseconds where available
+  static std::string_view metadata_etag(uint64_t inode, uint64_t size, int64_t modified, char* etag);
+};
+
+#endif // CONTENT_HASHER_H
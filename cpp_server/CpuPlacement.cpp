@@ -0,0 +1,84 @@
+#include "CpuPlacement.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+std::vector<unsigned> CpuPlacement::allowed_cpus()
+{
+  std::vector<unsigned> cpus;
+#ifdef _WIN32
+  DWORD_PTR process_mask, system_mask;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+	for (unsigned cpu = 0; cpu != sizeof(process_mask) * 8; cpu++) {
+	  if (process_mask & (DWORD_PTR(1) << cpu)) {
+		cpus.push_back(cpu);
+	  }
+	}
+  }
+#elif defined(__linux__)
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+	for (unsigned cpu = 0; cpu != CPU_SETSIZE; cpu++) {
+	  if (CPU_ISSET(cpu, &set)) {
+		cpus.push_back(cpu);
+	  }
+	}
+  }
+#endif
+  if (cpus.empty()) {
+	for (unsigned cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++) {
+	  cpus.push_back(cpu);
+	}
+  }
+  return cpus;
+}
+
+int CpuPlacement::node_of(unsigned cpu)
+{
+#ifdef _WIN32
+  UCHAR node;
+  if (cpu < 256 && GetNumaProcessorNode(UCHAR(cpu), &node) && node != 0xff) {
+	return int(node);
+  }
+#elif defined(__linux__)
+  // The directory of the CPU links to its node as nodeN
+  std::error_code error;
+  std::filesystem::directory_iterator it("/sys/devices/system/cpu/cpu" + std::to_string(cpu), error);
+  for (; !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+	std::string name = it->path().filename().string();
+	if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name.find_first_not_of("0123456789", 4) == std::string::npos) {
+	  return std::atoi(name.c_str() + 4);
+	}
+  }
+#else
+  (void)cpu;
+#endif
+  return -1;
+}
+
+bool CpuPlacement::pin_current_thread(unsigned cpu)
+{
+#ifdef _WIN32
+  return cpu < sizeof(DWORD_PTR) * 8 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+  if (cpu >= CPU_SETSIZE) {
+	return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
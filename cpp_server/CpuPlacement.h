@@ -0,0 +1,18 @@
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include <vector>
+
+// Where threads run: the CPUs this process may use, the NUMA node each belongs
+// to, and pinning a thread to one of them. Linux reads the nodes from sysfs and
+// Windows asks the system; elsewhere nodes are unknown and threads cannot be pinned.
+class CpuPlacement {
+public:
+  // In ascending order
+  static std::vector<unsigned> allowed_cpus();
+  // -1 if unknown
+  static int node_of(unsigned cpu);
+  static bool pin_current_thread(unsigned cpu);
+};
+
+#endif // CPU_PLACEMENT_H
@@ -0,0 +1,281 @@
+#include "FileCache.h"
+#include "ContentHasher.h"
+#include "ServerPolicies.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool FileCache::stat_file(const char* path, int fd, identity& id)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  int result = fd != -1 ? _fstat64(fd, &st) : _stat64(path, &st);
+  if (result != 0 || (st.st_mode & _S_IFMT) != _S_IFREG) {
+	return false;
+  }
+  id.modified = int64_t(st.st_mtime);
+#else
+  struct stat st;
+  int result = fd != -1 ? fstat(fd, &st) : stat(path, &st);
+  if (result != 0 || !S_ISREG(st.st_mode)) {
+	return false;
+  }
+  id.inode = uint64_t(st.st_ino);
+#ifdef __linux__
+  id.modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+  id.modified = int64_t(st.st_mtime);
+#endif
+#endif
+  id.device = uint64_t(st.st_dev);
+  id.size = uint64_t(st.st_size);
+  return true;
+}
+
+// The whole file, or null if it cannot be read or is larger than max_size
+std::shared_ptr<const std::pmr::string> FileCache::read_file(const char* path, size_t max_size, identity& id,
+  std::pmr::memory_resource* memory)
+{
+  std::shared_ptr<std::pmr::string> data;
+#ifdef _WIN32
+  int fd = _open(path, _O_RDONLY | _O_BINARY);
+#else
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+#endif
+  if (fd == -1) {
+	return data;
+  }
+  if (stat_file(path, fd, id) && id.size <= max_size) {
+	// The allocator is passed on to the string, so the string, its contents and
+	// the count of its holders all come from memory
+	data = std::allocate_shared<std::pmr::string>(
+	  std::pmr::polymorphic_allocator<std::pmr::string>(memory), size_t(id.size), '\0');
+	size_t done = 0;
+	while (done != data->size()) {
+#ifdef _WIN32
+	  int got = _read(fd, &(*data)[done], unsigned(data->size() - done));
+#else
+	  ssize_t got = read(fd, &(*data)[done], data->size() - done);
+#endif
+	  if (got <= 0) {
+		data.reset();
+		break;
+	  }
+	  done += size_t(got);
+	}
+  }
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+  return data;
+}
+
+FileCache::FileCache() : lock_failures(0), hits(0), loads(0), coalesced(0)
+{
+  for (shard& s : shards) {
+	s.memory = &HugePageHeap::shared();
+  }
+}
+
+FileCache::shard& FileCache::shard_of(std::string_view path)
+{
+  // The high bits, as the maps of the shards use the low ones
+  return shards[(std::hash<std::string_view>()(path) >> 16) % SHARDS];
+}
+
+bool FileCache::open(const std::pmr::string& path, Resource& resource)
+{
+  bool pending;
+  if (try_open(path, resource, pending, std::function<void()>())) {
+	return true;
+  }
+  return pending && NoCache().open(path, resource);
+}
+
+bool FileCache::try_open(const std::pmr::string& path, Resource& resource, bool& pending,
+  const std::function<void()>& wake)
+{
+  pending = false;
+  identity id;
+  if (!stat_file(path.c_str(), -1, id)) {
+	return false;
+  }
+  shard& s = shard_of(path);
+  std::unique_lock<std::mutex> guard(s.lock);
+  if (id.size > s.max_file_size || id.size > s.capacity) {
+	guard.unlock();
+	return NoCache().open(path, resource);
+  }
+  auto it = s.entries.find(path);
+  if (it != s.entries.end()) {
+	entry& e = it->second;
+	if (!e.data) {
+	  // Another request is reading the file; its result serves this one too
+	  if (wake) {
+		coalesced++;
+		e.waiters.push_back(wake);
+	  }
+	  pending = true;
+	  return false;
+	}
+	if (e.id == id) {
+	  hits++;
+	  s.recency.splice(s.recency.begin(), s.recency, e.position);
+	  resource.data = std::shared_ptr<const char>(e.data, e.data->data());
+	  resource.size = e.data->size();
+	  char etag[ContentHasher::metadata_etag_size];
+	  resource.etag = ContentHasher::metadata_etag(id.inode, id.size, id.modified, etag);
+	  return true;
+	}
+	// The file changed since it was cached
+	erase(s, it);
+  }
+
+  // Requests for the path arriving meanwhile find the placeholder and are parked
+  s.entries[path].position = s.recency.end();
+  size_t limit = s.max_file_size;
+  std::pmr::memory_resource* target = s.memory;
+  guard.unlock();
+  loads++;
+  std::shared_ptr<const std::pmr::string> data = read_file(path.c_str(), limit, id, target);
+  guard.lock();
+  it = s.entries.find(path);
+  std::vector<std::function<void()>> waiters = std::move(it->second.waiters);
+  if (!data) {
+	s.entries.erase(it);
+	guard.unlock();
+	for (const auto& waiter : waiters) {
+	  waiter();
+	}
+	return NoCache().open(path, resource);
+  }
+  it->second.id = id;
+  it->second.data = data;
+  it->second.position = s.recency.insert(s.recency.begin(), path);
+  s.used += data->size();
+  if (s.locked) {
+	lock_contents(*data);
+  }
+  evict(s);
+  guard.unlock();
+  for (const auto& waiter : waiters) {
+	waiter();
+  }
+  resource.data = std::shared_ptr<const char>(data, data->data());
+  resource.size = data->size();
+  char etag[ContentHasher::metadata_etag_size];
+  resource.etag = ContentHasher::metadata_etag(id.inode, id.size, id.modified, etag);
+  return true;
+}
+
+void FileCache::erase(shard& s, std::unordered_map<std::pmr::string, entry>::iterator it)
+{
+  const std::pmr::string& data = *it->second.data;
+  s.used -= data.size();
+  if (s.locked) {
+	unlock_contents(data);
+  }
+  s.recency.erase(it->second.position);
+  s.entries.erase(it);
+}
+
+void FileCache::evict(shard& s)
+{
+  while (s.used > s.capacity && !s.recency.empty()) {
+	erase(s, s.entries.find(s.recency.back()));
+  }
+}
+
+void FileCache::lock_contents(const std::pmr::string& data)
+{
+  if (data.empty()) {
+	return;
+  }
+#ifdef _WIN32
+  bool done = VirtualLock(const_cast<char*>(data.data()), data.size()) != 0;
+#else
+  bool done = mlock(data.data(), data.size()) == 0;
+#endif
+  if (!done) {
+	lock_failures++;
+  }
+}
+
+void FileCache::unlock_contents(const std::pmr::string& data)
+{
+  if (data.empty()) {
+	return;
+  }
+#ifdef _WIN32
+  VirtualUnlock(const_cast<char*>(data.data()), data.size());
+#else
+  munlock(data.data(), data.size());
+#endif
+}
+
+void FileCache::lock_memory(bool enabled)
+{
+  for (shard& s : shards) {
+	std::lock_guard<std::mutex> guard(s.lock);
+	if (s.locked == enabled) {
+	  continue;
+	}
+	s.locked = enabled;
+	for (const auto& e : s.entries) {
+	  if (!e.second.data) {
+		continue;
+	  }
+	  if (enabled) {
+		lock_contents(*e.second.data);
+	  } else {
+		unlock_contents(*e.second.data);
+	  }
+	}
+  }
+}
+
+void FileCache::configure(size_t capacity, size_t max_file_size)
+{
+  for (shard& s : shards) {
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.capacity = capacity / SHARDS;
+	s.max_file_size = max_file_size;
+	evict(s);
+  }
+}
+
+void FileCache::set_memory(std::pmr::memory_resource* memory)
+{
+  for (shard& s : shards) {
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.memory = memory;
+  }
+}
+
+void FileCache::report(std::ostream& out) const
+{
+  size_t bytes = 0;
+  size_t files = 0;
+  for (const shard& s : shards) {
+	std::lock_guard<std::mutex> guard(s.lock);
+	bytes += s.used;
+	files += s.recency.size();
+  }
+  out << "cache_files " << files << '\n'
+	<< "cache_bytes " << bytes << '\n'
+	<< "cache_hits " << hits.load() << '\n'
+	<< "cache_loads " << loads.load() << '\n'
+	<< "cache_coalesced " << coalesced.load() << '\n'
+	<< "cache_lock_failures " << lock_failures.load() << '\n';
+}
@@ -0,0 +1,105 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "HugePageHeap.h"
+#include "Resource.h"
+
+// CachePolicy keeping the contents of small files in memory.
+//
+// Every lookup stats the file, so a changed file is never served from memory.
+// Loads are single-flight: the first miss for a path reads the file while later
+// requests for the same path, from any thread, are parked until that read is
+// done and then share its buffer instead of going to the disk themselves; no
+// thread waits for another. Contents are kept in the huge page heap, or wherever
+// set_memory() says. Larger files, and every file when the capacity is 0, are
+// opened as before. The entries are spread over shards by path, each with its own
+// lock and an equal part of the capacity; least recently used entries of a shard
+// go once its contents exceed its part.
+class FileCache {
+private:
+  // What a cached copy is checked against
+  struct identity {
+	uint64_t device = 0;
+	uint64_t inode = 0;
+	uint64_t size = 0;
+	int64_t modified = 0;
+	bool operator==(const identity& other) const {
+	  return device == other.device && inode == other.inode && size == other.size && modified == other.modified;
+	}
+  };
+  struct entry {
+	identity id;
+	// null while the file is being read
+	std::shared_ptr<const std::pmr::string> data;
+	std::list<std::pmr::string>::iterator position;
+	// Called once the file is read, for the requests parked on it
+	std::vector<std::function<void()>> waiters;
+  };
+  struct shard {
+	mutable std::mutex lock;
+	// Keyed like the paths requests come with, so that lookups need no conversion
+	std::unordered_map<std::pmr::string, entry> entries;
+	// Most recently used first
+	std::list<std::pmr::string> recency;
+	size_t used = 0;
+	// Its part of the capacity, in bytes of file contents
+	size_t capacity = (64 << 20) / SHARDS;
+	size_t max_file_size = 1 << 20;
+	std::pmr::memory_resource* memory = nullptr;
+	// Contents are locked into memory
+	bool locked = false;
+  };
+  static const size_t SHARDS = 16;
+  shard shards[SHARDS];
+  std::atomic<uint64_t> lock_failures;
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> loads;
+  std::atomic<uint64_t> coalesced;
+
+  // Identifies the open file fd, or path when fd is -1; false if it is not a regular file
+  static bool stat_file(const char* path, int fd, identity& id);
+  static std::shared_ptr<const std::pmr::string> read_file(const char* path, size_t max_size, identity& id,
+	std::pmr::memory_resource* memory);
+  shard& shard_of(std::string_view path);
+  void evict(shard& s);
+  void lock_contents(const std::pmr::string& data);
+  void unlock_contents(const std::pmr::string& data);
+  // Drops the entry of a loaded file
+  void erase(shard& s, std::unordered_map<std::pmr::string, entry>::iterator it);
+public:
+  FileCache();
+  FileCache(const FileCache&) = delete;
+  FileCache& operator=(const FileCache&) = delete;
+  // Opens path if it is a regular file, with its contents in memory when they are cached,
+  // and sets its metadata ETag. A file another request is reading is opened from
+  // the disk rather than waited for.
+  bool open(const std::pmr::string& path, Resource& resource);
+  // Like open, but a file another request is reading is left to it: pending is set,
+  // and wake, when not empty, is called once the read is done, from the thread that
+  // did it, for the request to be handled again
+  bool try_open(const std::pmr::string& path, Resource& resource, bool& pending, const std::function<void()>& wake);
+  // The capacity is shared out between the shards; shrinking drops entries at once
+  void configure(size_t capacity, size_t max_file_size);
+  // Where contents read from now on are kept; memory must outlive their holders
+  void set_memory(std::pmr::memory_resource* memory);
+  // Keeps cached contents from being paged out, from now on. Locks are per page,
+  // so unlocking an evicted entry may unlock the edges of its neighbours.
+  void lock_memory(bool enabled);
+  // Counters as "name value" lines
+  void report(std::ostream& out) const;
+};
+
+#endif // FILE_CACHE_H
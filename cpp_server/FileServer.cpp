@@ -1,7 +1,39 @@
 #include "FileServer.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <thread>
 #include <unordered_map>
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+
 const int REQ_BUF_SIZE = 8192;
+// Most request heads fit a small receive buffer; the large one bounds their size
+const size_t RECEIVE_BUFFER_SIZE = 4 << 10;
+const size_t LARGE_RECEIVE_BUFFER_SIZE = REQ_BUF_SIZE;
+const size_t BUFFER_POOL_SLAB_BUFFERS = 64;
+// Bodies up to this size are read into the response head, so consecutive
+// pipelined responses leave in a single gather write
+const uint64_t INLINE_BODY_LIMIT = 16 << 10;
+const size_t MAX_GATHER = 64;
+// Heads up to this size, inlined bodies included, come from the pools of freed blocks
+const size_t RESPONSE_POOL_BLOCK_LIMIT = 2 * INLINE_BODY_LIMIT;
+// How long input is still read and dropped after the end of an HTTP/2 stream went out
+const auto LINGER_TIME = std::chrono::seconds(2);
+const size_t PRELOAD_CHUNK_SIZE = 256 << 10;
+const size_t SPLICE_PIPE_SIZE = 256 << 10;
+// Made by each worker before it starts; more are made as connections stall
+const size_t SPLICE_PIPES_RESERVED = 16;
 
 std::string getErrorMessage() {
   char buf[256];
@@ -15,159 +47,2072 @@ std::string getErrorMessage() {
   return std::string(buf);
 }
 
+static bool would_block() {
+#ifdef _WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Client sockets must not leak into a successor process
+static void set_close_on_exec(SOCKET sock) {
+#ifndef _WIN32
+  fcntl(sock, F_SETFD, fcntl(sock, F_GETFD) | FD_CLOEXEC);
+#endif
+}
+
+static bool set_non_blocking(SOCKET sock) {
+#ifdef _WIN32
+  u_long mode = 1;
+  return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+  int flags = fcntl(sock, F_GETFL, 0);
+  return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Reads exactly count bytes from the current position
+static bool read_file(int fd, char* buf, size_t count) {
+  while (count != 0) {
+#ifdef _WIN32
+	int got = _read(fd, buf, unsigned(std::min<size_t>(count, INT_MAX)));
+#else
+	ssize_t got = read(fd, buf, count);
+#endif
+	if (got <= 0) {
+	  return false;
+	}
+	buf += got;
+	count -= size_t(got);
+  }
+  return true;
+}
+
+// Reads the first count bytes of a direct stream into buf
+static bool read_stream(BodyStream& stream, char* buf, size_t count) {
+  for (uint64_t offset = 0; offset != count;) {
+	size_t got = count - size_t(offset);
+	const char* data = stream.read(offset, got);
+	if (!data || got == 0) {
+	  return false;
+	}
+	memcpy(buf + offset, data, got);
+	offset += got;
+	stream.sent(offset);
+  }
+  return true;
+}
+
+static void close_file(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::connection(worker& owner) :
+  responses(&owner.response_memory), owner(owner)
+{
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::~connection()
+{
+  // The TLS session may still write close_notify to the socket
+  tls.reset();
+  for (response& r : responses) {
+	if (r.file != -1) {
+	  close_file(r.file);
+	}
+  }
+  if (socket == INVALID_SOCKET) {
+	return;
+  }
+  if (zerocopy_pins.empty()) {
+	closesocket(socket);
+	return;
+  }
+  // The kernel still sends from bodies held for it. The peer is sent the end of the
+  // stream after them, as on close, and the socket is closed once they are released.
+  shutdown(socket, SHUT_WR);
+  owner.lingering.emplace_back(socket, std::move(zerocopy_pins));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_some(size_t limit)
+{
+  // What is written in one go leaves in full segments, the rest when uncorked
+  bool cork = owner.cork && addr.ss_family != AF_UNIX;
+  if (cork) {
+	IoEngine::cork(socket, true);
+  }
+  long long written = h2 ? h2->write_some(*this, limit) : write_responses(limit);
+  if (cork) {
+	IoEngine::cork(socket, false);
+  }
+  broken = written < 0;
+  return written;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_responses(size_t limit)
+{
+  long long written = 0;
+  while (!responses.empty() && limit != 0) {
+	response& front = responses.front();
+	long long sent;
+	if (front.head_sent < front.head.size()) {
+	  sent = write_heads(limit);
+	} else if (front.body_remaining != 0) {
+	  size_t count = size_t(std::min<uint64_t>(limit, front.body_remaining));
+	  sent = front.data ? write_data(front.data, front.body_offset, count) :
+		write_file(front.file, front.stream.get(), front.body_offset, count);
+	  if (sent > 0) {
+		front.body_offset += sent;
+		front.body_remaining -= sent;
+	  }
+	} else {
+	  if (front.file != -1) {
+		close_file(front.file);
+	  }
+	  responses.pop_front();
+	  continue;
+	}
+	if (sent <= 0) {
+	  // An error shows up again on the next attempt
+	  return written != 0 ? written : sent;
+	}
+	written += sent;
+	limit -= size_t(sent);
+  }
+  // Completed responses must not count against the pipeline depth
+  while (!responses.empty() && responses.front().head_sent == responses.front().head.size() &&
+	responses.front().body_remaining == 0) {
+	if (responses.front().file != -1) {
+	  close_file(responses.front().file);
+	}
+	responses.pop_front();
+  }
+  return written;
+}
+
+// Writes the head of the first response and, as long as no file body has to go
+// in between, the heads of the responses after it in the same call
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_heads(size_t limit)
+{
+  if (tls) {
+	// One head per TLS record
+	response& front = responses.front();
+	long long sent = tls->write(front.head.data() + front.head_sent, std::min(limit, front.head.size() - front.head_sent));
+	if (sent > 0) {
+	  front.head_sent += size_t(sent);
+	}
+	return sent;
+  }
+  typename IoEngine::buffer buffers[MAX_GATHER];
+  size_t count = 0;
+  size_t total = 0;
+  bool more = false;
+  for (const response& r : responses) {
+	if (count == MAX_GATHER || total == limit) {
+	  break;
+	}
+	size_t size = std::min(r.head.size() - r.head_sent, limit - total);
+	buffers[count++] = IoEngine::make_buffer(r.head.data() + r.head_sent, size);
+	total += size;
+	if (r.body_remaining != 0) {
+	  more = true;
+	  break;
+	}
+  }
+  long long sent = IoEngine::send_buffers(socket, buffers, count, more);
+  if (sent == SOCKET_ERROR) {
+	return would_block() ? 0 : -1;
+  }
+  size_t left = size_t(sent);
+  for (response& r : responses) {
+	size_t size = std::min(left, r.head.size() - r.head_sent);
+	r.head_sent += size;
+	left -= size;
+	if (left == 0) {
+	  break;
+	}
+  }
+  return sent;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+uint64_t BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::remaining() const
+{
+  if (h2) {
+	return h2->pending();
+  }
+  uint64_t total = 0;
+  for (const response& r : responses) {
+	total += r.head.size() - r.head_sent + r.body_remaining;
+  }
+  return total;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+uint64_t BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::backlog() const
+{
+  return h2 ? h2->unsent() : remaining();
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_bytes(const char* data, size_t size, bool more)
+{
+  if (tls) {
+	return tls->write(data, size);
+  }
+  // A DATA frame header is followed by its payload; more keeps them in one segment
+  long long sent = IoEngine::send(socket, data, size, more);
+  if (sent == SOCKET_ERROR) {
+	return would_block() ? 0 : -1;
+  }
+  return sent;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_file(int fd, BodyStream* stream, uint64_t offset, size_t count)
+{
+  long long sent;
+  if (stream && stream->direct()) {
+	// From the buffer the file was read into, or the body made; a piece shorter
+	// than asked for is followed at once by the next
+	size_t asked = count;
+	const char* data = stream->read(offset, count);
+	sent = data ? write_bytes(data, count, count < asked) : -1;
+  } else if (tls) {
+	sent = tls->send_file(fd, offset, count);
+  } else if (owner.splice) {
+	sent = write_spliced(fd, offset, count);
+	if (sent == SOCKET_ERROR) {
+	  return would_block() ? 0 : -1;
+	}
+	if (sent == 0) {
+	  return -1;
+	}
+  } else {
+	uint64_t position = offset;
+	sent = IoEngine::send_file(socket, fd, position, count);
+	if (sent == SOCKET_ERROR) {
+	  return would_block() ? 0 : -1;
+	}
+	// Nothing left to send means the file shrank under us
+	if (sent == 0) {
+	  return -1;
+	}
+  }
+  if (stream && sent > 0) {
+	stream->sent(offset + uint64_t(sent));
+  }
+  return sent;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_data(const std::shared_ptr<const char>& data,
+  uint64_t offset, size_t count)
+{
+  if (!zerocopy || count < owner.zerocopy_threshold) {
+	return write_bytes(data.get() + offset, count, false);
+  }
+  long long sent = IoEngine::send_zerocopy(socket, data.get() + offset, count, false);
+  if (sent > 0) {
+	zerocopy_pins.sent(data);
+	return sent;
+  }
+  // Out of memory to track sends with; this one is copied
+  if (sent == SOCKET_ERROR && errno == ENOBUFS) {
+	return write_bytes(data.get() + offset, count, false);
+  }
+  return sent == SOCKET_ERROR && would_block() ? 0 : -1;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::reap_zerocopy()
+{
+  uint32_t first, last;
+  bool copied;
+  while (IoEngine::zerocopy_completion(socket, first, last, copied)) {
+	zerocopy_pins.complete(first, last);
+	// Where the kernel copies anyway, such as over loopback or to devices without
+	// scatter-gather, zerocopy costs more than copying
+	if (copied) {
+	  zerocopy = false;
+	}
+  }
+}
+
+// Sends from the file through a pipe. Bytes left in the pipe when the socket is
+// full are sent before any more are taken from the file, so the pipe stays with
+// the connection until they are.
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+long long BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::write_spliced(int fd, uint64_t offset, size_t count)
+{
+  if (!spliced) {
+	spliced = owner.pipes.acquire();
+	if (!spliced) {
+	  return IoEngine::send_file(socket, fd, offset, count);
+	}
+  }
+  if (spliced.held == 0) {
+	long long got = IoEngine::splice_in(spliced.write_end(), fd, offset, std::min(count, owner.pipes.capacity()));
+	if (got <= 0) {
+	  return got;
+	}
+	spliced.held = size_t(got);
+  }
+  long long sent = IoEngine::splice_out(socket, spliced.read_end(), std::min(spliced.held, count), spliced.held < count);
+  if (sent > 0) {
+	spliced.held -= size_t(sent);
+	if (spliced.held == 0) {
+	  spliced.reset();
+	}
+  }
+  return sent;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::worker::worker(unsigned index, int cpu, CachePolicy* cache,
+  std::pmr::memory_resource* buffer_memory) :
+  index(index), cpu(cpu), cache(cache), scheduler(SendScheduler::config()),
+  receive_buffers(RECEIVE_BUFFER_SIZE, BUFFER_POOL_SLAB_BUFFERS, buffer_memory),
+  large_receive_buffers(LARGE_RECEIVE_BUFFER_SIZE, BUFFER_POOL_SLAB_BUFFERS, buffer_memory), pipes(SPLICE_PIPE_SIZE),
+  response_memory(std::pmr::pool_options{ 0, RESPONSE_POOL_BLOCK_LIMIT }), drain_requested(false)
+{
+#ifndef _WIN32
+  if (pipe(wake) == 0) {
+	for (int fd : wake) {
+	  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	  fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+  }
+#endif
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::worker::~worker()
+{
+  // The scheduler must not keep pointers to the connections going away
+  scheduler.clear();
+  connections.clear();
+  for (auto& entry : lingering) {
+	closesocket(entry.first);
+  }
+#ifndef _WIN32
+  for (int fd : wake) {
+	if (fd != -1) {
+	  close(fd);
+	}
+  }
+#endif
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::worker::request_drain()
+{
+  drain_requested = true;
+#ifndef _WIN32
+  char byte = 0;
+  if (wake[1] != -1 && write(wake[1], &byte, 1) < 0) {
+	// The pipe is full, so the loop is woken anyway
+  }
+#endif
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::worker::resume(SOCKET socket)
+{
+  {
+	std::lock_guard<std::mutex> guard(resume_lock);
+	resumable.push_back(socket);
+  }
+#ifndef _WIN32
+  char byte = 0;
+  if (wake[1] != -1 && write(wake[1], &byte, 1) < 0) {
+	// The pipe is full, so the loop is woken anyway
+  }
+#endif
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::worker::reap_lingering()
+{
+  for (size_t i = 0; i != lingering.size();) {
+	SOCKET socket = lingering[i].first;
+	ZeroCopyPins& pins = lingering[i].second;
+	uint32_t first, last;
+	bool copied;
+	while (IoEngine::zerocopy_completion(socket, first, last, copied)) {
+	  pins.complete(first, last);
+	}
+	if (!pins.empty()) {
+	  i++;
+	  continue;
+	}
+	closesocket(socket);
+	lingering[i] = std::move(lingering.back());
+	lingering.pop_back();
+  }
+}
 
-FileServer::FileServer(int port, std::string root_dir) :
-  port(port), root(std::move(root_dir)), mime_mapper(MimeMapper::createDefault())
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::BasicFileServer(int port, std::string root_dir) :
+  port(port), mime_mapper(MimeLookup::createDefault()), rate_limiter(nullptr), config(new ServerConfig()),
+  config_generation(0)
 {
+  defaults.root = std::move(root_dir);
 }
 
-FileServer::FileServer(int port, std::string root_dir, const IMimeMapper* mime_mapper) :
-  port(port), root(std::move(root_dir)), mime_mapper(mime_mapper)
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::BasicFileServer(int port, std::string root_dir, const MimeLookup* mime_mapper) :
+  port(port), mime_mapper(mime_mapper), rate_limiter(nullptr), config(new ServerConfig()), config_generation(0)
 {
+  defaults.root = std::move(root_dir);
 }
 
-SOCKET FileServer::create_socket()
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+SOCKET BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::create_socket(int family)
 {
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+  SOCKET sock = socket(family, SOCK_STREAM, 0);
   if (sock == INVALID_SOCKET) {
-	std::cerr << "Error creating socket: " << getErrorMessage() << '\n';
+	Logger::error() << "Error creating socket: " << getErrorMessage() << '\n';
 	exit(1);
   }
+  set_close_on_exec(sock);
+#ifdef _WIN32
+  // SO_REUSEADDR would let another socket take the port over; this one binds anyway
+  int exclusive = 1;
+  setsockopt(sock, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof(exclusive));
+#else
+  // Binds while connections of a previous run are still in TIME_WAIT
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
   return sock;
 }
 
-void FileServer::send_ok_response(SOCKET client_socket, const std::string& mime_type)
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+bool BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::bind_listener(SOCKET sock, const ListenAddress& address)
+{
+  if (bind(sock, (const sockaddr*)&address.address, address.length) != SOCKET_ERROR) {
+	return true;
+  }
+#ifndef _WIN32
+  // The file is left behind when the server stops, since the successor of an upgrade
+  // goes on listening on it; it is stale if connecting to it is refused
+  if (address.is_unix() && errno == EADDRINUSE) {
+	SOCKET probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	bool stale = probe != INVALID_SOCKET &&
+	  connect(probe, (const sockaddr*)&address.address, address.length) == SOCKET_ERROR && errno == ECONNREFUSED;
+	if (probe != INVALID_SOCKET) {
+	  closesocket(probe);
+	}
+	if (stale && unlink(address.path().c_str()) == 0) {
+	  return bind(sock, (const sockaddr*)&address.address, address.length) != SOCKET_ERROR;
+	}
+	errno = EADDRINUSE;
+  }
+#endif
+  return false;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::tune_listener(SOCKET sock, int family)
 {
-  std::ostringstream oss;
-  oss << "HTTP/1.0 200 OK\r\n"
-	<< "Content-Type: " << mime_type << "\r\n"
-	<< "Connection: close\r\n"
-	<< "\r\n";
+  if (const char* option = socket_options.apply_to_listener(sock, family)) {
+	Logger::error() << "Error setting " << option << " on server socket: " << getErrorMessage() << std::endl;
+  }
+}
 
-  std::string response = oss.str();
-  if (send(client_socket, response.c_str(), response.size(), 0) == SOCKET_ERROR) {
-	std::cerr << "Error sending response: " << getErrorMessage() << '\n';
+// Head of a response without a body
+static std::pmr::string empty_response_head(std::pmr::memory_resource* memory, const char* status, bool close,
+  std::string_view extra_headers = "") {
+  std::pmr::string head("HTTP/1.1 ", memory);
+  head += status;
+  head += "\r\nContent-Length: 0\r\n";
+  head += extra_headers;
+  if (close) {
+	head += "Connection: close\r\n";
   }
+  head += "\r\n";
+  return head;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::respond(connection& conn, std::pmr::string head)
+{
+  response r;
+  r.head = std::move(head);
+  conn.responses.push_back(std::move(r));
+  conn.owner.scheduler.add(&conn);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::respond(connection& conn, std::pmr::string head, Resource& body)
+{
+  response r;
+  r.head = std::move(head);
+  r.file = body.file;
+  r.data = std::move(body.data);
+  r.stream = std::move(body.stream);
+  r.body_remaining = body.size;
+  body.file = -1;
+  conn.responses.push_back(std::move(r));
+  conn.owner.scheduler.add(&conn);
 }
 
-void FileServer::send_not_found_response(SOCKET client_socket)
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_ok_response(connection& conn, Resource& resource)
 {
-  std::string response = "HTTP/1.0 404 Not Found\r\n\r\n";
-  if (send(client_socket, response.c_str(), response.size(), 0) == SOCKET_ERROR) {
-	std::cerr << "Error sending response: " << getErrorMessage() << '\n';
+  // Sized up front, so that the head is allocated once: 256 bytes cover the status
+  // line and the names of the fields, and a small body follows them
+  size_t inline_size = resource.size <= INLINE_BODY_LIMIT ? size_t(resource.size) : 0;
+  std::pmr::string head(&conn.owner.response_memory);
+  head.reserve(256 + resource.header_fields.size() + resource.content_type.size() + resource.etag.size() + inline_size);
+  head += "HTTP/1.1 200 OK\r\n";
+  if (!resource.header_fields.empty()) {
+	head += resource.header_fields;
+  } else {
+	char length[24];
+	snprintf(length, sizeof(length), "%llu", (unsigned long long)resource.size);
+	head.append("Content-Type: ").append(resource.content_type).append("\r\n");
+	head.append("Content-Length: ").append(length).append("\r\n");
+	if (!resource.etag.empty()) {
+	  head.append("ETag: ").append(resource.etag).append("\r\n");
+	}
+	if (!resource.content_encoding.empty()) {
+	  head.append("Content-Encoding: ").append(resource.content_encoding).append("\r\n");
+	}
+	if (resource.varies) {
+	  head += "Vary: Accept-Encoding\r\n";
+	}
+  }
+  if (conn.closing) {
+	head += "Connection: close\r\n";
+  }
+  head += "\r\n";
+
+  // Small bodies travel in the head; larger ones are sent from the file or buffer after it
+  if (resource.size <= INLINE_BODY_LIMIT && resource.data) {
+	head.append(resource.data.get(), size_t(resource.size));
+	resource.release();
+	respond(conn, std::move(head));
+	return;
   }
+  if (resource.size <= INLINE_BODY_LIMIT) {
+	size_t head_size = head.size();
+	head.resize(head_size + size_t(resource.size));
+	bool inlined = resource.stream && resource.stream->direct() ? read_stream(*resource.stream, &head[head_size], size_t(resource.size)) :
+	  read_file(resource.file, &head[head_size], size_t(resource.size));
+	if (inlined) {
+	  resource.release();
+	  respond(conn, std::move(head));
+	  return;
+	}
+	head.resize(head_size);
+  }
+  respond(conn, std::move(head), resource);
 }
 
-void FileServer::send_internal_server_error_response(SOCKET client_socket)
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_not_modified_response(connection& conn, const Resource& resource)
 {
-  std::string response = "HTTP/1.0 500 Internal Server Error\r\n\r\n";
-  if (send(client_socket, response.c_str(), response.size(), 0) == SOCKET_ERROR) {
-	std::cerr << "Error sending response: " << getErrorMessage() << '\n';
+  // No Content-Length: it would describe the body of a 200
+  std::pmr::string head("HTTP/1.1 304 Not Modified\r\nETag: ", &conn.owner.response_memory);
+  head.append(resource.etag).append("\r\n");
+  if (resource.varies) {
+	head += "Vary: Accept-Encoding\r\n";
   }
+  if (conn.closing) {
+	head += "Connection: close\r\n";
+  }
+  head += "\r\n";
+  respond(conn, std::move(head));
 }
 
-void FileServer::handle_request(SOCKET client_socket) {
-  char buf[REQ_BUF_SIZE];
-  int num_bytes = recv(client_socket, buf, REQ_BUF_SIZE, 0);
-  if (num_bytes == SOCKET_ERROR) {
-	std::cerr << "Error receiving request from client\n";
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_not_found_response(connection& conn)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "404 Not Found", conn.closing));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_bad_request_response(connection& conn)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "400 Bad Request", conn.closing));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_not_acceptable_response(connection& conn)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "406 Not Acceptable", conn.closing));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_uri_too_long_response(connection& conn)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "414 URI Too Long", conn.closing));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_internal_server_error_response(connection& conn)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "500 Internal Server Error", conn.closing));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::send_too_many_requests_response(connection& conn, unsigned retry_after)
+{
+  respond(conn, empty_response_head(&conn.owner.response_memory, "429 Too Many Requests", conn.closing,
+	"Retry-After: " + std::to_string(retry_after) + "\r\n"));
+}
+
+// Only clients on this host may use the admin endpoint
+static bool is_loopback(const sockaddr* addr) {
+  if (addr->sa_family == AF_UNIX) {
+	return true;
+  }
+  if (addr->sa_family == AF_INET) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&reinterpret_cast<const sockaddr_in*>(addr)->sin_addr);
+	return bytes[0] == 127;
+  }
+  if (addr->sa_family == AF_INET6) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr);
+	static const uint8_t loopback[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+	static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	return memcmp(bytes, loopback, sizeof(loopback)) == 0 ||
+	  (memcmp(bytes, v4_mapped, sizeof(v4_mapped)) == 0 && bytes[12] == 127);
+  }
+  return false;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::handle_admin_request(connection& conn, std::string_view method)
+{
+  if (!is_loopback((const sockaddr*)&conn.addr)) {
+	send_not_found_response(conn);
+	return;
+  }
+  if (method != "GET" && method != "POST") {
+	respond(conn, empty_response_head(&conn.owner.response_memory, "405 Method Not Allowed", conn.closing, "Allow: GET, POST\r\n"));
 	return;
   }
+  std::string error;
+  std::string body;
+  const char* status = "200 OK";
+  if (method == "GET") {
+	// Counters. Those of the buffers are of the worker answering; those of cache
+	// replicas and their heaps are prefixed with their node.
+	std::ostringstream report;
+	worker& w = conn.owner;
+	if (workers.size() > 1) {
+	  report << "worker " << w.index << '\n';
+	}
+	report << "receive_buffers_in_use " << w.receive_buffers.in_use() << '\n'
+	  << "receive_buffers_allocated " << w.receive_buffers.allocated() << '\n'
+	  << "large_receive_buffers_in_use " << w.large_receive_buffers.in_use() << '\n'
+	  << "large_receive_buffers_allocated " << w.large_receive_buffers.allocated() << '\n'
+	  << "splice_pipes_in_use " << w.pipes.in_use() << '\n'
+	  << "splice_pipes_allocated " << w.pipes.allocated() << '\n';
+	for (auto& entry : caches) {
+	  std::ostringstream counters;
+	  entry.second->report(counters);
+	  HugePageHeap::shared(entry.first).report(counters);
+	  if (entry.first < 0) {
+		report << counters.str();
+		continue;
+	  }
+	  std::istringstream lines(counters.str());
+	  for (std::string line; std::getline(lines, line);) {
+		report << "node" << entry.first << '_' << line << '\n';
+	  }
+	}
+	body = report.str();
+  } else if (reload_config(error)) {
+	Logger::info() << "Configuration reloaded from " << config_path << std::endl;
+	body = "reloaded\n";
+  } else {
+	Logger::error() << "Error reloading configuration: " << error << std::endl;
+	status = "500 Internal Server Error";
+	body = error + "\n";
+  }
+  std::pmr::string head("HTTP/1.1 ", &conn.owner.response_memory);
+  head += status;
+  head += "\r\nContent-Type: text/plain\r\nContent-Length: ";
+  head += std::to_string(body.size());
+  head += "\r\n";
+  if (conn.closing) {
+	head += "Connection: close\r\n";
+  }
+  head += "\r\n";
+  head += body;
+  respond(conn, std::move(head));
+}
 
-  // Parse the request method, path, and HTTP version
-  std::string request(buf, buf + num_bytes);
-  std::string request_method;
-  std::string request_path;
-  std::string http_version;
-  std::istringstream request_stream(request);
-  request_stream >> request_method >> request_path >> http_version;
+// Turns the resource into a 304 when the client already has it
+static bool not_modified(const ResourceRequest& request, Resource& resource) {
+  if (request.if_none_match.empty() || resource.etag.empty() || !request.already_has(resource.etag)) {
+	return false;
+  }
+  resource.release();
+  resource.status = 304;
+  return true;
+}
 
-  // Ensure that the request method is GET and the HTTP version is 1.0 or 1.1
-  if (request_method != "GET" || (http_version != "HTTP/1.0" && http_version != "HTTP/1.1")) {
-	send_internal_server_error_response(client_socket);
-	return;
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+Resource BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::open_resource(CachePolicy& cache, const ResourceRequest& request,
+  const sockaddr* client_addr, std::pmr::memory_resource* memory, const std::function<void()>* wake)
+{
+  Resource resource(memory);
+  const ServerConfig& cfg = *config;
+  RateLimiter* limiter = rate_limiter;
+
+  // Refuse clients over their request or byte budget before doing any work for them
+  if (limiter && !request.resumed) {
+	resource.retry_after = limiter->acquire_request(client_addr);
+	if (resource.retry_after != 0) {
+	  resource.status = 429;
+	  return resource;
+	}
+  }
+
+  // Ensure that the request method is GET
+  if (request.method != "GET") {
+	return resource;
+  }
+
+  // Reduce the target to its canonical form; it must not leave the root directory
+  CanonicalPath canonical_path;
+  switch (canonical_path.assign(request.target)) {
+  case CanonicalPath::status::ok:
+	break;
+  case CanonicalPath::status::too_long:
+	resource.status = 414;
+	return resource;
+  default:
+	resource.status = 400;
+	return resource;
+  }
+
+  // A bundle holds every resource there is, with its type and headers
+  if (bundle) {
+	std::pmr::string bundle_path(canonical_path.view(), memory);
+	if (canonical_path.is_directory()) {
+	  bundle_path += "index.html";
+	}
+	if (!bundle->open(bundle_path, request.gzip, resource)) {
+	  resource.status = 404;
+	  return resource;
+	}
+	if (not_modified(request, resource)) {
+	  return resource;
+	}
+	resource.status = 200;
+	if (limiter) {
+	  limiter->charge_bytes(client_addr, resource.size);
+	}
+	return resource;
   }
 
-  // Append the root directory to the request path
-  request_path = root + request_path;
+  // Append the root directory to the request path; entries of an archive are named without it
+  std::pmr::string request_path(memory);
+  request_path.reserve(cfg.root.size() + canonical_path.view().size() + sizeof("index.html"));
+  if (!cfg.archive) {
+	request_path += cfg.root;
+  }
+  request_path += canonical_path.view();
 
   // If the request path is a directory, append "index.html"
-  if (request_path.empty() || request_path.back() == '/') {
+  if (canonical_path.is_directory()) {
 	request_path += "index.html";
   }
 
-  // Open the file
-  std::ifstream file(request_path, std::ios::in | std::ios::binary);
-  if (!file) {
-	send_not_found_response(client_socket);
-	return;
+  // Open the file or archive entry
+  if (cfg.archive) {
+	int status = cfg.archive->open(request_path, request.gzip, resource);
+	if (status != 200) {
+	  resource.release();
+	  resource.status = status;
+	  return resource;
+	}
+  } else if (!(wake ? cache.try_open(request_path, resource, resource.pending, *wake) : cache.open(request_path, resource))) {
+	// A pending file is looked for again when the request is handled again
+	if (!resource.pending) {
+	  resource.status = 404;
+	}
+	return resource;
+  } else if (hasher) {
+	hasher->lookup(request_path, resource.etag);
   }
 
   // Determine the file extension and corresponding MIME type
   size_t extension_index = request_path.rfind('.');
   if (extension_index == std::string::npos) {
-	send_internal_server_error_response(client_socket);
-	return;
+	resource.release();
+	return resource;
+  }
+  std::string_view extension = std::string_view(request_path).substr(extension_index);
+  auto configured = cfg.mime_types.find(extension);
+  resource.content_type = configured != cfg.mime_types.end() ? configured->second : mime_mapper->findMime(extension);
+  if (not_modified(request, resource)) {
+	return resource;
+  }
+  resource.status = 200;
+  // Large files are read so that the page cache stays with the small ones
+  if (resource.file != -1 && !cfg.archive && stream_config.threshold != 0 && resource.size >= stream_config.threshold &&
+	resource.size > INLINE_BODY_LIMIT) {
+	resource.stream = std::make_shared<FileStream>(resource.file, resource.size, stream_config);
   }
-  std::string extension = request_path.substr(extension_index);
-  std::string mime_type_str = mime_mapper->getMime(extension);
+  if (limiter) {
+	limiter->charge_bytes(client_addr, resource.size);
+  }
+  return resource;
+}
 
-  // Send the OK response and file contents
-  send_ok_response(client_socket, mime_type_str);
-  std::string file_contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-  send(client_socket, file_contents.c_str(), file_contents.size(), 0);
+// Value of the first header field called name (lower case), or empty
+static std::string_view header_value(std::string_view request, std::string_view name) {
+  size_t line = request.find('\n');
+  while (line != std::string_view::npos && line + 1 < request.size()) {
+	size_t start = line + 1;
+	line = request.find('\n', start);
+	size_t end = line == std::string_view::npos ? request.size() : line;
+	size_t colon = request.find(':', start);
+	if (colon >= end || colon - start != name.size()) {
+	  continue;
+	}
+	bool match = true;
+	for (size_t i = 0; i != name.size() && match; i++) {
+	  match = std::tolower((unsigned char)request[start + i]) == name[i];
+	}
+	if (match) {
+	  size_t first = request.find_first_not_of(" \t", colon + 1);
+	  size_t last = request.find_last_not_of(" \t\r", end - 1);
+	  return first < end && last != std::string_view::npos && last >= first ? request.substr(first, last - first + 1) : "";
+	}
+  }
+  return "";
+}
 
-  // Close the file and socket
-  file.close();
-  closesocket(client_socket);
+// The next whitespace-separated word of text, which is advanced past it
+static std::string_view next_word(std::string_view& text) {
+  const char* whitespace = " \t\r\n\v\f";
+  size_t start = std::min(text.find_first_not_of(whitespace), text.size());
+  size_t end = std::min(text.find_first_of(whitespace, start), text.size());
+  std::string_view word = text.substr(start, end - start);
+  text.remove_prefix(end);
+  return word;
 }
 
-FileServer::~FileServer()
-{
-  if (mime_mapper) {
-	delete mime_mapper;
-	mime_mapper = 0;
+// Whether text contains word (lower case), ignoring case
+static bool contains_word(std::string_view text, std::string_view word) {
+  for (size_t i = 0; i + word.size() <= text.size(); i++) {
+	bool match = true;
+	for (size_t j = 0; j != word.size() && match; j++) {
+	  match = std::tolower((unsigned char)text[i + j]) == word[j];
+	}
+	if (match) {
+	  return true;
+	}
   }
+  return false;
 }
 
-void FileServer::run() {
-  SOCKET server_socket = create_socket();
-  sockaddr_in addr;
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = INADDR_ANY; // Bind to any available interface
-  addr.sin_port = htons(port); // Bind to the specified port
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::handle_request(connection& conn, std::string_view request) {
+  bool resumed = conn.resumed;
+  conn.resumed = false;
+  if (!resumed) {
+	conn.requests_handled++;
+  }
+
+  // Parse the request method, path, and HTTP version
+  std::string_view request_line = request;
+  std::string_view request_method = next_word(request_line);
+  std::string_view request_path = next_word(request_line);
+  std::string_view http_version = next_word(request_line);
 
-  if (bind(server_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-	std::cerr << "Error binding server socket: " << getErrorMessage() << std::endl;
-	closesocket(server_socket);
+  // Ensure that the HTTP version is 1.0 or 1.1
+  if (http_version != "HTTP/1.0" && http_version != "HTTP/1.1") {
+	conn.closing = true;
+	send_internal_server_error_response(conn);
 	return;
   }
 
-  // Listen for incoming connections
-  if (listen(server_socket, SOMAXCONN) == SOCKET_ERROR) {
-	std::cerr << "Error listening for incoming connections: " << getErrorMessage() << std::endl;
-	closesocket(server_socket);
+  // HTTP/1.1 connections persist unless the client asks otherwise; HTTP/1.0 ones only on request.
+  // Request bodies are not read, so the next request could not be found after one.
+  std::string_view connection_option = header_value(request, "connection");
+  bool keep_alive = http_version == "HTTP/1.1" ? !contains_word(connection_option, "close") :
+	contains_word(connection_option, "keep-alive");
+  std::string_view content_length = header_value(request, "content-length");
+  if (!keep_alive || (!content_length.empty() && content_length != "0") ||
+	!header_value(request, "transfer-encoding").empty()) {
+	conn.closing = true;
   }
 
-  // Wait for incoming connections
-  std::cout << "Server listening on port " << port << std::endl;
+  const std::string& admin_path = config->admin_path;
+  if (!admin_path.empty() && request_path == admin_path) {
+	handle_admin_request(conn, request_method);
+	return;
+  }
 
-  while (true) {
-	// Accept a client connection
-	SOCKET client_socket = accept(server_socket, NULL, NULL);
-	if (client_socket == INVALID_SOCKET) {
-	  std::cerr << "Error accepting client connection: " << getErrorMessage() << std::endl;
-	  continue;
+  ResourceRequest resource_request;
+  resource_request.method = request_method;
+  resource_request.target = request_path;
+  resource_request.gzip = ResourceRequest::accepts_gzip(header_value(request, "accept-encoding"));
+  resource_request.if_none_match = header_value(request, "if-none-match");
+  resource_request.resumed = resumed;
+
+  // h2c upgrade (RFC 7540 3.2) on cleartext connections, for a request that is not pipelined
+  if (http2 && !conn.tls && http_version == "HTTP/1.1" && conn.requests_handled == 1 && conn.responses.empty() &&
+	header_value(request, "upgrade") == "h2c") {
+	std::string settings(header_value(request, "http2-settings"));
+	start_http2(conn);
+	if (conn.h2->upgrade(resource_request, settings)) {
+	  // Whatever followed the request (usually the client preface) belongs to the session
+	  BufferPool::buffer received = std::move(conn.receive_buffer);
+	  const char* rest = request.data() + request.size();
+	  size_t rest_size = size_t(received.data() + conn.received - rest);
+	  conn.received = 0;
+	  conn.closing = false;
+	  conn.h2->receive(rest, rest_size);
+	  serve_http2(conn);
+	  return;
 	}
+	conn.h2.reset();
+  }
 
-	// Handle the client request
-	handle_request(client_socket);
+  // Rather than wait for a file another request is loading, the connection is parked
+  // and resumed by the loop of its worker once it is loaded
+  worker& owner = conn.owner;
+  SOCKET socket = conn.socket;
+  std::function<void()> wake = [&owner, socket] { owner.resume(socket); };
+  Resource resource = open_resource(*owner.cache, resource_request, (const sockaddr*)&conn.addr,
+	owner.request_memory.resource(), owner.wake[1] != -1 ? &wake : nullptr);
+  if (resource.pending) {
+	// Whether the connection closes after the request is decided again with it
+	conn.parked = true;
+	conn.closing = false;
+	return;
+  }
+  switch (resource.status) {
+  case 200:
+	// Queue the OK response; the scheduler streams the file contents after it
+	send_ok_response(conn, resource);
+	break;
+  case 304:
+	send_not_modified_response(conn, resource);
+	break;
+  case 400:
+	conn.closing = true;
+	send_bad_request_response(conn);
+	break;
+  case 404:
+	send_not_found_response(conn);
+	break;
+  case 406:
+	send_not_acceptable_response(conn);
+	break;
+  case 414:
+	conn.closing = true;
+	send_uri_too_long_response(conn);
+	break;
+  case 429:
+	conn.closing = true;
+	send_too_many_requests_response(conn, resource.retry_after);
+	break;
+  default:
+	conn.closing = true;
+	send_internal_server_error_response(conn);
+	break;
+  }
+}
 
-	// Close the client socket
-	closesocket(client_socket);
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::~BasicFileServer()
+{
+  if (mime_mapper) {
+	delete mime_mapper;
+	mime_mapper = 0;
+  }
+  delete bundle;
+  delete hasher;
+  delete rate_limiter.load();
+  // Sessions of remaining connections must go before their context
+  workers.clear();
+  delete tls;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_rate_limiter(RateLimiter *limiter)
+{
+  if (rate_limiter != limiter) {
+	delete rate_limiter.load();
+	rate_limiter = limiter;
+  }
+  defaults.rate_limits = limiter ? limiter->settings() : RateLimiter::config();
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_tls_context(TlsContext *context)
+{
+  if (tls != context) {
+	delete tls;
+	tls = context;
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_bundle(AssetBundle *assets)
+{
+  if (bundle != assets) {
+	delete bundle;
+	bundle = assets;
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_content_hasher(ContentHasher *content_hasher)
+{
+  if (hasher != content_hasher) {
+	delete hasher;
+	hasher = content_hasher;
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_send_config(const SendScheduler::config& cfg)
+{
+  defaults.send = cfg;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_http2(bool enabled, const Http2Session::settings& settings)
+{
+  http2 = enabled;
+  defaults.http2 = settings;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_pipeline_depth(size_t depth)
+{
+  defaults.pipeline_depth = std::max<size_t>(depth, 1);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_cache(size_t capacity, size_t max_file_size)
+{
+  defaults.cache_size = capacity;
+  defaults.cache_max_file = max_file_size;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_hot_upgrade(const std::vector<std::string>& command, unsigned drain_timeout)
+{
+  upgrade_command = command;
+  defaults.drain_timeout = drain_timeout;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_config_file(const std::string& path)
+{
+  config_path = path;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_preload(const Preload::config& cfg)
+{
+  preload_config = cfg;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_streaming(const FileStream::config& cfg)
+{
+  stream_config = cfg;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_splice(bool enabled)
+{
+  splice = enabled;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_zerocopy(size_t threshold)
+{
+  zerocopy_threshold = threshold;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_socket_options(const SocketOptions& options)
+{
+  socket_options = options;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_listen_addresses(const std::vector<ListenAddress>& addresses)
+{
+  listen_addresses = addresses;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::set_workers(unsigned count, bool pin, bool per_node_caches)
+{
+  worker_count = std::max(count, 1u);
+  pin_workers = pin;
+  cache_per_node = per_node_caches;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::create_workers()
+{
+  std::vector<unsigned> cpus = CpuPlacement::allowed_cpus();
+  if (pin_workers && cpus.size() < worker_count) {
+	Logger::info() << "More workers than CPUs: " << cpus.size() << " CPUs are shared by " << worker_count << " workers" << std::endl;
+  }
+  for (unsigned i = 0; i != worker_count; i++) {
+	int cpu = pin_workers ? int(cpus[i % cpus.size()]) : -1;
+	int node = cpu >= 0 && cache_per_node ? CpuPlacement::node_of(unsigned(cpu)) : -1;
+	// Pages of a replica, and of the buffers of its workers, are placed on its node
+	// whichever thread first touches them
+	HugePageHeap& memory = HugePageHeap::shared(node);
+	std::unique_ptr<CachePolicy>& cache = caches[node];
+	if (!cache) {
+	  cache.reset(new CachePolicy());
+	  cache->set_memory(&memory);
+	}
+	workers.emplace_back(new worker(i, cpu, cache.get(), &memory));
+	if (splice) {
+	  workers.back()->splice = true;
+	  workers.back()->pipes.reserve(SPLICE_PIPES_RESERVED);
+	}
+	workers.back()->zerocopy_threshold = zerocopy_threshold;
+	workers.back()->cork = socket_options.cork;
+  }
+  if (cache_per_node) {
+	Logger::info() << "Cache replicated on " << caches.size() << " NUMA node(s)" << std::endl;
+  }
+}
+
+// Reads the chosen files through the cache on several threads. Those the cache
+// keeps end up in memory; the others are read through, so that the page cache
+// holds them for sendfile, except that of streamed files only the first window is.
+// Either way their inodes are in the kernel's caches.
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::preload()
+{
+  const Preload::config& options = preload_config;
+  const ServerConfig& cfg = *config;
+  if (!options.enabled) {
+	return;
+  }
+  if (bundle || cfg.archive) {
+	Logger::info() << "Nothing to preload: resources are served from a mapped file" << std::endl;
+	return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (auto& entry : caches) {
+	entry.second->lock_memory(options.lock_memory);
+  }
+  std::vector<std::string> paths;
+  std::string error;
+  if (!Preload::select(cfg.root, options, paths, error)) {
+	Logger::error() << "Error preloading: " << error << std::endl;
+	return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<uint64_t> files(0);
+  std::atomic<uint64_t> cached_bytes(0);
+  std::atomic<uint64_t> read_bytes(0);
+  auto read_files = [&]() {
+	std::vector<char> buffer;
+	for (size_t i; (i = next++) < paths.size();) {
+	  std::pmr::string path(cfg.root + paths[i]);
+	  Resource resource;
+	  // Every replica reads its own copy; the last one counts
+	  bool opened = false;
+	  for (auto& entry : caches) {
+		resource.release();
+		opened = entry.second->open(path, resource);
+	  }
+	  if (!opened) {
+		continue;
+	  }
+	  files++;
+	  if (resource.data) {
+		cached_bytes += resource.size;
+	  } else {
+		buffer.resize(PRELOAD_CHUNK_SIZE);
+		bool streamed = stream_config.threshold != 0 && resource.size >= stream_config.threshold;
+		for (uint64_t left = streamed ? std::min<uint64_t>(resource.size, stream_config.window) : resource.size; left != 0;) {
+		  size_t count = size_t(std::min<uint64_t>(left, buffer.size()));
+		  if (!read_file(resource.file, buffer.data(), count)) {
+			break;
+		  }
+		  left -= count;
+		  read_bytes += count;
+		}
+	  }
+	  resource.release();
+	}
+  };
+  unsigned thread_count = options.threads != 0 ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < thread_count && i < paths.size(); i++) {
+	threads.emplace_back(read_files);
+  }
+  read_files();
+  for (std::thread& thread : threads) {
+	thread.join();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  Logger::info() << "Preloaded " << files.load() << " of " << paths.size() << " files in " << elapsed.count() << " ms: "
+	<< cached_bytes.load() << " bytes cached, " << read_bytes.load() << " bytes read into the page cache" << std::endl;
+}
+
+// Publishes the settings with the configuration file read over them. Requests
+// being handled finish with the previous snapshot; new ones see this one.
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+bool BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::reload_config(std::string& error)
+{
+  std::lock_guard<std::mutex> guard(reload_lock);
+  ServerConfig next = defaults;
+  if (!config_path.empty() && !next.load(config_path, error)) {
+	return false;
+  }
+  if (fs::is_regular_file(next.root)) {
+	std::shared_ptr<ZipArchive> archive = std::make_shared<ZipArchive>();
+	if (!archive->load(next.root, error)) {
+	  return false;
+	}
+	Logger::info() << "Serving " << archive->size() << " entries of " << next.root << std::endl;
+	next.archive = archive;
+  } else if (!fs::is_directory(next.root)) {
+	error = "root " + next.root + " is neither a directory nor a ZIP archive";
+	return false;
+  }
+  config.publish(new ServerConfig(next));
+  // Each worker applies the send settings itself
+  config_generation++;
+  for (auto& entry : caches) {
+	entry.second->configure(next.cache_size, next.cache_max_file);
+  }
+  const RateLimiter::config& limits = next.rate_limits;
+  if (RateLimiter* limiter = rate_limiter) {
+	limiter->set_rates(limits);
+  } else if (limits.requests_per_second > 0 || limits.bytes_per_second > 0) {
+	rate_limiter = new RateLimiter(limits);
+  }
+  return true;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::accept_connections(worker& w, SOCKET server_socket)
+{
+  while (true) {
+	// Accept a client connection
+	std::unique_ptr<connection> conn(new connection(w));
+	socklen_t client_addr_len = sizeof(conn->addr);
+	conn->socket = accept(server_socket, (sockaddr*)&conn->addr, &client_addr_len);
+	if (conn->socket == INVALID_SOCKET) {
+	  if (!would_block()) {
+		Logger::error() << "Error accepting client connection: " << getErrorMessage() << std::endl;
+	  }
+	  return;
+	}
+	if (!set_non_blocking(conn->socket)) {
+	  Logger::error() << "Error making client socket non-blocking: " << getErrorMessage() << std::endl;
+	  continue;
+	}
+	set_close_on_exec(conn->socket);
+	if (const char* option = socket_options.apply_to_connection(conn->socket, conn->addr.ss_family)) {
+	  Logger::error() << "Error setting " << option << " on client socket: " << getErrorMessage() << std::endl;
+	}
+	if (!tls && w.zerocopy_threshold != 0) {
+	  conn->zerocopy = IoEngine::enable_zerocopy(conn->socket);
+	}
+	if (tls) {
+	  conn->tls.reset(tls->create_session(conn->socket));
+	  if (!conn->tls) {
+		Logger::error() << "Error creating TLS session" << std::endl;
+		continue;
+	  }
+	  conn->handshaking = true;
+	}
+	connection& accepted = *conn;
+	accepted.recency_position = w.recency.insert(w.recency.end(), &accepted);
+	accepted.active = std::chrono::steady_clock::now();
+	w.connections[accepted.socket] = std::move(conn);
+	watch(accepted);
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::continue_handshake(connection& conn)
+{
+  int state = conn.tls->handshake();
+  if (state < 0) {
+	close_connection(conn);
+	return;
+  }
+  if (state > 0) {
+	conn.handshaking = false;
+	if (http2 && conn.tls->alpn() == "h2") {
+	  start_http2(conn);
+	}
+	// The client may have sent its request along with the last handshake flight
+	read_request(conn);
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::read_request(connection& conn)
+{
+  if (conn.h2) {
+	read_http2(conn);
+	return;
+  }
+  size_t received = conn.received;
+  worker& w = conn.owner;
+  if (conn.read_closed || received == w.large_receive_buffers.capacity()) {
+	return;
+  }
+  if (!conn.receive_buffer) {
+	conn.receive_buffer = w.receive_buffers.acquire();
+  } else if (received == conn.receive_buffer.capacity()) {
+	// A request head that does not fit a small buffer continues in a large one
+	BufferPool::buffer large = w.large_receive_buffers.acquire();
+	memcpy(large.data(), conn.receive_buffer.data(), received);
+	conn.receive_buffer = std::move(large);
+  }
+  char* space = conn.receive_buffer.data() + received;
+  size_t space_size = conn.receive_buffer.capacity() - received;
+  long long num_bytes;
+  if (conn.tls) {
+	num_bytes = conn.tls->read(space, space_size);
+	if (num_bytes == 0) {
+	  if (received == 0) {
+		conn.receive_buffer.reset();
+	  }
+	  return;
+	}
+	if (num_bytes < 0) {
+	  // A TLS read fails for a closed connection as well as for a broken one
+	  num_bytes = 0;
+	}
+  } else {
+	num_bytes = IoEngine::receive(conn.socket, space, space_size);
+  }
+  if (num_bytes == SOCKET_ERROR && would_block()) {
+	if (received == 0) {
+	  conn.receive_buffer.reset();
+	}
+	return;
+  }
+  if (num_bytes == SOCKET_ERROR) {
+	Logger::error() << "Error receiving request from client\n";
+	close_connection(conn);
+	return;
+  }
+  if (num_bytes == 0) {
+	// The client may half-close after its last request; answer what was received
+	conn.read_closed = true;
+	process_requests(conn);
+	if (!conn.scheduled() && !conn.parked) {
+	  close_connection(conn);
+	}
+	return;
+  }
+  conn.received = received + size_t(num_bytes);
+
+  // A client with prior knowledge opens with the HTTP/2 connection preface
+  if (http2 && conn.requests_handled == 0) {
+	std::string_view pending(conn.receive_buffer.data(), conn.received);
+	size_t compared = std::min(pending.size(), Http2Session::preface_length);
+	if (pending.compare(0, compared, Http2Session::preface, compared) == 0) {
+	  if (compared == Http2Session::preface_length) {
+		start_http2(conn);
+		BufferPool::buffer bytes = std::move(conn.receive_buffer);
+		conn.received = 0;
+		conn.h2->receive(pending.data(), pending.size());
+		serve_http2(conn);
+	  }
+	  return;
+	}
+  }
+
+  process_requests(conn);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::connection::consume(size_t count)
+{
+  if (count == 0) {
+	return;
+  }
+  received -= count;
+  memmove(receive_buffer.data(), receive_buffer.data() + count, received);
+}
+
+// Handles every complete request in the receive buffer, in order, up to the pipeline depth
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::process_requests(connection& conn)
+{
+  if (conn.parked) {
+	return;
+  }
+  conn.held = false;
+  while (!conn.closing && !conn.h2) {
+	// Empty lines between requests are allowed
+	std::string_view pending(conn.receive_buffer.data(), conn.received);
+	size_t start = std::min(pending.find_first_not_of("\r\n"), pending.size());
+	conn.consume(start);
+	pending.remove_prefix(start);
+	if (pending.empty()) {
+	  break;
+	}
+	if (conn.responses.size() >= config->pipeline_depth) {
+	  conn.held = true;
+	  return;
+	}
+	pending = std::string_view(conn.receive_buffer.data(), conn.received);
+	size_t end = pending.find("\r\n\r\n");
+	size_t end_length = 4;
+	size_t bare_end = pending.find("\n\n");
+	if (bare_end < end) {
+	  end = bare_end;
+	  end_length = 2;
+	}
+	if (end == std::string_view::npos) {
+	  if (conn.received < conn.owner.large_receive_buffers.capacity() && !conn.read_closed) {
+		return;
+	  }
+	  // Headers that do not fit the buffer, or a truncated last request
+	  end = conn.received;
+	  end_length = 0;
+	  conn.closing = true;
+	}
+	handle_request(conn, pending.substr(0, end + end_length));
+	conn.owner.request_memory.reset();
+	if (conn.parked) {
+	  // The request stays in the buffer until it is handled again
+	  return;
+	}
+	if (conn.h2) {
+	  // The session took the rest of the buffer
+	  return;
+	}
+	conn.consume(end + end_length);
+  }
+  // Nothing is pending, so the buffer goes back to the pool
+  if (conn.received == 0) {
+	conn.receive_buffer.reset();
+  }
+  if (conn.read_closed) {
+	conn.closing = true;
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::start_http2(connection& conn)
+{
+  const sockaddr* client_addr = (const sockaddr*)&conn.addr;
+  CachePolicy* cache = conn.owner.cache;
+  conn.h2.reset(new Http2Session([this, cache, client_addr](const ResourceRequest& request) {
+	// The session keeps the resource past the request, so its strings come from the heap
+	return open_resource(*cache, request, client_addr, std::pmr::get_default_resource());
+  }, config->http2));
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::read_http2(connection& conn)
+{
+  char buf[REQ_BUF_SIZE];
+  // Drain the socket; TLS may hold decrypted records poll cannot see. Reading stops
+  // while the session has more frames to write than it allows.
+  while (!conn.h2->backed_up()) {
+	long long num_bytes;
+	if (conn.tls) {
+	  num_bytes = conn.tls->read(buf, sizeof(buf));
+	} else {
+	  num_bytes = IoEngine::receive(conn.socket, buf, sizeof(buf));
+	  if (num_bytes == SOCKET_ERROR) {
+		num_bytes = would_block() ? 0 : -1;
+	  } else if (num_bytes == 0) {
+		num_bytes = -1;
+	  }
+	}
+	if (num_bytes < 0) {
+	  close_connection(conn);
+	  return;
+	}
+	if (num_bytes == 0) {
+	  break;
+	}
+	if (!conn.write_closed) {
+	  conn.h2->receive(buf, size_t(num_bytes));
+	} else if (std::chrono::steady_clock::now() >= conn.linger_deadline) {
+	  // The peer keeps sending and never read what ended the session
+	  close_connection(conn);
+	  return;
+	}
+  }
+  if (!conn.write_closed) {
+	serve_http2(conn);
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::serve_http2(connection& conn)
+{
+  if (conn.h2->pending() != 0) {
+	conn.owner.scheduler.add(&conn);
+  } else if (conn.h2->closed() && !conn.scheduled()) {
+	close_http2(conn);
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::close_http2(connection& conn)
+{
+  // Closing with input unread resets the connection, and the peer loses what it has
+  // not read yet, GOAWAY included. Over plain TCP the end of the stream is sent
+  // instead, and the socket closes when the peer closes its side, or when it still
+  // sends after LINGER_TIME.
+  if (conn.tls || conn.broken || conn.write_closed) {
+	close_connection(conn);
+	return;
+  }
+  shutdown(conn.socket, SHUT_WR);
+  conn.write_closed = true;
+  conn.linger_deadline = std::chrono::steady_clock::now() + LINGER_TIME;
+  watch(conn);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::close_connection(connection& conn)
+{
+  worker& w = conn.owner;
+  w.scheduler.remove(&conn);
+  w.poller.watch(conn.socket, conn.watched, 0);
+  w.recency.erase(conn.recency_position);
+  w.connections.erase(conn.socket);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::mark_active(connection& conn)
+{
+  worker& w = conn.owner;
+  conn.active = std::chrono::steady_clock::now();
+  w.recency.splice(w.recency.end(), w.recency, conn.recency_position);
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::watch(connection& conn)
+{
+  // Requests are read while there is room for them, and responses blocked on the socket wait for it
+  unsigned events = conn.blocked() ? Poller::writable : 0;
+  if (!conn.closing && !conn.read_closed && !conn.held && !conn.parked && conn.received < conn.owner.large_receive_buffers.capacity()) {
+	events |= Poller::readable;
+  }
+  if (conn.h2) {
+	events = (conn.h2->backed_up() ? 0 : Poller::readable) | (conn.blocked() ? Poller::writable : 0);
+  } else if (conn.handshaking) {
+	events = conn.tls->wants_write() ? Poller::writable : Poller::readable;
+  }
+  if (events == conn.watched) {
+	return;
+  }
+  if (!conn.owner.poller.watch(conn.socket, conn.watched, events)) {
+	Logger::error() << "Error watching client socket: " << getErrorMessage() << std::endl;
+	close_connection(conn);
+	return;
+  }
+  conn.watched = (unsigned char)events;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+bool BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::open_listeners(ListenerHandoff& predecessor)
+{
+  // Listening sockets handed over by the process we replace, or passed by a service manager
+  std::vector<int> inherited;
+  if (predecessor.receive(inherited) || !(inherited = ListenerHandoff::inherited_listeners()).empty()) {
+	for (int fd : inherited) {
+	  set_non_blocking(SOCKET(fd));
+	  // Options changed since the sockets were opened apply to the connections accepted from now on
+	  ListenAddress address;
+	  if (ListenAddress::of(SOCKET(fd), address)) {
+		tune_listener(SOCKET(fd), address.family());
+	  }
+	  listeners.push_back(SOCKET(fd));
+	}
+	Logger::info() << "Server taking over " << listeners.size() << " listening socket(s)" << std::endl;
+	return true;
+  }
+
+  std::vector<ListenAddress> addresses = listen_addresses;
+  if (addresses.empty()) {
+	addresses.push_back(ListenAddress::any(port));
+  }
+  for (const ListenAddress& address : addresses) {
+	// A TCP socket per worker, among which the kernel spreads the connections;
+	// elsewhere, and on Unix sockets, the workers share one
+#ifdef __linux__
+	unsigned count = address.is_unix() ? 1 : worker_count;
+#else
+	unsigned count = 1;
+#endif
+	for (unsigned i = 0; i != count; i++) {
+	  SOCKET server_socket = create_socket(address.family());
+#ifdef __linux__
+	  if (count > 1) {
+		int reuse = 1;
+		setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+	  }
+#endif
+	  if (address.family() == AF_INET6) {
+		// Dual stack, whatever the system's default
+		int v6_only = 0;
+		setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&v6_only, sizeof(v6_only));
+	  }
+	  if (!bind_listener(server_socket, address)) {
+		Logger::error() << "Error binding server socket to " << address.to_string() << ": " << getErrorMessage() << std::endl;
+		closesocket(server_socket);
+		return false;
+	  }
+	  tune_listener(server_socket, address.family());
+
+	  // Listen for incoming connections
+	  if (listen(server_socket, SOMAXCONN) == SOCKET_ERROR) {
+		Logger::error() << "Error listening for incoming connections: " << getErrorMessage() << std::endl;
+		closesocket(server_socket);
+		return false;
+	  }
+	  set_non_blocking(server_socket);
+	  listeners.push_back(server_socket);
+	}
+	Logger::info() << "Server listening on " << address.to_string() << std::endl;
+  }
+  return true;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::start_upgrade(worker& w, ListenerHandoff& successor)
+{
+  if (w.draining || successor.status() == ListenerHandoff::state::waiting) {
+	Logger::error() << "Upgrade already in progress" << std::endl;
+	return;
+  }
+  if (upgrade_command.empty()) {
+	Logger::error() << "Hot upgrade is not configured" << std::endl;
+	return;
+  }
+  std::vector<int> fds(listeners.begin(), listeners.end());
+  if (!successor.start_successor(upgrade_command, fds)) {
+	Logger::error() << "Error starting successor process: " << getErrorMessage() << std::endl;
+	return;
+  }
+  Logger::info() << "Started successor process " << successor.successor_pid() << std::endl;
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::start_draining(worker& w)
+{
+  // The sockets are closed once every worker has stopped watching them
+  for (SOCKET listener : w.listeners) {
+	w.poller.watch(listener, Poller::readable, 0);
+  }
+  w.listeners.clear();
+  w.draining = true;
+  w.drain_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config->drain_timeout);
+  Logger::info() << "Draining " << w.connections.size() << " connection(s)"
+	<< (workers.size() > 1 ? " of worker " + std::to_string(w.index) : std::string()) << std::endl;
+
+  // Responses in progress are completed; idle connections go now
+  std::vector<connection*> current;
+  for (auto& entry : w.connections) {
+	current.push_back(entry.second.get());
+  }
+  for (connection* conn : current) {
+	if (conn->h2) {
+	  conn->h2->shutdown();
+	  serve_http2(*conn);
+	} else {
+	  conn->closing = true;
+	  if (!conn->scheduled()) {
+		close_connection(*conn);
+	  }
+	}
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::close_idle_connections(worker& w, unsigned idle_timeout)
+{
+  // Only the expired end of the list is looked at; connections with responses under
+  // way are left to the scheduler
+  auto cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(idle_timeout);
+  for (auto it = w.recency.begin(); it != w.recency.end() && (*it)->active < cutoff;) {
+	connection& conn = **it++;
+	if (!conn.scheduled()) {
+	  close_connection(conn);
+	}
+  }
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::resume_parked(worker& w)
+{
+  std::vector<SOCKET> resumable;
+  {
+	std::lock_guard<std::mutex> guard(w.resume_lock);
+	resumable.swap(w.resumable);
+  }
+  for (SOCKET socket : resumable) {
+	// The connection may have closed meanwhile, and its socket gone to another
+	auto it = w.connections.find(socket);
+	if (it == w.connections.end() || !it->second->parked) {
+	  continue;
+	}
+	connection& conn = *it->second;
+	conn.parked = false;
+	conn.resumed = true;
+	process_requests(conn);
+	if (conn.read_closed && !conn.scheduled() && !conn.parked) {
+	  close_connection(conn);
+	} else {
+	  watch(conn);
+	}
+  }
+}
+
+#ifndef _WIN32
+static int signal_pipe[2] = { -1, -1 };
+
+// Signals are forwarded to the event loop through a pipe
+static void on_signal(int signo) {
+  int saved_errno = errno;
+  char byte = char(signo);
+  if (write(signal_pipe[1], &byte, 1) < 0) {
+	// The pipe is full; the loop has signals to handle anyway
+  }
+  errno = saved_errno;
+}
+#endif
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::run() {
+#ifndef _WIN32
+  // Peers closing early must surface as send errors, not kill the process
+  signal(SIGPIPE, SIG_IGN);
+  if (signal_pipe[0] == -1 && pipe(signal_pipe) == 0) {
+	for (int fd : signal_pipe) {
+	  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	  fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+  }
+  struct sigaction action = {};
+  action.sa_handler = on_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR2, &action, nullptr);
+  sigaction(SIGHUP, &action, nullptr);
+  // Every connection holds a descriptor; take as many as we are allowed
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+	files.rlim_cur = files.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &files);
+  }
+#endif
+  create_workers();
+  std::string error;
+  if (!reload_config(error)) {
+	Logger::error() << "Error loading configuration: " << error << std::endl;
+	return;
+  }
+  ListenerHandoff predecessor;
+  ListenerHandoff successor;
+  // A predecessor keeps serving until the files are read
+  preload();
+  if (!open_listeners(predecessor)) {
+	return;
+  }
+  // The process we replace stops accepting once it hears from us
+  predecessor.acknowledge();
+
+  // The sockets of each address, inherited ones included
+  std::vector<std::pair<ListenAddress, std::vector<SOCKET>>> groups;
+  for (SOCKET listener : listeners) {
+	ListenAddress address;
+	ListenAddress::of(listener, address);
+	auto group = std::find_if(groups.begin(), groups.end(),
+	  [&](const std::pair<ListenAddress, std::vector<SOCKET>>& g) { return address.length != 0 && g.first == address; });
+	if (group == groups.end()) {
+	  groups.emplace_back(address, std::vector<SOCKET>());
+	  group = groups.end() - 1;
+	}
+	group->second.push_back(listener);
+  }
+  // Every worker takes connections from every address, on sockets of its own while
+  // there are enough to go round
+  for (const std::pair<ListenAddress, std::vector<SOCKET>>& group : groups) {
+	const std::vector<SOCKET>& sockets = group.second;
+	for (size_t i = 0; i != std::max(sockets.size(), workers.size()); i++) {
+	  worker& w = *workers[i % workers.size()];
+	  SOCKET listener = sockets[i % sockets.size()];
+	  w.listeners.push_back(listener);
+#ifdef SO_INCOMING_CPU
+	  // The kernel then hands a connection to the worker on the CPU that received it
+	  if (w.cpu >= 0 && sockets.size() == workers.size()) {
+		int cpu = w.cpu;
+		setsockopt(listener, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+	  }
+#endif
+	}
+  }
+  for (size_t i = 1; i < workers.size(); i++) {
+	worker& w = *workers[i];
+	w.thread = std::thread([this, &w] { serve(w, nullptr); });
+  }
+  serve(*workers[0], &successor);
+  for (size_t i = 1; i < workers.size(); i++) {
+	workers[i]->request_drain();
+	workers[i]->thread.join();
+  }
+
+  // The successor holds its own references, so the sockets and their backlogs stay open
+  for (SOCKET listener : listeners) {
+	closesocket(listener);
+  }
+  listeners.clear();
+}
+
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+void BasicFileServer<IoEngine, MimeLookup, CachePolicy, Logger>::serve(worker& w, ListenerHandoff* successor)
+{
+  if (w.cpu >= 0 && !CpuPlacement::pin_current_thread(unsigned(w.cpu))) {
+	Logger::error() << "Error pinning worker " << w.index << " to CPU " << w.cpu << std::endl;
+  }
+  // This loop reads the configuration; it holds no snapshot between iterations
+  Rcu::reader rcu_reader;
+  Poller& poller = w.poller;
+  SendScheduler& scheduler = w.scheduler;
+  if (!poller.open()) {
+	Logger::error() << "Error creating poller: " << getErrorMessage() << std::endl;
+	return;
+  }
+  if (socket_options.busy_poll > 0 && !poller.busy_poll(unsigned(socket_options.busy_poll)) && w.index == 0) {
+	Logger::info() << "Busy polling in reads only; waits spin where net.core.busy_poll is set" << std::endl;
+  }
+  // The listening sockets and the signal or wake pipe stay watched; the successor
+  // is watched while it is awaited
+  for (SOCKET listener : w.listeners) {
+	poller.watch(listener, 0, Poller::readable);
+  }
+#ifndef _WIN32
+  if (successor) {
+	poller.watch(signal_pipe[0], 0, Poller::readable);
+  }
+  if (w.wake[0] != -1) {
+	poller.watch(w.wake[0], 0, Poller::readable);
+  }
+  int watched_successor = -1;
+#endif
+  std::vector<Poller::event> ready;
+  std::vector<SendScheduler::transfer*> active;
+  std::vector<SendScheduler::transfer*> done;
+  int timeout = -1;
+  auto next_idle_check = std::chrono::steady_clock::now();
+  while (true) {
+	rcu_reader.quiescent();
+	unsigned generation = config_generation;
+	const ServerConfig& cfg = *config;
+	if (generation != w.config_generation) {
+	  w.config_generation = generation;
+	  // The egress cap is shared out between the workers
+	  SendScheduler::config send = cfg.send;
+	  send.global_rate /= double(workers.size());
+	  scheduler.reconfigure(send);
+	}
+	if (!w.draining && w.drain_requested) {
+	  start_draining(w);
+	}
+	if (w.draining && (w.connections.empty() || std::chrono::steady_clock::now() >= w.drain_deadline)) {
+	  break;
+	}
+
+	// Only connections with responses under way change what they wait for without
+	// an event of their own; idle ones are not visited at all
+	active.clear();
+	scheduler.list(active);
+	for (SendScheduler::transfer* t : active) {
+	  connection& conn = *static_cast<connection*>(t);
+	  if (conn.held && conn.responses.size() < cfg.pipeline_depth) {
+		// Responses completed; requests held back by the depth limit can go ahead
+		process_requests(conn);
+		if (conn.scheduled()) {
+		  timeout = 0;
+		}
+	  }
+	  watch(conn);
+	}
+#ifndef _WIN32
+	if (successor && successor->wait_handle() != watched_successor) {
+	  watched_successor = successor->wait_handle();
+	  poller.watch(watched_successor, 0, Poller::readable);
+	}
+#endif
+	if (cfg.idle_timeout != 0 && !w.connections.empty()) {
+	  // Idle connections are looked for once a second
+	  timeout = timeout < 0 ? 1000 : std::min(timeout, 1000);
+	}
+	if (!w.lingering.empty()) {
+	  // Their completions are looked for ten times a second
+	  w.reap_lingering();
+	  timeout = timeout < 0 ? 100 : std::min(timeout, 100);
+	}
+	if (w.draining) {
+	  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(w.drain_deadline - std::chrono::steady_clock::now());
+	  int ms = int(std::max<long long>(left.count(), 0) + 1);
+	  timeout = timeout < 0 ? ms : std::min(timeout, ms);
+	}
+	if (poller.wait(ready, timeout) == SOCKET_ERROR) {
+	  if (!would_block()) {
+		Logger::error() << "Error polling sockets: " << getErrorMessage() << std::endl;
+	  }
+	  timeout = 0;
+	  continue;
+	}
+
+	for (const Poller::event& e : ready) {
+	  auto it = w.connections.find(e.socket);
+	  if (it != w.connections.end()) {
+		connection& conn = *it->second;
+		mark_active(conn);
+		// Completions are reported as errors, which are reported until taken
+		if (conn.zerocopy || !conn.zerocopy_pins.empty()) {
+		  conn.reap_zerocopy();
+		}
+		if (conn.handshaking) {
+		  continue_handshake(conn);
+		} else if (conn.h2) {
+		  if (e.ready & Poller::writable) {
+			scheduler.set_writable(&conn);
+		  }
+		  if (e.ready & Poller::readable) {
+			read_http2(conn);
+		  }
+		} else {
+		  // Write errors are picked up by the next write attempt
+		  if (e.ready & Poller::writable) {
+			scheduler.set_writable(&conn);
+		  }
+		  if (e.ready & Poller::readable) {
+			read_request(conn);
+		  }
+		}
+		// Handling may have closed the connection
+		it = w.connections.find(e.socket);
+		if (it != w.connections.end()) {
+		  watch(*it->second);
+		}
+		continue;
+	  }
+	  if (std::find(w.listeners.begin(), w.listeners.end(), e.socket) != w.listeners.end()) {
+		accept_connections(w, e.socket);
+		continue;
+	  }
+#ifndef _WIN32
+	  if (e.socket == w.wake[0]) {
+		// A drain request, handled at the top of the loop, or parked connections to resume
+		char bytes[16];
+		while (read(w.wake[0], bytes, sizeof(bytes)) > 0) {
+		}
+		resume_parked(w);
+		timeout = 0;
+	  } else if (!successor) {
+		continue;
+	  } else if (e.socket == signal_pipe[0]) {
+		std::string error;
+		char signals[16];
+		ssize_t count = read(signal_pipe[0], signals, sizeof(signals));
+		for (ssize_t i = 0; i < count; i++) {
+		  if (signals[i] == SIGUSR2) {
+			start_upgrade(w, *successor);
+		  } else if (signals[i] == SIGHUP) {
+			if (reload_config(error)) {
+			  Logger::info() << "Configuration reloaded" << (config_path.empty() ? "" : " from " + config_path) << std::endl;
+			} else {
+			  Logger::error() << "Error reloading configuration: " << error << std::endl;
+			}
+		  }
+		}
+	  } else if (e.socket == watched_successor) {
+		// check() may close the channel; it is watched again while still awaited
+		poller.watch(watched_successor, Poller::readable, 0);
+		watched_successor = -1;
+		switch (successor->check()) {
+		case ListenerHandoff::state::ready:
+		  Logger::info() << "Successor process " << successor->successor_pid() << " is accepting connections" << std::endl;
+		  for (size_t i = 1; i < workers.size(); i++) {
+			workers[i]->request_drain();
+		  }
+		  start_draining(w);
+		  break;
+		case ListenerHandoff::state::failed:
+		  Logger::error() << "Successor process " << successor->successor_pid() << " failed, still serving" << std::endl;
+		  break;
+		default:
+		  break;
+		}
+	  }
+#endif
+	}
+
+	// Let the scheduler write, then close connections whose responses are complete
+	done.clear();
+	timeout = scheduler.run(done);
+	for (SendScheduler::transfer* t : done) {
+	  connection& conn = *static_cast<connection*>(t);
+	  // HTTP/2 and persistent HTTP/1.1 connections stay open between responses
+	  if (conn.h2 && !conn.broken && !conn.h2->closed()) {
+		// Reading resumes if it stopped for frames that are written now
+		watch(conn);
+		continue;
+	  }
+	  if (conn.h2 && !conn.broken) {
+		close_http2(conn);
+		continue;
+	  }
+	  if (!conn.h2 && !conn.broken && !conn.closing) {
+		process_requests(conn);
+		if (conn.scheduled()) {
+		  timeout = 0;
+		}
+		if (conn.scheduled() || !conn.closing) {
+		  watch(conn);
+		  continue;
+		}
+	  }
+	  close_connection(conn);
+	}
+	if (cfg.idle_timeout != 0 && std::chrono::steady_clock::now() >= next_idle_check) {
+	  close_idle_connections(w, cfg.idle_timeout);
+	  next_idle_check = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	}
   }
 
-  // Close the server socket
-  closesocket(server_socket);
+  // Whatever the drain deadline cut off goes; the scheduler must not keep pointers
+  // to the connections going away
+  scheduler.clear();
+  w.recency.clear();
+  w.connections.clear();
 }
 
+template class BasicFileServer<SocketIo, ConcurrentMimeMapper, FileCache, StreamLogger>;
@@ -1,52 +1,326 @@
 #ifndef FILE_SERVER_H
 #define FILE_SERVER_H
 
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <filesystem>
+#include <functional>
 #include <regex>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "AssetBundle.h"
+#include "BufferPool.h"
+#include "CanonicalPath.h"
+#include "ContentHasher.h"
+#include "CpuPlacement.h"
+#include "FileCache.h"
+#include "FileStream.h"
+#include "Http2Session.h"
+#include "HugePageHeap.h"
+#include "ListenAddress.h"
+#include "ListenerHandoff.h"
 #include "MimeMapper.h"
-
-#ifdef _WIN32
-#include <winsock2.h>
-#pragma comment(lib, "ws2_32.lib")
-#ifndef _WIN32
-#define closesocket close
-#endif
-typedef int socklen_t;
-#else
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <cstring>
-#define SOCKET_ERROR -1
-#define INVALID_SOCKET -1
-typedef int SOCKET;
-#endif
+#include "PipePool.h"
+#include "Poller.h"
+#include "Preload.h"
+#include "RateLimiter.h"
+#include "Rcu.h"
+#include "RequestArena.h"
+#include "Resource.h"
+#include "SendScheduler.h"
+#include "ServerConfig.h"
+#include "ServerPolicies.h"
+#include "SocketOptions.h"
+#include "TlsContext.h"
+#include "ZeroCopyPins.h"
 
 namespace fs = std::filesystem;
 
-class FileServer {
+// Serves files over HTTP/1.1 and HTTP/2, specialized at compile time with its
+// policies (see ServerPolicies.h): IoEngine moves the bytes, MimeLookup maps
+// extensions to types (its findMime should be non-virtual or final), CachePolicy
+// opens resources, and Logger reports. The member definitions live in
+// FileServer.cpp, which instantiates the combinations the program uses.
+template<class IoEngine, class MimeLookup, class CachePolicy, class Logger>
+class BasicFileServer {
 private:
+  // One HTTP/1.1 response: head (with the body when it is small) and an optional
+  // body sent from a file, from memory or from a stream
+  struct response {
+    std::pmr::string head;
+    size_t head_sent = 0;
+    int file = -1;
+    std::shared_ptr<const char> data;
+    std::shared_ptr<BodyStream> stream;
+    uint64_t body_offset = 0;
+    uint64_t body_remaining = 0;
+  };
+  struct worker;
+  // A client socket together with the requests being read and the responses being written,
+  // in request order. Once a connection speaks HTTP/2, its session decides what gets written.
+  struct connection : SendScheduler::transfer, Http2Session::transport {
+    SOCKET socket = INVALID_SOCKET;
+    sockaddr_storage addr;
+    std::unique_ptr<TlsSession> tls;
+    bool handshaking = false;
+    // Received bytes not parsed yet. The buffer is on loan only while there are any.
+    BufferPool::buffer receive_buffer;
+    size_t received = 0;
+    unsigned requests_handled = 0;
+    // Parsing stopped at the pipeline depth limit
+    bool held = false;
+    // The next request waits for its file, which another request is loading; it stays
+    // in the receive buffer and nothing more is read until it is handled again
+    bool parked = false;
+    // The next request is being handled again after waiting
+    bool resumed = false;
+    // The peer has finished sending
+    bool read_closed = false;
+    // No more requests are handled; the connection closes after the queued responses
+    bool closing = false;
+    // The end of the stream went out; what the peer still sends is dropped until it
+    // closes too, or until the deadline
+    bool write_closed = false;
+    std::chrono::steady_clock::time_point linger_deadline;
+    // Allocates nothing while empty
+    std::pmr::list<response> responses;
+    // Holds bytes of the body being sent, when it is spliced and they could not all go out
+    PipePool::pipe spliced;
+    // Large bodies in memory are sent with MSG_ZEROCOPY, until the kernel reports
+    // copying them anyway
+    bool zerocopy = false;
+    ZeroCopyPins zerocopy_pins;
+    std::unique_ptr<Http2Session> h2;
+    bool broken = false;
+    // What the socket is registered with the poller for
+    unsigned char watched = 0;
+    // Last time the socket was readable or writable
+    std::chrono::steady_clock::time_point active;
+    // In the recency list of its worker
+    typename std::list<connection*>::iterator recency_position;
+    // The worker that accepted it and serves it; responses and their heads are
+    // allocated from its memory
+    worker& owner;
+    explicit connection(worker& owner);
+    ~connection();
+    // Drops count parsed bytes from the front of the receive buffer
+    void consume(size_t count);
+    long long write_some(size_t limit) override;
+    long long write_responses(size_t limit);
+    long long write_heads(size_t limit);
+    uint64_t remaining() const override;
+    // An HTTP/2 session counts the bodies its windows hold back, so that it is classed
+    // by every stream it has rather than by what the client lets through at a time
+    uint64_t backlog() const override;
+    long long write_bytes(const char* data, size_t size, bool more) override;
+    long long write_file(int fd, BodyStream* stream, uint64_t offset, size_t count) override;
+    long long write_spliced(int fd, uint64_t offset, size_t count);
+    long long write_data(const std::shared_ptr<const char>& data, uint64_t offset, size_t count);
+    // Releases the bodies of completed zerocopy sends
+    void reap_zerocopy();
+  };
+  // An event loop and the connections it accepted, on a thread of its own. It
+  // allocates from its own pools, and its connections never leave it.
+  struct worker {
+    unsigned index;
+    // The CPU its thread is pinned to, or -1
+    int cpu;
+    // The cache replica of its NUMA node, or the one cache
+    CachePolicy* cache;
+    // Watched for connections; with fewer listening sockets than workers, some share one
+    std::vector<SOCKET> listeners;
+    Poller poller;
+    SendScheduler scheduler;
+    // Receive buffers; a request head that fills a small one moves to a large one
+    BufferPool receive_buffers;
+    BufferPool large_receive_buffers;
+    // File bodies on plain connections go through these when splicing
+    PipePool pipes;
+    bool splice = false;
+    // Bodies in memory of at least this size are sent with MSG_ZEROCOPY; 0 disables
+    size_t zerocopy_threshold = 0;
+    // Connections are corked while they write
+    bool cork = false;
+    // Sockets of closed connections, left open until their zerocopy sends are complete
+    std::vector<std::pair<SOCKET, ZeroCopyPins>> lingering;
+    // Response heads and queues; freed blocks are reused rather than returned to the heap
+    std::pmr::unsynchronized_pool_resource response_memory;
+    // What a request needs while it is handled; reset after each
+    RequestArena request_memory;
+    std::unordered_map<SOCKET, std::unique_ptr<connection>> connections;
+    // The connections by their last activity, least recent first, so that looking
+    // for idle ones stops at the first that is not
+    std::list<connection*> recency;
+    bool draining = false;
+    std::chrono::steady_clock::time_point drain_deadline;
+    // Set by the first worker, which handles the upgrade, when the others are to drain
+    std::atomic<bool> drain_requested;
+    // Written to wake the loop up
+    int wake[2] = { -1, -1 };
+    // Sockets of parked connections whose files are loaded, told from the threads
+    // that loaded them
+    std::mutex resume_lock;
+    std::vector<SOCKET> resumable;
+    // Of the configuration whose send settings the scheduler has
+    unsigned config_generation = 0;
+    std::thread thread;
+    // Buffers come from buffer_memory
+    worker(unsigned index, int cpu, CachePolicy* cache, std::pmr::memory_resource* buffer_memory);
+    ~worker();
+    void request_drain();
+    // Has the parked connection on socket handle its request again; from any thread
+    void resume(SOCKET socket);
+    void reap_lingering();
+  };
+  // Listened on when no addresses are set: any IPv4 address, on this port
   int port;
-  std::string root;
-  const IMimeMapper *mime_mapper;
+  std::vector<ListenAddress> listen_addresses;
+  const MimeLookup *mime_mapper;
+  // Cache replicas by NUMA node, or a single cache under -1
+  std::map<int, std::unique_ptr<CachePolicy>> caches;
+  // Serves every resource when set
+  AssetBundle *bundle = nullptr;
+  // Content ETags for files, when set
+  ContentHasher *hasher = nullptr;
+  // Created by a reload while workers read it
+  std::atomic<RateLimiter*> rate_limiter;
+  TlsContext *tls = nullptr;
+  bool http2 = true;
+  // What the setters configured; the configuration file is read over a copy of it
+  ServerConfig defaults;
+  std::string config_path;
+  Preload::config preload_config;
+  FileStream::config stream_config;
+  RcuPointer<const ServerConfig> config;
+  // Counts reloads, so that workers notice new send settings
+  std::atomic<unsigned> config_generation;
+  // Reloads come from signals and from admin requests on any worker
+  std::mutex reload_lock;
+  std::vector<std::string> upgrade_command;
+  unsigned worker_count = 1;
+  bool pin_workers = false;
+  bool cache_per_node = false;
+  bool splice = false;
+  size_t zerocopy_threshold = 0;
+  SocketOptions socket_options;
+  // The first runs on the thread that calls run() and handles signals and upgrades
+  std::vector<std::unique_ptr<worker>> workers;
+  // The listening sockets of the process, on every address, spread over the workers
+  std::vector<SOCKET> listeners;
 public:
-    FileServer(int port, std::string root_dir);
-    FileServer(int port, std::string root_dir, const IMimeMapper *mime_mapper);
-    ~FileServer();
+    BasicFileServer(int port, std::string root_dir);
+    // Takes ownership of the mapper
+    BasicFileServer(int port, std::string root_dir, const MimeLookup *mime_mapper);
+    ~BasicFileServer();
+    // Takes ownership of the limiter; nullptr disables rate limiting
+    void set_rate_limiter(RateLimiter *limiter);
+    // Takes ownership of the context; every accepted connection then speaks TLS
+    void set_tls_context(TlsContext *context);
+    // Takes ownership of the bundle; resources are then served from it instead of the root directory
+    void set_bundle(AssetBundle *assets);
+    // Takes ownership of the hasher; files are then sent with content ETags once hashed
+    void set_content_hasher(ContentHasher *content_hasher);
+    // Must be called before run()
+    void set_send_config(const SendScheduler::config& cfg);
+    // HTTP/2 is offered through ALPN, h2c upgrade and prior knowledge unless disabled
+    void set_http2(bool enabled, const Http2Session::settings& settings);
+    // Most requests a connection may have waiting for their responses
+    void set_pipeline_depth(size_t depth);
+    // Bytes of small files kept in memory, if the cache policy keeps any
+    void set_cache(size_t capacity, size_t max_file_size);
+    // On SIGUSR2, command is started as successor and takes over the listening
+    // sockets; this process then drains its connections for up to drain_timeout seconds
+    void set_hot_upgrade(const std::vector<std::string>& command, unsigned drain_timeout);
+    // Settings in the file override those of the setters. The file is read when
+    // run() starts and again on SIGHUP or a POST to its admin_path.
+    void set_config_file(const std::string& path);
+    // Files to read in when run() starts, before the listening sockets are taken
+    void set_preload(const Preload::config& cfg);
+    // How files at least cfg.threshold bytes large are read while they are sent
+    void set_streaming(const FileStream::config& cfg);
+    // File bodies on plain connections are spliced through pipes of each worker rather
+    // than sent with sendfile (Linux only). Must be called before run().
+    void set_splice(bool enabled);
+    // Bodies in memory of at least threshold bytes are sent on plain connections with
+    // MSG_ZEROCOPY (Linux only), smaller ones are copied; 0 copies all. Must be called
+    // before run().
+    void set_zerocopy(size_t threshold);
+    // How the listening sockets, and the connections accepted on them, are tuned. Must
+    // be called before run().
+    void set_socket_options(const SocketOptions& options);
+    // Listens on each of addresses instead of the port given to the constructor, every
+    // worker taking connections from each. Must be called before run().
+    void set_listen_addresses(const std::vector<ListenAddress>& addresses);
+    // Serves with count event loops on threads of their own. With pin, each is pinned
+    // to a CPU and, where the listening sockets are its own, takes the connections
+    // that CPU receives; with per_node_caches, each NUMA node of those CPUs has a
+    // replica of the cache in its own memory. Must be called before run().
+    void set_workers(unsigned count, bool pin, bool per_node_caches);
     void run();
 private:
-    SOCKET create_socket();
-    void send_ok_response(SOCKET client_socket, const std::string& mime_type);
-    void send_not_found_response(SOCKET client_socket);
-    void send_internal_server_error_response(SOCKET client_socket);
-    void handle_request(SOCKET client_socket);
+    SOCKET create_socket(int family);
+    // Binds a listening socket, taking over the file of a Unix socket nothing listens on
+    bool bind_listener(SOCKET sock, const ListenAddress& address);
+    // Sets the socket options of a listening socket, reporting those refused
+    void tune_listener(SOCKET sock, int family);
+    // Places the workers on CPUs and gives each its cache
+    void create_workers();
+    bool open_listeners(ListenerHandoff& predecessor);
+    // The event loop of w; successor is set for the first worker
+    void serve(worker& w, ListenerHandoff* successor);
+    void start_upgrade(worker& w, ListenerHandoff& successor);
+    void start_draining(worker& w);
+    bool reload_config(std::string& error);
+    void preload();
+    void close_idle_connections(worker& w, unsigned idle_timeout);
+    // Handles again the requests of the connections w was told to resume
+    void resume_parked(worker& w);
+    void accept_connections(worker& w, SOCKET server_socket);
+    void continue_handshake(connection& conn);
+    void read_request(connection& conn);
+    void process_requests(connection& conn);
+    void start_http2(connection& conn);
+    void read_http2(connection& conn);
+    void serve_http2(connection& conn);
+    void close_http2(connection& conn);
+    void close_connection(connection& conn);
+    // Records traffic on conn, which becomes the most recent of its worker
+    void mark_active(connection& conn);
+    // Registers the socket of conn for what it waits for now
+    void watch(connection& conn);
+    void respond(connection& conn, std::pmr::string head);
+    // Takes over the file or buffer of body
+    void respond(connection& conn, std::pmr::string head, Resource& body);
+    void send_ok_response(connection& conn, Resource& resource);
+    void send_not_modified_response(connection& conn, const Resource& resource);
+    void send_not_found_response(connection& conn);
+    void send_bad_request_response(connection& conn);
+    void send_not_acceptable_response(connection& conn);
+    void send_uri_too_long_response(connection& conn);
+    void send_internal_server_error_response(connection& conn);
+    void send_too_many_requests_response(connection& conn, unsigned retry_after);
+    void handle_admin_request(connection& conn, std::string_view method);
+    // The strings of the resource are allocated from memory. With wake, a file another
+    // request is loading leaves the resource pending, and wake is called once it is loaded.
+    Resource open_resource(CachePolicy& cache, const ResourceRequest& request, const sockaddr *client_addr,
+      std::pmr::memory_resource *memory, const std::function<void()>* wake = nullptr);
+    // request is in the receive buffer of conn
+    void handle_request(connection& conn, std::string_view request);
 };
 
+typedef BasicFileServer<SocketIo, ConcurrentMimeMapper, FileCache, StreamLogger> FileServer;
+extern template class BasicFileServer<SocketIo, ConcurrentMimeMapper, FileCache, StreamLogger>;
+
 #endif // FILE_SERVER_H
@@ -0,0 +1,123 @@
+#include "FileStream.h"
+#include "HugePageHeap.h"
+#include <algorithm>
+#include <new>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Reads bypass the page cache for fd, or no longer do; false where that is not possible
+static bool set_direct_io(int fd, bool enabled) {
+#if defined(_WIN32)
+  return false;
+#elif defined(O_DIRECT)
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, enabled ? flags | O_DIRECT : flags & ~O_DIRECT) == 0;
+#elif defined(F_NOCACHE)
+  return fcntl(fd, F_NOCACHE, enabled ? 1 : 0) != -1;
+#else
+  return false;
+#endif
+}
+
+FileStream::FileStream(int fd, uint64_t size, const config& cfg) :
+  fd(fd), size(size), window(std::max(cfg.window & ~(2 * alignment - 1), 2 * alignment))
+{
+  if (cfg.direct && set_direct_io(fd, true)) {
+	try {
+	  for (buffer& b : buffers) {
+		b.data = (char*)HugePageHeap::shared().allocate(window / 2, alignment);
+	  }
+	} catch (const std::bad_alloc&) {
+	}
+	if (buffers[1].data && fill(buffers[0], 0)) {
+	  return;
+	}
+	// The file system does not take direct reads after all
+	for (buffer& b : buffers) {
+	  if (b.data) {
+		HugePageHeap::shared().deallocate(b.data, window / 2, alignment);
+		b = buffer();
+	  }
+	}
+	set_direct_io(fd, false);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  sent(0);
+}
+
+FileStream::~FileStream()
+{
+  for (buffer& b : buffers) {
+	if (b.data) {
+	  HugePageHeap::shared().deallocate(b.data, window / 2, alignment);
+	}
+  }
+}
+
+// Reads the part of the file around offset into b; false if offset is not in it
+bool FileStream::fill(buffer& b, uint64_t offset)
+{
+  uint64_t start = offset & ~uint64_t(alignment - 1);
+#ifdef _WIN32
+  long long got = _lseeki64(fd, start, SEEK_SET) == -1 ? -1 : _read(fd, b.data, unsigned(window / 2));
+#else
+  long long got = pread(fd, b.data, window / 2, off_t(start));
+#endif
+  b.offset = start;
+  b.length = got > 0 ? size_t(got) : 0;
+  return b.holds(offset);
+}
+
+const char* FileStream::read(uint64_t offset, size_t& count)
+{
+  buffer* held = buffers[0].holds(offset) ? &buffers[0] : buffers[1].holds(offset) ? &buffers[1] : nullptr;
+  if (!held) {
+	// Out of order; the buffer further behind is reused
+	held = buffers[0].offset <= buffers[1].offset ? &buffers[0] : &buffers[1];
+	if (!fill(*held, offset)) {
+	  return nullptr;
+	}
+  }
+  count = size_t(std::min<uint64_t>(count, held->offset + held->length - offset));
+  return held->data + (offset - held->offset);
+}
+
+void FileStream::sent(uint64_t offset)
+{
+  if (direct()) {
+	// Once one buffer has started to go out, the other is filled with what follows it
+	for (int i = 0; i != 2; i++) {
+	  const buffer& current = buffers[i];
+	  buffer& other = buffers[1 - i];
+	  uint64_t next = current.offset + current.length;
+	  if (current.holds(offset) && next < size && (other.length == 0 || other.offset != next)) {
+		fill(other, next);
+		break;
+	  }
+	}
+	return;
+  }
+#ifdef POSIX_FADV_DONTNEED
+  // The next window is asked for once the cursor is half way into the last one
+  if (advised < size && offset + window / 2 >= advised) {
+	posix_fadvise(fd, off_t(advised), off_t(window), POSIX_FADV_WILLNEED);
+	advised += window;
+  }
+  // Pages the socket still refers to are not dropped, so dropping lags a window
+  // behind; once all is sent, whatever can be dropped is. Only whole folios in the
+  // range are dropped, and large ones may straddle where the last drop ended, so
+  // every drop starts from the beginning.
+  uint64_t end = offset == size ? size : offset >= window ? offset - window : 0;
+  if (end >= dropped + window || (end == size && end > dropped)) {
+	posix_fadvise(fd, 0, off_t(end), POSIX_FADV_DONTNEED);
+	dropped = end;
+  }
+#endif
+}
@@ -0,0 +1,74 @@
+#ifndef FILE_STREAM_H
+#define FILE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A body made or read while it is sent, rather than sent from a whole buffer or
+// by the kernel from a file
+class BodyStream {
+public:
+  virtual ~BodyStream() {}
+  // The body is sent from read() rather than from the file
+  virtual bool direct() const = 0;
+  // The bytes at offset, and in count how many of those asked for are there; null
+  // if they could not be had. Valid until the next call.
+  virtual const char* read(uint64_t offset, size_t& count) = 0;
+  // The body up to offset has been sent
+  virtual void sent(uint64_t offset) = 0;
+};
+
+// How a large file is read while its body is sent, so that bulk downloads do not
+// push the small, hot files out of the page cache.
+//
+// The kernel is told that the file is read sequentially and is asked for a window
+// ahead of the send cursor, and the pages further behind it than a window are
+// dropped: a download occupies a few windows of the page cache however large the
+// file. With direct I/O the page cache is bypassed altogether. The file is read
+// into two aligned buffers in turn, the next one being filled as soon as the
+// other has started to go out, so the socket drains one while the disk fills the
+// other; the reads themselves are synchronous. Where direct I/O is not available
+// (tmpfs, Windows), the hints are used; where neither is, the file is read as any
+// other. Not thread-safe.
+class FileStream : public BodyStream {
+public:
+  struct config {
+	// Files of at least this size are streamed; 0 streams none
+	uint64_t threshold = 16 << 20;
+	// Bytes asked for ahead of the send cursor; with direct I/O, what both buffers hold
+	size_t window = 1 << 20;
+	bool direct = false;
+  };
+  // Of direct I/O buffers, offsets and lengths
+  static const size_t alignment = 4096;
+private:
+  struct buffer {
+	char* data = nullptr;
+	uint64_t offset = 0;
+	size_t length = 0;
+	bool holds(uint64_t position) const { return position >= offset && position - offset < length; }
+  };
+  int fd;
+  uint64_t size;
+  size_t window;
+  // The file up to here has been asked for, and dropped
+  uint64_t advised = 0;
+  uint64_t dropped = 0;
+  // Both empty without direct I/O
+  buffer buffers[2];
+
+  bool fill(buffer& b, uint64_t offset);
+public:
+  // Starts reading fd, of size bytes, from its start; fd stays the caller's
+  FileStream(int fd, uint64_t size, const config& cfg);
+  FileStream(const FileStream&) = delete;
+  FileStream& operator=(const FileStream&) = delete;
+  ~FileStream();
+  // With direct I/O only
+  bool direct() const override { return buffers[0].data != nullptr; }
+  // With direct I/O: reads the bytes at offset if need be
+  const char* read(uint64_t offset, size_t& count) override;
+  void sent(uint64_t offset) override;
+};
+
+#endif // FILE_STREAM_H
@@ -0,0 +1,352 @@
+#include "Hpack.h"
+
+namespace {
+  struct static_entry {
+	const char* name;
+	const char* value;
+  };
+
+  const static_entry static_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+  };
+  const size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+  struct huffman_code {
+	uint32_t code;
+	uint8_t length;
+  };
+
+  // RFC 7541 Appendix B, symbol 256 is EOS
+  const huffman_code huffman_codes[257] = {
+	{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+	{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+	{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+	{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+	{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+	{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+	{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+	{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+	{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+	{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+	{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+	{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+	{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+	{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+	{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+	{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+	{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+	{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+	{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+	{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+	{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+	{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+	{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+	{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+	{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+	{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+	{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+	{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+	{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+	{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+	{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+	{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+	{ 0x3fffffff, 30 },
+  };
+
+  struct huffman_node {
+	int16_t next[2];
+	int16_t symbol;
+  };
+
+  const std::vector<huffman_node>& huffman_tree() {
+	static const std::vector<huffman_node> tree = [] {
+	  std::vector<huffman_node> nodes(1, huffman_node{ { -1, -1 }, -1 });
+	  for (int symbol = 0; symbol != 257; symbol++) {
+		size_t node = 0;
+		for (int bit = huffman_codes[symbol].length - 1; bit >= 0; bit--) {
+		  int branch = (huffman_codes[symbol].code >> bit) & 1;
+		  if (nodes[node].next[branch] < 0) {
+			nodes[node].next[branch] = int16_t(nodes.size());
+			nodes.push_back(huffman_node{ { -1, -1 }, -1 });
+		  }
+		  node = size_t(nodes[node].next[branch]);
+		}
+		nodes[node].symbol = int16_t(symbol);
+	  }
+	  return nodes;
+	}();
+	return tree;
+  }
+
+  bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out) {
+	if (p == end) {
+	  return false;
+	}
+	bool huffman = (*p & 0x80) != 0;
+	uint64_t length;
+	if (!hpack::decode_integer(p, end, 7, length) || length > uint64_t(end - p)) {
+	  return false;
+	}
+	out.clear();
+	if (huffman) {
+	  if (!hpack::huffman_decode(p, size_t(length), out)) {
+		return false;
+	  }
+	} else {
+	  out.assign(reinterpret_cast<const char*>(p), size_t(length));
+	}
+	p += length;
+	return true;
+  }
+}
+
+bool hpack::decode_integer(const uint8_t*& p, const uint8_t* end, unsigned prefix_bits, uint64_t& value)
+{
+  if (p == end) {
+	return false;
+  }
+  uint8_t mask = uint8_t((1u << prefix_bits) - 1);
+  value = *p++ & mask;
+  if (value < mask) {
+	return true;
+  }
+  for (unsigned shift = 0; p != end && shift <= 56; shift += 7) {
+	uint8_t byte = *p++;
+	value += uint64_t(byte & 0x7f) << shift;
+	if ((byte & 0x80) == 0) {
+	  return true;
+	}
+  }
+  return false;
+}
+
+void hpack::encode_integer(std::string& out, uint8_t flags, unsigned prefix_bits, uint64_t value)
+{
+  uint8_t mask = uint8_t((1u << prefix_bits) - 1);
+  if (value < mask) {
+	out += char(flags | value);
+	return;
+  }
+  out += char(flags | mask);
+  value -= mask;
+  while (value >= 0x80) {
+	out += char((value & 0x7f) | 0x80);
+	value >>= 7;
+  }
+  out += char(value);
+}
+
+bool hpack::huffman_decode(const uint8_t* data, size_t size, std::string& out)
+{
+  const std::vector<huffman_node>& tree = huffman_tree();
+  size_t node = 0;
+  unsigned depth = 0;
+  bool all_ones = true;
+  for (size_t i = 0; i != size; i++) {
+	for (int bit = 7; bit >= 0; bit--) {
+	  int branch = (data[i] >> bit) & 1;
+	  int16_t next = tree[node].next[branch];
+	  if (next < 0) {
+		return false;
+	  }
+	  node = size_t(next);
+	  depth++;
+	  all_ones = all_ones && branch == 1;
+	  if (tree[node].symbol >= 0) {
+		if (tree[node].symbol == 256) {
+		  return false;
+		}
+		out += char(tree[node].symbol);
+		node = 0;
+		depth = 0;
+		all_ones = true;
+	  }
+	}
+  }
+  // Padding must be a prefix of EOS shorter than a byte
+  return depth < 8 && all_ones;
+}
+
+HpackDecoder::HpackDecoder(size_t table_limit, size_t max_header_list_size) :
+  table_limit(table_limit), settings_limit(table_limit), max_header_list_size(max_header_list_size)
+{
+}
+
+bool HpackDecoder::lookup(uint64_t index, std::string& name, std::string* value) const
+{
+  if (index == 0) {
+	return false;
+  }
+  if (index <= static_table_size) {
+	name = static_table[index - 1].name;
+	if (value) {
+	  *value = static_table[index - 1].value;
+	}
+	return true;
+  }
+  index -= static_table_size + 1;
+  if (index >= table.size()) {
+	return false;
+  }
+  name = table[size_t(index)].name;
+  if (value) {
+	*value = table[size_t(index)].value;
+  }
+  return true;
+}
+
+void HpackDecoder::evict(size_t limit)
+{
+  while (table_size > limit && !table.empty()) {
+	table_size -= table.back().name.size() + table.back().value.size() + 32;
+	table.pop_back();
+  }
+}
+
+void HpackDecoder::insert(const std::string& name, const std::string& value)
+{
+  size_t size = name.size() + value.size() + 32;
+  if (size > table_limit) {
+	evict(0);
+	return;
+  }
+  evict(table_limit - size);
+  table.push_front(entry{ name, value });
+  table_size += size;
+}
+
+bool HpackDecoder::decode(const uint8_t* data, size_t size, header_list& headers)
+{
+  const uint8_t* p = data;
+  const uint8_t* end = data + size;
+  size_t list_size = 0;
+  bool field_seen = false;
+  std::string name;
+  std::string value;
+  while (p != end) {
+	uint8_t first = *p;
+	uint64_t index;
+	if ((first & 0xe0) == 0x20) {
+	  // Dynamic table size update, only allowed before the first field
+	  if (field_seen || !hpack::decode_integer(p, end, 5, index) || index > settings_limit) {
+		return false;
+	  }
+	  table_limit = size_t(index);
+	  evict(table_limit);
+	  continue;
+	}
+	field_seen = true;
+	if (first & 0x80) {
+	  // Indexed header field
+	  if (!hpack::decode_integer(p, end, 7, index) || !lookup(index, name, &value)) {
+		return false;
+	  }
+	} else {
+	  // Literal with incremental indexing (6-bit prefix), without indexing or never indexed (4-bit)
+	  bool indexing = (first & 0xc0) == 0x40;
+	  if (!hpack::decode_integer(p, end, indexing ? 6 : 4, index)) {
+		return false;
+	  }
+	  if (index != 0) {
+		if (!lookup(index, name, nullptr)) {
+		  return false;
+		}
+	  } else if (!decode_string(p, end, name)) {
+		return false;
+	  }
+	  if (!decode_string(p, end, value)) {
+		return false;
+	  }
+	  if (indexing) {
+		insert(name, value);
+	  }
+	}
+	list_size += name.size() + value.size() + 32;
+	if (list_size > max_header_list_size) {
+	  return false;
+	}
+	headers.emplace_back(name, value);
+  }
+  return true;
+}
+
+void HpackEncoder::encode_status(std::string& out, int status)
+{
+  switch (status) {
+  case 200: out += char(0x88); return;
+  case 204: out += char(0x89); return;
+  case 206: out += char(0x8a); return;
+  case 304: out += char(0x8b); return;
+  case 400: out += char(0x8c); return;
+  case 404: out += char(0x8d); return;
+  case 500: out += char(0x8e); return;
+  }
+  encode_field(out, name_index::status, std::to_string(status));
+}
+
+void HpackEncoder::encode_field(std::string& out, name_index name, std::string_view value)
+{
+  hpack::encode_integer(out, 0x00, 4, name);
+  hpack::encode_integer(out, 0x00, 7, value.size());
+  out.append(value.data(), value.size());
+}
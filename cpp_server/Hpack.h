@@ -0,0 +1,66 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HPACK header compression (RFC 7541) for HTTP/2.
+//
+// The decoder is complete: static and dynamic tables, table size updates and
+// Huffman-coded strings. Responses only carry a handful of headers, so the
+// encoder emits literals against static table names and never touches a dynamic
+// table, which keeps it stateless.
+
+class HpackDecoder {
+public:
+  typedef std::vector<std::pair<std::string, std::string>> header_list;
+private:
+  struct entry {
+	std::string name;
+	std::string value;
+  };
+  std::deque<entry> table;
+  size_t table_size = 0;
+  size_t table_limit;
+  size_t settings_limit;
+  size_t max_header_list_size;
+
+  bool lookup(uint64_t index, std::string& name, std::string* value) const;
+  void evict(size_t limit);
+  void insert(const std::string& name, const std::string& value);
+public:
+  // table_limit is what we advertise as SETTINGS_HEADER_TABLE_SIZE
+  explicit HpackDecoder(size_t table_limit = 4096, size_t max_header_list_size = 64 << 10);
+  // Decodes one complete header block; false means a COMPRESSION_ERROR
+  bool decode(const uint8_t* data, size_t size, header_list& headers);
+};
+
+class HpackEncoder {
+public:
+  // Static table indexes of the names we send
+  enum name_index : unsigned {
+	status = 8,
+	content_encoding = 26,
+	content_length = 28,
+	content_type = 31,
+	etag = 34,
+	retry_after = 53,
+	vary = 59,
+  };
+  static void encode_status(std::string& out, int status);
+  // Literal header field without indexing, name taken from the static table
+  static void encode_field(std::string& out, name_index name, std::string_view value);
+};
+
+namespace hpack {
+  bool decode_integer(const uint8_t*& p, const uint8_t* end, unsigned prefix_bits, uint64_t& value);
+  void encode_integer(std::string& out, uint8_t flags, unsigned prefix_bits, uint64_t value);
+  bool huffman_decode(const uint8_t* data, size_t size, std::string& out);
+}
+
+#endif // HPACK_H
@@ -0,0 +1,731 @@
+#include "Http2Session.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  enum frame_type : uint8_t {
+	DATA = 0x0,
+	HEADERS = 0x1,
+	PRIORITY = 0x2,
+	RST_STREAM = 0x3,
+	SETTINGS = 0x4,
+	PUSH_PROMISE = 0x5,
+	PING = 0x6,
+	GOAWAY = 0x7,
+	WINDOW_UPDATE = 0x8,
+	CONTINUATION = 0x9,
+  };
+
+  enum frame_flag : uint8_t {
+	END_STREAM = 0x1,
+	ACK = 0x1,
+	END_HEADERS = 0x4,
+	PADDED = 0x8,
+	PRIORITY_INFO = 0x20,
+  };
+
+  enum error_code : uint32_t {
+	NO_ERROR = 0x0,
+	PROTOCOL_ERROR = 0x1,
+	FLOW_CONTROL_ERROR = 0x3,
+	FRAME_SIZE_ERROR = 0x6,
+	REFUSED_STREAM = 0x7,
+	COMPRESSION_ERROR = 0x9,
+	ENHANCE_YOUR_CALM = 0xb,
+  };
+
+  enum setting_id : uint16_t {
+	HEADER_TABLE_SIZE = 0x1,
+	ENABLE_PUSH = 0x2,
+	MAX_CONCURRENT_STREAMS = 0x3,
+	INITIAL_WINDOW_SIZE = 0x4,
+	MAX_FRAME_SIZE = 0x5,
+  };
+
+  const int64_t max_window = 0x7fffffff;
+  const size_t max_header_block = 64 << 10;
+  // Stream resets a client may send at once, and then per second
+  const double reset_burst = 200;
+  const double resets_per_second = 100;
+
+  uint32_t read32(const uint8_t* p) {
+	return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+  }
+
+  void write32(char* p, uint32_t value) {
+	p[0] = char(value >> 24);
+	p[1] = char(value >> 16);
+	p[2] = char(value >> 8);
+	p[3] = char(value);
+  }
+
+  void write_frame_head(char* p, size_t length, uint8_t type, uint8_t flags, uint32_t stream_id) {
+	p[0] = char(length >> 16);
+	p[1] = char(length >> 8);
+	p[2] = char(length);
+	p[3] = char(type);
+	p[4] = char(flags);
+	write32(p + 5, stream_id & 0x7fffffff);
+  }
+
+  bool base64url_decode(const std::string& in, std::string& out) {
+	unsigned buffer = 0;
+	int bits = 0;
+	for (char c : in) {
+	  int value;
+	  if (c >= 'A' && c <= 'Z') {
+		value = c - 'A';
+	  } else if (c >= 'a' && c <= 'z') {
+		value = c - 'a' + 26;
+	  } else if (c >= '0' && c <= '9') {
+		value = c - '0' + 52;
+	  } else if (c == '-' || c == '+') {
+		value = 62;
+	  } else if (c == '_' || c == '/') {
+		value = 63;
+	  } else if (c == '=') {
+		break;
+	  } else {
+		return false;
+	  }
+	  buffer = (buffer << 6) | unsigned(value);
+	  bits += 6;
+	  if (bits >= 8) {
+		bits -= 8;
+		out += char((buffer >> bits) & 0xff);
+	  }
+	}
+	return true;
+  }
+}
+
+const char Http2Session::preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+Http2Session::Http2Session(resolver resolve, const settings& local) :
+  resolve(std::move(resolve)), local(local), decoder(local.header_table_size),
+  reset_tokens(reset_burst), reset_stamp(std::chrono::steady_clock::now())
+{
+  // The server preface goes out first
+  queue_settings();
+}
+
+Http2Session::~Http2Session()
+{
+  for (auto& entry : streams) {
+	entry.second.body.release();
+  }
+}
+
+void Http2Session::queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t length)
+{
+  char head[9];
+  write_frame_head(head, length, type, flags, stream_id);
+  control.append(head, sizeof(head));
+  if (length != 0) {
+	control.append(payload, length);
+  }
+}
+
+void Http2Session::queue_settings()
+{
+  std::string payload;
+  auto add = [&payload](uint16_t id, uint32_t value) {
+	char entry[6] = { char(id >> 8), char(id) };
+	write32(entry + 2, value);
+	payload.append(entry, sizeof(entry));
+  };
+  add(MAX_CONCURRENT_STREAMS, local.max_concurrent_streams);
+  if (local.initial_window_size != 65535) {
+	add(INITIAL_WINDOW_SIZE, local.initial_window_size);
+  }
+  if (local.max_frame_size != 16384) {
+	add(MAX_FRAME_SIZE, local.max_frame_size);
+  }
+  if (local.header_table_size != 4096) {
+	add(HEADER_TABLE_SIZE, local.header_table_size);
+  }
+  queue_frame(SETTINGS, 0, 0, payload.data(), payload.size());
+}
+
+void Http2Session::queue_rst_stream(uint32_t stream_id, uint32_t code)
+{
+  char payload[4];
+  write32(payload, code);
+  queue_frame(RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+void Http2Session::queue_window_update(uint32_t stream_id, uint32_t increment)
+{
+  char payload[4];
+  write32(payload, increment);
+  queue_frame(WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+bool Http2Session::connection_error(uint32_t code)
+{
+  if (!goaway_sent) {
+	char payload[8];
+	write32(payload, last_stream_id);
+	write32(payload + 4, code);
+	queue_frame(GOAWAY, 0, 0, payload, sizeof(payload));
+	goaway_sent = true;
+  }
+  return false;
+}
+
+bool Http2Session::apply_settings(const uint8_t* payload, size_t length)
+{
+  for (size_t i = 0; i + 6 <= length; i += 6) {
+	uint16_t id = uint16_t(payload[i] << 8 | payload[i + 1]);
+	uint32_t value = read32(payload + i + 2);
+	switch (id) {
+	case ENABLE_PUSH:
+	  if (value > 1) {
+		return connection_error(PROTOCOL_ERROR);
+	  }
+	  break;
+	case INITIAL_WINDOW_SIZE: {
+	  if (value > max_window) {
+		return connection_error(FLOW_CONTROL_ERROR);
+	  }
+	  int64_t delta = int64_t(value) - int64_t(peer_initial_window);
+	  for (auto& entry : streams) {
+		entry.second.window += delta;
+		if (entry.second.window > max_window) {
+		  return connection_error(FLOW_CONTROL_ERROR);
+		}
+	  }
+	  peer_initial_window = value;
+	  break;
+	}
+	case MAX_FRAME_SIZE:
+	  if (value < 16384 || value > 16777215) {
+		return connection_error(PROTOCOL_ERROR);
+	  }
+	  peer_max_frame_size = value;
+	  break;
+	default:
+	  // Our encoder has no dynamic table and we never push, so the rest does not matter
+	  break;
+	}
+  }
+  return true;
+}
+
+bool Http2Session::upgrade(const ResourceRequest& request, const std::string& http2_settings)
+{
+  std::string peer_settings;
+  if (!base64url_decode(http2_settings, peer_settings) || peer_settings.size() % 6 != 0) {
+	return false;
+  }
+  // The 101 goes out ahead of the server preface; it also acknowledges HTTP2-Settings
+  control.insert(0, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+  if (!apply_settings(reinterpret_cast<const uint8_t*>(peer_settings.data()), peer_settings.size())) {
+	return true;
+  }
+  last_stream_id = 1;
+  start_stream(1, request, 0, 16);
+  return true;
+}
+
+void Http2Session::receive(const char* data, size_t size)
+{
+  if (goaway_sent) {
+	return;
+  }
+  input.append(data, size);
+  size_t pos = 0;
+  if (!preface_received) {
+	size_t compared = std::min(input.size(), preface_length);
+	if (std::memcmp(input.data(), preface, compared) != 0) {
+	  connection_error(PROTOCOL_ERROR);
+	  return;
+	}
+	if (compared < preface_length) {
+	  return;
+	}
+	preface_received = true;
+	pos = preface_length;
+  }
+  while (!goaway_sent && input.size() - pos >= 9) {
+	const uint8_t* head = reinterpret_cast<const uint8_t*>(input.data()) + pos;
+	size_t length = size_t(head[0]) << 16 | size_t(head[1]) << 8 | head[2];
+	if (length > local.max_frame_size) {
+	  connection_error(FRAME_SIZE_ERROR);
+	  break;
+	}
+	if (input.size() - pos - 9 < length) {
+	  break;
+	}
+	if (!handle_frame(head[3], head[4], read32(head + 5) & 0x7fffffff, head + 9, length)) {
+	  break;
+	}
+	pos += 9 + length;
+	// PING, SETTINGS and requests all make us queue frames; a client that sends them
+	// faster than it reads the answers is cut off
+	if (control.size() - control_sent > max_queued_control) {
+	  connection_error(ENHANCE_YOUR_CALM);
+	  break;
+	}
+  }
+  input.erase(0, pos);
+}
+
+bool Http2Session::take_reset()
+{
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - reset_stamp).count();
+  reset_tokens = std::min(reset_burst, reset_tokens + elapsed * resets_per_second);
+  reset_stamp = now;
+  if (reset_tokens < 1) {
+	return false;
+  }
+  reset_tokens -= 1;
+  return true;
+}
+
+bool Http2Session::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length)
+{
+  // Nothing may interrupt a header block
+  if (header_stream != 0 && (type != CONTINUATION || stream_id != header_stream)) {
+	return connection_error(PROTOCOL_ERROR);
+  }
+  switch (type) {
+  case DATA:
+	if (stream_id == 0 || stream_id > last_stream_id) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	if ((flags & PADDED) && (length == 0 || payload[0] >= length)) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	// Request bodies are discarded; hand the flow-control credit straight back
+	if (length != 0) {
+	  queue_window_update(0, uint32_t(length));
+	  if (streams.count(stream_id) != 0) {
+		queue_window_update(stream_id, uint32_t(length));
+	  }
+	}
+	return true;
+  case HEADERS:
+	return handle_headers(flags, stream_id, payload, length);
+  case PRIORITY: {
+	if (stream_id == 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	if (length != 5) {
+	  queue_rst_stream(stream_id, FRAME_SIZE_ERROR);
+	  close_stream(stream_id);
+	  return true;
+	}
+	uint32_t dependency = read32(payload) & 0x7fffffff;
+	if (dependency == stream_id) {
+	  queue_rst_stream(stream_id, PROTOCOL_ERROR);
+	  close_stream(stream_id);
+	  return true;
+	}
+	auto it = streams.find(stream_id);
+	if (it != streams.end()) {
+	  it->second.dependency = dependency;
+	  it->second.weight = payload[4] + 1u;
+	}
+	return true;
+  }
+  case RST_STREAM:
+	if (stream_id == 0 || stream_id > last_stream_id) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	if (length != 4) {
+	  return connection_error(FRAME_SIZE_ERROR);
+	}
+	// Opening streams only to reset them costs us far more than it costs the client
+	if (!take_reset()) {
+	  return connection_error(ENHANCE_YOUR_CALM);
+	}
+	close_stream(stream_id);
+	return true;
+  case SETTINGS:
+	if (stream_id != 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	if (flags & ACK) {
+	  return length == 0 || connection_error(FRAME_SIZE_ERROR);
+	}
+	if (length % 6 != 0) {
+	  return connection_error(FRAME_SIZE_ERROR);
+	}
+	if (!apply_settings(payload, length)) {
+	  return false;
+	}
+	queue_frame(SETTINGS, ACK, 0, nullptr, 0);
+	return true;
+  case PUSH_PROMISE:
+	return connection_error(PROTOCOL_ERROR);
+  case PING:
+	if (stream_id != 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	if (length != 8) {
+	  return connection_error(FRAME_SIZE_ERROR);
+	}
+	if (!(flags & ACK)) {
+	  queue_frame(PING, ACK, 0, reinterpret_cast<const char*>(payload), length);
+	}
+	return true;
+  case GOAWAY:
+	if (stream_id != 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	goaway_received = true;
+	return true;
+  case WINDOW_UPDATE: {
+	if (length != 4) {
+	  return connection_error(FRAME_SIZE_ERROR);
+	}
+	uint32_t increment = read32(payload) & 0x7fffffff;
+	if (stream_id == 0) {
+	  if (increment == 0) {
+		return connection_error(PROTOCOL_ERROR);
+	  }
+	  connection_window += increment;
+	  return connection_window <= max_window || connection_error(FLOW_CONTROL_ERROR);
+	}
+	auto it = streams.find(stream_id);
+	if (it == streams.end()) {
+	  return true;
+	}
+	it->second.window += increment;
+	if (increment == 0 || it->second.window > max_window) {
+	  queue_rst_stream(stream_id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+	  close_stream(stream_id);
+	}
+	return true;
+  }
+  case CONTINUATION:
+	if (header_stream == 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	header_block.append(reinterpret_cast<const char*>(payload), length);
+	if (header_block.size() > max_header_block) {
+	  return connection_error(ENHANCE_YOUR_CALM);
+	}
+	return !(flags & END_HEADERS) || finish_header_block();
+  default:
+	// Unknown frame types must be ignored
+	return true;
+  }
+}
+
+bool Http2Session::handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length)
+{
+  if (stream_id == 0 || (stream_id & 1) == 0) {
+	return connection_error(PROTOCOL_ERROR);
+  }
+  size_t padding = 0;
+  if (flags & PADDED) {
+	if (length == 0) {
+	  return connection_error(PROTOCOL_ERROR);
+	}
+	padding = payload[0];
+	payload++;
+	length--;
+  }
+  header_dependency = 0;
+  header_weight = 16;
+  if (flags & PRIORITY_INFO) {
+	if (length < 5) {
+	  return connection_error(FRAME_SIZE_ERROR);
+	}
+	header_dependency = read32(payload) & 0x7fffffff;
+	header_weight = payload[4] + 1u;
+	payload += 5;
+	length -= 5;
+  }
+  if (padding > length || header_dependency == stream_id) {
+	return connection_error(PROTOCOL_ERROR);
+  }
+  // A block on a stream we already know is a trailer section: decoded for the
+  // table state, otherwise ignored
+  header_trailers = stream_id <= last_stream_id;
+  if (!header_trailers) {
+	last_stream_id = stream_id;
+  }
+  header_stream = stream_id;
+  header_block.assign(reinterpret_cast<const char*>(payload), length - padding);
+  return !(flags & END_HEADERS) || finish_header_block();
+}
+
+bool Http2Session::finish_header_block()
+{
+  uint32_t stream_id = header_stream;
+  header_stream = 0;
+  HpackDecoder::header_list headers;
+  bool decoded = decoder.decode(reinterpret_cast<const uint8_t*>(header_block.data()), header_block.size(), headers);
+  header_block.clear();
+  if (!decoded) {
+	return connection_error(COMPRESSION_ERROR);
+  }
+  if (header_trailers || goaway_received || shutting_down) {
+	return true;
+  }
+
+  ResourceRequest request;
+  std::string scheme;
+  bool valid = true;
+  bool regular_seen = false;
+  for (const auto& header : headers) {
+	const std::string& name = header.first;
+	if (!name.empty() && name[0] == ':') {
+	  if (regular_seen) {
+		valid = false;
+	  } else if (name == ":method") {
+		request.method = header.second;
+	  } else if (name == ":path") {
+		request.target = header.second;
+	  } else if (name == ":scheme") {
+		scheme = header.second;
+	  } else if (name != ":authority") {
+		valid = false;
+	  }
+	  continue;
+	}
+	regular_seen = true;
+	if (name == "connection" || std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })) {
+	  valid = false;
+	}
+	if (name == "accept-encoding" && ResourceRequest::accepts_gzip(header.second)) {
+	  request.gzip = true;
+	} else if (name == "if-none-match") {
+	  request.if_none_match = header.second;
+	}
+  }
+  if (!valid || request.method.empty() || request.target.empty() || scheme.empty()) {
+	queue_rst_stream(stream_id, PROTOCOL_ERROR);
+	return true;
+  }
+  if (streams.size() >= local.max_concurrent_streams) {
+	queue_rst_stream(stream_id, REFUSED_STREAM);
+	return true;
+  }
+  start_stream(stream_id, request, header_dependency, header_weight);
+  return true;
+}
+
+void Http2Session::start_stream(uint32_t stream_id, const ResourceRequest& request, uint32_t dependency, unsigned weight)
+{
+  Resource resource = resolve(request);
+  bool has_body = resource.status == 200 && resource.size != 0;
+  std::string block;
+  HpackEncoder::encode_status(block, resource.status);
+  if (resource.status == 200 && !resource.content_type.empty()) {
+	HpackEncoder::encode_field(block, HpackEncoder::content_type, resource.content_type);
+  }
+  if (resource.status == 200 && !resource.content_encoding.empty()) {
+	HpackEncoder::encode_field(block, HpackEncoder::content_encoding, resource.content_encoding);
+  }
+  if (resource.status == 200 || resource.status == 304) {
+	if (!resource.etag.empty()) {
+	  HpackEncoder::encode_field(block, HpackEncoder::etag, resource.etag);
+	}
+	if (resource.varies) {
+	  HpackEncoder::encode_field(block, HpackEncoder::vary, "accept-encoding");
+	}
+  }
+  if (resource.status == 429) {
+	HpackEncoder::encode_field(block, HpackEncoder::retry_after, std::to_string(resource.retry_after));
+  }
+  // A 304 has no Content-Length: it would describe the body of a 200
+  if (resource.status != 304) {
+	HpackEncoder::encode_field(block, HpackEncoder::content_length, std::to_string(has_body ? resource.size : 0));
+  }
+  queue_frame(HEADERS, END_HEADERS | (has_body ? 0 : END_STREAM), stream_id, block.data(), block.size());
+  if (!has_body) {
+	resource.release();
+	return;
+  }
+  stream& s = streams[stream_id];
+  s.body = resource;
+  s.unframed = resource.size;
+  s.window = peer_initial_window;
+  s.dependency = dependency;
+  s.weight = weight;
+  s.pass = virtual_time;
+}
+
+void Http2Session::close_stream(uint32_t stream_id)
+{
+  auto it = streams.find(stream_id);
+  if (it == streams.end()) {
+	return;
+  }
+  if (stream_id == current_stream) {
+	// The DATA frame in flight has to be completed; the stream goes after it
+	it->second.reset = true;
+	it->second.unframed = 0;
+	return;
+  }
+  it->second.body.release();
+  streams.erase(it);
+}
+
+bool Http2Session::blocked_by_dependency(const stream& s) const
+{
+  uint32_t dependency = s.dependency;
+  for (size_t hops = 0; dependency != 0 && hops != streams.size(); hops++) {
+	auto it = streams.find(dependency);
+	if (it == streams.end()) {
+	  return false;
+	}
+	const stream& parent = it->second;
+	if (parent.unframed != 0 && parent.window > 0) {
+	  return true;
+	}
+	dependency = parent.dependency;
+  }
+  return false;
+}
+
+bool Http2Session::start_data_frame(size_t budget)
+{
+  // After an upgrade, bodies wait for the client preface: clients only have so
+  // much room for what follows the 101
+  if (!preface_received || connection_window <= 0) {
+	return false;
+  }
+  stream* next = nullptr;
+  uint32_t next_id = 0;
+  for (auto& entry : streams) {
+	stream& s = entry.second;
+	if (s.unframed == 0 || s.window <= 0 || blocked_by_dependency(s)) {
+	  continue;
+	}
+	if (next == nullptr || s.pass < next->pass) {
+	  next = &s;
+	  next_id = entry.first;
+	}
+  }
+  if (next == nullptr) {
+	return false;
+  }
+  uint64_t size = std::min<uint64_t>({ next->unframed, uint64_t(next->window), uint64_t(connection_window),
+	peer_max_frame_size, std::max<uint64_t>(budget, 4096) });
+  next->unframed -= size;
+  next->window -= int64_t(size);
+  connection_window -= int64_t(size);
+  next->pass += size * 256 / next->weight;
+  virtual_time = next->pass;
+  write_frame_head(frame_head, size_t(size), DATA, next->unframed == 0 ? END_STREAM : 0, next_id);
+  frame_head_sent = 0;
+  payload_left = size;
+  current_stream = next_id;
+  return true;
+}
+
+void Http2Session::finish_data_frame()
+{
+  auto it = streams.find(current_stream);
+  current_stream = 0;
+  if (it != streams.end() && (it->second.unframed == 0 || it->second.reset)) {
+	it->second.body.release();
+	streams.erase(it);
+  }
+}
+
+uint64_t Http2Session::pending() const
+{
+  uint64_t total = control.size() - control_sent;
+  total += payload_left;
+  if (goaway_sent || !preface_received || connection_window <= 0) {
+	return total;
+  }
+  uint64_t data = 0;
+  for (const auto& entry : streams) {
+	const stream& s = entry.second;
+	if (s.unframed != 0 && s.window > 0) {
+	  data += std::min<uint64_t>(s.unframed, uint64_t(s.window));
+	}
+  }
+  return total + std::min<uint64_t>(data, uint64_t(connection_window));
+}
+
+uint64_t Http2Session::unsent() const
+{
+  uint64_t total = control.size() - control_sent + payload_left;
+  for (const auto& entry : streams) {
+	total += entry.second.unframed;
+  }
+  return total;
+}
+
+bool Http2Session::backed_up() const
+{
+  return control.size() - control_sent > max_queued_control;
+}
+
+long long Http2Session::write_some(transport& out, size_t limit)
+{
+  size_t written = 0;
+  while (written < limit) {
+	long long sent;
+	if (frame_head_sent < sizeof(frame_head)) {
+	  sent = out.write_bytes(frame_head + frame_head_sent, sizeof(frame_head) - frame_head_sent, true);
+	  if (sent > 0) {
+		frame_head_sent += size_t(sent);
+		continue;
+	  }
+	} else if (current_stream != 0) {
+	  stream& s = streams[current_stream];
+	  size_t count = size_t(std::min<uint64_t>(payload_left, limit - written));
+	  sent = s.body.data ? out.write_bytes(s.body.data.get() + s.offset, count, false) :
+		out.write_file(s.body.file, s.body.stream.get(), s.offset, count);
+	  if (sent > 0) {
+		s.offset += uint64_t(sent);
+		payload_left -= uint64_t(sent);
+		if (payload_left == 0) {
+		  finish_data_frame();
+		}
+	  }
+	} else if (control_sent < control.size()) {
+	  sent = out.write_bytes(control.data() + control_sent, std::min(control.size() - control_sent, limit - written), false);
+	  if (sent > 0) {
+		control_sent += size_t(sent);
+		if (control_sent == control.size()) {
+		  control.clear();
+		  control_sent = 0;
+		}
+	  }
+	} else if (goaway_sent || !start_data_frame(limit - written)) {
+	  break;
+	} else {
+	  continue;
+	}
+	if (sent < 0) {
+	  return -1;
+	}
+	if (sent == 0) {
+	  break;
+	}
+	written += size_t(sent);
+  }
+  return (long long)written;
+}
+
+bool Http2Session::closed() const
+{
+  bool flushed = control.empty() && current_stream == 0;
+  if (goaway_sent) {
+	return flushed;
+  }
+  return (goaway_received || shutting_down) && flushed && streams.empty();
+}
+
+void Http2Session::shutdown()
+{
+  if (goaway_sent || shutting_down) {
+	return;
+  }
+  char payload[8];
+  write32(payload, last_stream_id);
+  write32(payload + 4, NO_ERROR);
+  queue_frame(GOAWAY, 0, 0, payload, sizeof(payload));
+  shutting_down = true;
+}
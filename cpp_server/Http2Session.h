@@ -0,0 +1,137 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include "Hpack.h"
+#include "Resource.h"
+
+// Server side of one HTTP/2 connection (RFC 9113): frame parsing, HPACK, stream
+// state, flow control and the order in which response bodies are framed.
+//
+// Bodies are never copied through the session: each DATA frame header is written
+// on its own and the payload follows straight from the file through the transport,
+// so plain and kernel TLS connections keep using sendfile.
+//
+// Streams are served by weight (stride scheduling); a stream waits while a stream
+// it depends on still has data it could send. Exclusive dependencies are treated
+// as plain ones.
+//
+// A client cannot make the session queue without bound: past max_queued_control
+// bytes of frames other than DATA waiting to be written, or past the rate of stream
+// resets allowed, it gets GOAWAY(ENHANCE_YOUR_CALM), and the connection is not read
+// while those frames are backed up.
+class Http2Session {
+public:
+  struct settings {
+	uint32_t max_concurrent_streams = 100;
+	uint32_t initial_window_size = 65535;
+	uint32_t max_frame_size = 16384;
+	uint32_t header_table_size = 4096;
+  };
+  // Where the session writes; both return bytes written, 0 if the socket would block, -1 on error
+  class transport {
+  public:
+	virtual ~transport() {}
+	virtual long long write_bytes(const char* data, size_t size, bool more) = 0;
+	// stream, when set, reads or makes the body
+	virtual long long write_file(int fd, BodyStream* stream, uint64_t offset, size_t count) = 0;
+  };
+  typedef std::function<Resource(const ResourceRequest& request)> resolver;
+  static const char preface[];
+  static constexpr size_t preface_length = 24;
+  static constexpr size_t max_queued_control = 256 << 10;
+private:
+  struct stream {
+	Resource body;
+	uint64_t offset = 0;
+	// body bytes not yet put in a DATA frame
+	uint64_t unframed = 0;
+	int64_t window = 0;
+	uint32_t dependency = 0;
+	unsigned weight = 16;
+	uint64_t pass = 0;
+	bool reset = false;
+  };
+  resolver resolve;
+  settings local;
+  HpackDecoder decoder;
+  std::map<uint32_t, stream> streams;
+  std::string input;
+  bool preface_received = false;
+  // Serialized frames other than DATA, written in order
+  std::string control;
+  size_t control_sent = 0;
+  // DATA frame being written
+  uint32_t current_stream = 0;
+  char frame_head[9];
+  size_t frame_head_sent = sizeof(frame_head);
+  uint64_t payload_left = 0;
+  int64_t connection_window = 65535;
+  uint32_t peer_initial_window = 65535;
+  uint32_t peer_max_frame_size = 16384;
+  uint32_t last_stream_id = 0;
+  // Header block spread over HEADERS and CONTINUATION frames
+  uint32_t header_stream = 0;
+  bool header_trailers = false;
+  uint32_t header_dependency = 0;
+  unsigned header_weight = 16;
+  std::string header_block;
+  uint64_t virtual_time = 0;
+  bool goaway_sent = false;
+  bool goaway_received = false;
+  bool shutting_down = false;
+  // Stream resets the client may still send, refilled over time
+  double reset_tokens;
+  std::chrono::steady_clock::time_point reset_stamp;
+
+  void queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t length);
+  void queue_settings();
+  void queue_rst_stream(uint32_t stream_id, uint32_t code);
+  void queue_window_update(uint32_t stream_id, uint32_t increment);
+  // Queues GOAWAY; always returns false so frame handlers can return it
+  bool connection_error(uint32_t code);
+  // Takes one reset from the budget; false once the client resets too fast
+  bool take_reset();
+  bool apply_settings(const uint8_t* payload, size_t length);
+  bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+  bool handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+  bool finish_header_block();
+  void start_stream(uint32_t stream_id, const ResourceRequest& request, uint32_t dependency, unsigned weight);
+  void close_stream(uint32_t stream_id);
+  bool blocked_by_dependency(const stream& s) const;
+  bool start_data_frame(size_t budget);
+  void finish_data_frame();
+public:
+  Http2Session(resolver resolve, const settings& local);
+  Http2Session(const Http2Session&) = delete;
+  Http2Session& operator=(const Http2Session&) = delete;
+  ~Http2Session();
+  // h2c upgrade: answers 101, takes the peer's HTTP2-Settings and serves the
+  // upgraded request as stream 1. The client preface is still expected.
+  bool upgrade(const ResourceRequest& request, const std::string& http2_settings);
+  // Feeds bytes read from the connection
+  void receive(const char* data, size_t size);
+  // Bytes that can be written right now. DATA frame headers are not counted, here
+  // or in what write_some returns, so the figure is exact however bodies get framed.
+  uint64_t pending() const;
+  // Bytes of frames and bodies not written yet, including what the flow-control
+  // windows hold back; DATA frame headers are not counted
+  uint64_t unsent() const;
+  // Frames other than DATA are backed up past max_queued_control; the connection
+  // should not be read until they are written
+  bool backed_up() const;
+  long long write_some(transport& out, size_t limit);
+  // Graceful close: announces GOAWAY, finishes the streams already started and
+  // ignores new ones
+  void shutdown();
+  // The connection is finished once GOAWAY went out for an error, or was exchanged
+  // gracefully and every stream completed
+  bool closed() const;
+};
+
+#endif // HTTP2_SESSION_H
@@ -0,0 +1,217 @@
+#include "HugePageHeap.h"
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+static const size_t SMALL_PAGE_SIZE = 4 << 10;
+
+// The class of a block of bytes, setting size to the size of its blocks
+static size_t size_class(size_t bytes, size_t& size)
+{
+  if (bytes <= 128) {
+	size = bytes <= 16 ? 16 : (bytes + 15) & ~size_t(15);
+	return size / 16 - 1;
+  }
+  unsigned bits = 0;
+  for (size_t n = bytes - 1; n != 0; n >>= 1) {
+	bits++;
+  }
+  size_t step = size_t(1) << (bits - 4);
+  size = (bytes + step - 1) & ~(step - 1);
+  return 8 + (bits - 8) * 8 + (((size - 1) >> (bits - 4)) & 7);
+}
+
+std::atomic<HugePageHeap::mode> HugePageHeap::pages(HugePageHeap::transparent);
+
+// Pages of the mapping are taken from node while it has any; they are placed when
+// first touched
+static void prefer_node(void* p, size_t size, int node)
+{
+#ifdef __linux__
+  if (node >= 0 && node < 64) {
+	unsigned long nodes = 1ul << node;
+	// MPOL_PREFERRED; the kernel reads one bit less of the mask than it is told
+	syscall(SYS_mbind, p, size, 1, &nodes, sizeof(nodes) * 8 + 1, 0);
+  }
+#else
+  (void)p;
+  (void)size;
+  (void)node;
+#endif
+}
+
+static char* map_pages(size_t size, int node)
+{
+#ifdef _WIN32
+  return (char*)(node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT,
+	PAGE_READWRITE, DWORD(node)) : VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+	return nullptr;
+  }
+  prefer_node(p, size, node);
+  return (char*)p;
+#endif
+}
+
+static void unmap_pages(void* p, size_t size)
+{
+#ifdef _WIN32
+  (void)size;
+  VirtualFree(p, 0, MEM_RELEASE);
+#else
+  munmap(p, size);
+#endif
+}
+
+HugePageHeap& HugePageHeap::shared(int node)
+{
+  static std::mutex lock;
+  static std::unordered_map<int, HugePageHeap*>* heaps = new std::unordered_map<int, HugePageHeap*>();
+  std::lock_guard<std::mutex> guard(lock);
+  HugePageHeap*& heap = (*heaps)[node];
+  if (!heap) {
+	heap = new HugePageHeap(node);
+  }
+  return *heap;
+}
+
+void HugePageHeap::configure(mode pages)
+{
+  HugePageHeap::pages = pages;
+}
+
+char* HugePageHeap::map_region(size_t size, bool& huge)
+{
+  huge = false;
+#ifdef _WIN32
+  if (pages == explicit_pages) {
+	SIZE_T large = GetLargePageMinimum();
+	// Needs the lock pages in memory privilege
+	DWORD flags = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+	void* p = large == 0 || size % large != 0 ? nullptr : node >= 0 ?
+	  VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, flags, PAGE_READWRITE, DWORD(node)) :
+	  VirtualAlloc(nullptr, size, flags, PAGE_READWRITE);
+	if (p) {
+	  huge = true;
+	  return (char*)p;
+	}
+	fallbacks++;
+  }
+  return map_pages(size, node);
+#else
+#ifdef MAP_HUGETLB
+  if (pages == explicit_pages) {
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+	  prefer_node(p, size, node);
+	  huge = true;
+	  return (char*)p;
+	}
+	// None reserved, or too few
+	fallbacks++;
+  }
+#endif
+  // Mapped with room to align, which transparent huge pages need; the rest goes back
+  char* start = map_pages(size + region_size, node);
+  if (!start) {
+	return nullptr;
+  }
+  char* aligned = (char*)((uintptr_t(start) + region_size - 1) & ~uintptr_t(region_size - 1));
+  if (aligned != start) {
+	munmap(start, size_t(aligned - start));
+  }
+  munmap(aligned + size, region_size - size_t(aligned - start));
+#ifdef MADV_HUGEPAGE
+  huge = pages != off && madvise(aligned, size, MADV_HUGEPAGE) == 0;
+#endif
+  return aligned;
+#endif
+}
+
+void* HugePageHeap::do_allocate(size_t bytes, size_t alignment)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (bytes > region_size / 4 || alignment > 16) {
+	size_t size = bytes >= region_size ? (bytes + region_size - 1) & ~(region_size - 1) :
+	  (bytes + SMALL_PAGE_SIZE - 1) & ~(SMALL_PAGE_SIZE - 1);
+	bool huge;
+	char* p = size >= region_size ? map_region(size, huge) : map_pages(size, node);
+	if (!p) {
+	  throw std::bad_alloc();
+	}
+	mapped += size;
+	requested += bytes;
+	allocated += size;
+	return p;
+  }
+  size_t size;
+  size_t index = size_class(bytes, size);
+  void* p = free_blocks[index];
+  if (p) {
+	free_blocks[index] = *(void**)p;
+  } else {
+	if (size_t(end - next) < size) {
+	  // What is left of the current region stays unused
+	  bool huge;
+	  next = map_region(region_size, huge);
+	  if (!next) {
+		end = nullptr;
+		throw std::bad_alloc();
+	  }
+	  end = next + region_size;
+	  regions++;
+	  mapped += region_size;
+	  if (huge) {
+		huge_mapped += region_size;
+	  }
+	}
+	p = next;
+	next += size;
+  }
+  requested += bytes;
+  allocated += size;
+  return p;
+}
+
+void HugePageHeap::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (bytes > region_size / 4 || alignment > 16) {
+	size_t size = bytes >= region_size ? (bytes + region_size - 1) & ~(region_size - 1) :
+	  (bytes + SMALL_PAGE_SIZE - 1) & ~(SMALL_PAGE_SIZE - 1);
+	unmap_pages(p, size);
+	mapped -= size;
+	requested -= bytes;
+	allocated -= size;
+	return;
+  }
+  size_t size;
+  size_t index = size_class(bytes, size);
+  *(void**)p = free_blocks[index];
+  free_blocks[index] = p;
+  requested -= bytes;
+  allocated -= size;
+}
+
+void HugePageHeap::report(std::ostream& out)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  out << "heap_regions " << regions << '\n'
+	<< "heap_mapped_bytes " << mapped << '\n'
+	<< "heap_huge_page_bytes " << huge_mapped << '\n'
+	<< "heap_huge_page_fallbacks " << fallbacks << '\n'
+	<< "heap_requested_bytes " << requested << '\n'
+	<< "heap_allocated_bytes " << allocated << '\n';
+}
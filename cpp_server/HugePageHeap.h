@@ -0,0 +1,65 @@
+#ifndef HUGE_PAGE_HEAP_H
+#define HUGE_PAGE_HEAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <ostream>
+
+// Memory for what the server keeps for long and in bulk, such as cached file
+// contents and receive buffers, packed into 2 MiB regions backed by huge pages.
+//
+// Sizes are rounded up to a size class, eight per power of two above 128 bytes, so
+// rounding wastes at most a ninth of a block above that. Blocks are cut from the
+// current region in turn, and freed blocks go on the free list of their class to
+// be reused before anything is cut; regions are never returned. Requests larger
+// than a quarter of a region are mapped on their own. Regions come from explicit
+// huge pages (MAP_HUGETLB) when asked for and reserved, from transparent huge
+// pages (MADV_HUGEPAGE) otherwise, and from normal pages where neither is
+// available. A heap for a NUMA node takes its pages from that node while it has
+// any. Thread-safe.
+class HugePageHeap : public std::pmr::memory_resource {
+public:
+  enum mode { off, transparent, explicit_pages };
+  static const size_t region_size = 2 << 20;
+private:
+  static const size_t class_count = 104;
+  static std::atomic<mode> pages;
+  std::mutex lock;
+  // -1 for any
+  int node;
+  char* next = nullptr;
+  char* end = nullptr;
+  void* free_blocks[class_count] = {};
+  size_t regions = 0;
+  // Regions and requests mapped on their own
+  size_t mapped = 0;
+  // Regions backed by huge pages, or advised to be
+  size_t huge_mapped = 0;
+  // Explicit huge pages asked for but not available
+  size_t fallbacks = 0;
+  // Bytes asked for and bytes handed out, rounding included, of the blocks in use
+  size_t requested = 0;
+  size_t allocated = 0;
+
+  // Maps size bytes, a multiple of region_size, aligned to region_size where that
+  // lets them be backed by huge pages; huge tells whether they are
+  char* map_region(size_t size, bool& huge);
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+public:
+  explicit HugePageHeap(int node = -1) : node(node) {}
+  HugePageHeap(const HugePageHeap&) = delete;
+  HugePageHeap& operator=(const HugePageHeap&) = delete;
+  // The heap of the process for memory on node (-1 for any); never destroyed, so
+  // its blocks may outlive anything
+  static HugePageHeap& shared(int node = -1);
+  // Applies to the regions every heap maps from now on
+  static void configure(mode pages);
+  // Counters as "name value" lines
+  void report(std::ostream& out);
+};
+
+#endif // HUGE_PAGE_HEAP_H
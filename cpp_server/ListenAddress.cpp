@@ -0,0 +1,158 @@
+#include "ListenAddress.h"
+#include <cstddef>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+static const char UNIX_PREFIX[] = "unix:";
+
+// A port number, all digits
+static bool parse_port(const std::string& text, uint16_t& port)
+{
+  if (text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos) {
+	return false;
+  }
+  unsigned long value = std::stoul(text);
+  if (value > 65535) {
+	return false;
+  }
+  port = uint16_t(value);
+  return true;
+}
+
+bool ListenAddress::is_unix() const
+{
+#ifdef _WIN32
+  return false;
+#else
+  return family() == AF_UNIX;
+#endif
+}
+
+std::string ListenAddress::path() const
+{
+#ifndef _WIN32
+  if (is_unix()) {
+	const sockaddr_un* un = reinterpret_cast<const sockaddr_un*>(&address);
+	return std::string(un->sun_path, strnlen(un->sun_path, sizeof(un->sun_path)));
+  }
+#endif
+  return std::string();
+}
+
+std::string ListenAddress::to_string() const
+{
+  if (is_unix()) {
+	return UNIX_PREFIX + path();
+  }
+  char host[INET6_ADDRSTRLEN] = "";
+  if (family() == AF_INET) {
+	const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(&address);
+	inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+	return std::string(host) + ':' + std::to_string(ntohs(in->sin_port));
+  }
+  if (family() == AF_INET6) {
+	const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(&address);
+	inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+	return '[' + std::string(host) + "]:" + std::to_string(ntohs(in6->sin6_port));
+  }
+  return "?";
+}
+
+bool ListenAddress::operator==(const ListenAddress& other) const
+{
+  return length == other.length && memcmp(&address, &other.address, length) == 0;
+}
+
+bool ListenAddress::parse(const std::string& spec, ListenAddress& result, std::string& error)
+{
+  result = ListenAddress();
+  if (spec.compare(0, sizeof(UNIX_PREFIX) - 1, UNIX_PREFIX) == 0) {
+#ifdef _WIN32
+	error = "Unix sockets are not supported: " + spec;
+	return false;
+#else
+	std::string path = spec.substr(sizeof(UNIX_PREFIX) - 1);
+	sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&result.address);
+	if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+	  error = "Unix socket path is empty or too long: " + spec;
+	  return false;
+	}
+	un->sun_family = AF_UNIX;
+	memcpy(un->sun_path, path.data(), path.size());
+	result.length = socklen_t(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+	return true;
+#endif
+  }
+
+  // The port follows the last colon, outside the brackets of an IPv6 host
+  std::string host;
+  std::string port_text = spec;
+  bool bracketed = !spec.empty() && spec[0] == '[';
+  size_t colon = spec.rfind(':');
+  if (bracketed) {
+	size_t close = spec.find(']');
+	if (close == std::string::npos || close + 1 != colon) {
+	  error = "Expected [host]:port: " + spec;
+	  return false;
+	}
+	host = spec.substr(1, close - 1);
+	port_text = spec.substr(colon + 1);
+  } else if (colon != std::string::npos) {
+	host = spec.substr(0, colon);
+	port_text = spec.substr(colon + 1);
+  }
+  uint16_t port;
+  if (!parse_port(port_text, port)) {
+	error = "Invalid port in listen address: " + spec;
+	return false;
+  }
+  if (!bracketed && (host.empty() || host == "*")) {
+	result = any(port);
+	return true;
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = bracketed ? AF_INET6 : AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* found = nullptr;
+  int status = getaddrinfo(host.c_str(), nullptr, &hints, &found);
+  if (status != 0 || found == nullptr) {
+	error = "Cannot resolve listen address " + spec + ": " + gai_strerror(status);
+	return false;
+  }
+  memcpy(&result.address, found->ai_addr, found->ai_addrlen);
+  result.length = socklen_t(found->ai_addrlen);
+  freeaddrinfo(found);
+  if (result.family() == AF_INET6) {
+	reinterpret_cast<sockaddr_in6*>(&result.address)->sin6_port = htons(port);
+  } else {
+	reinterpret_cast<sockaddr_in*>(&result.address)->sin_port = htons(port);
+  }
+  return true;
+}
+
+ListenAddress ListenAddress::any(int port)
+{
+  ListenAddress result;
+  sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&result.address);
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = INADDR_ANY;
+  in->sin_port = htons(uint16_t(port));
+  result.length = sizeof(sockaddr_in);
+  return result;
+}
+
+bool ListenAddress::of(SOCKET sock, ListenAddress& result)
+{
+  result = ListenAddress();
+  socklen_t length = sizeof(result.address);
+  if (getsockname(sock, reinterpret_cast<sockaddr*>(&result.address), &length) != 0) {
+	return false;
+  }
+  result.length = length;
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef LISTEN_ADDRESS_H
+#define LISTEN_ADDRESS_H
+
+#include <string>
+#include "ServerPolicies.h"
+
+// An address the server listens on: TCP over IPv4 or IPv6, or a Unix domain stream
+// socket (POSIX only), which spares clients on this host, a reverse proxy say, the
+// TCP loopback path.
+//
+// Written as "port" or "host:port" ("*" or no host for any IPv4 address),
+// "[host]:port" for IPv6, or "unix:path". "[::]:port" is dual stack: it takes
+// IPv4 connections as well, with v4-mapped addresses.
+struct ListenAddress {
+  sockaddr_storage address = {};
+  socklen_t length = 0;
+
+  int family() const { return address.ss_family; }
+  bool is_unix() const;
+  // The path of a Unix socket, empty otherwise
+  std::string path() const;
+  // In the form it is written
+  std::string to_string() const;
+  bool operator==(const ListenAddress& other) const;
+
+  // False, with error telling why, if spec is not an address
+  static bool parse(const std::string& spec, ListenAddress& result, std::string& error);
+  // Any IPv4 address
+  static ListenAddress any(int port);
+  // The address sock is bound to; false if it cannot be told
+  static bool of(SOCKET sock, ListenAddress& result);
+};
+
+#endif // LISTEN_ADDRESS_H
@@ -0,0 +1,259 @@
+#include "ListenerHandoff.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+const char ListenerHandoff::channel_variable[] = "CPP_SERVER_HANDOFF_FD";
+
+// More than any sane configuration listens on
+const size_t MAX_LISTENERS = 64;
+
+#ifndef _WIN32
+
+static void set_close_on_exec(int fd) {
+  int flags = fcntl(fd, F_GETFD);
+  if (flags != -1) {
+	fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+  }
+}
+
+ListenerHandoff::~ListenerHandoff()
+{
+  if (channel != -1) {
+	close(channel);
+  }
+}
+
+std::vector<int> ListenerHandoff::inherited_listeners()
+{
+  std::vector<int> listeners;
+  const char* pid = getenv("LISTEN_PID");
+  const char* count = getenv("LISTEN_FDS");
+  if (pid != nullptr && count != nullptr && strtol(pid, nullptr, 10) == long(getpid())) {
+	long n = strtol(count, nullptr, 10);
+	for (long i = 0; i < n && size_t(i) < MAX_LISTENERS; i++) {
+	  // SD_LISTEN_FDS_START
+	  int fd = 3 + int(i);
+	  if (fcntl(fd, F_GETFD) == -1) {
+		continue;
+	  }
+	  set_close_on_exec(fd);
+	  listeners.push_back(fd);
+	}
+  }
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  return listeners;
+}
+
+bool ListenerHandoff::receive(std::vector<int>& listeners)
+{
+  const char* value = getenv(channel_variable);
+  if (value == nullptr) {
+	return false;
+  }
+  channel = int(strtol(value, nullptr, 10));
+  unsetenv(channel_variable);
+  set_close_on_exec(channel);
+
+  char byte;
+  iovec data = { &byte, 1 };
+  union {
+	cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+  } control;
+  msghdr message = {};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buf;
+  message.msg_controllen = sizeof(control.buf);
+  ssize_t got;
+  do {
+	got = recvmsg(channel, &message, 0);
+  } while (got == -1 && errno == EINTR);
+  if (got != 1) {
+	close(channel);
+	channel = -1;
+	return false;
+  }
+  for (cmsghdr* c = CMSG_FIRSTHDR(&message); c != nullptr; c = CMSG_NXTHDR(&message, c)) {
+	if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+	  continue;
+	}
+	size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	for (size_t i = 0; i != count; i++) {
+	  int fd;
+	  memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+	  set_close_on_exec(fd);
+	  listeners.push_back(fd);
+	}
+  }
+  return !listeners.empty();
+}
+
+void ListenerHandoff::acknowledge()
+{
+  if (channel == -1) {
+	return;
+  }
+  char byte = 'R';
+  if (write(channel, &byte, 1) != 1) {
+	// The old process is gone already; nothing is waiting for us
+  }
+  close(channel);
+  channel = -1;
+}
+
+bool ListenerHandoff::start_successor(const std::vector<std::string>& command, const std::vector<int>& listeners)
+{
+  if (current == state::waiting || command.empty() || listeners.empty() || listeners.size() > MAX_LISTENERS) {
+	return false;
+  }
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+	return false;
+  }
+  set_close_on_exec(pair[0]);
+
+  // Everything the child needs is prepared before fork: another thread may hold
+  // the allocator or environment lock at that moment, and the child would wait
+  // for it forever
+  std::vector<char*> argv;
+  for (const std::string& arg : command) {
+	argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  std::string channel_entry = std::string(channel_variable) + "=" + std::to_string(pair[1]);
+  std::vector<char*> envp;
+  size_t name_length = strlen(channel_variable);
+  for (char** entry = environ; *entry != nullptr; entry++) {
+	if (strncmp(*entry, channel_variable, name_length) != 0 || (*entry)[name_length] != '=') {
+	  envp.push_back(*entry);
+	}
+  }
+  envp.push_back(&channel_entry[0]);
+  envp.push_back(nullptr);
+  // Where argv[0] may be, in the order execvp would try
+  std::vector<std::string> paths;
+  if (command[0].find('/') != std::string::npos) {
+	paths.push_back(command[0]);
+  } else {
+	const char* search = getenv("PATH");
+	std::string directories = search != nullptr ? search : "/bin:/usr/bin";
+	for (size_t start = 0; start <= directories.size();) {
+	  size_t end = std::min(directories.find(':', start), directories.size());
+	  std::string directory = end == start ? "." : directories.substr(start, end - start);
+	  paths.push_back(directory + "/" + command[0]);
+	  start = end + 1;
+	}
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+	close(pair[0]);
+	close(pair[1]);
+	return false;
+  }
+  if (pid == 0) {
+	for (const std::string& path : paths) {
+	  execve(path.c_str(), argv.data(), envp.data());
+	}
+	_exit(127);
+  }
+  close(pair[1]);
+
+  // The message waits in the socket buffer until the successor gets to it
+  char byte = 'L';
+  iovec data = { &byte, 1 };
+  union {
+	cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+  } control;
+  msghdr message = {};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buf;
+  message.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+  cmsghdr* c = CMSG_FIRSTHDR(&message);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+  memcpy(CMSG_DATA(c), listeners.data(), sizeof(int) * listeners.size());
+  if (sendmsg(pair[0], &message, 0) != 1) {
+	// Without its sockets the successor gives up and exits
+	close(pair[0]);
+	waitpid(pid, nullptr, 0);
+	return false;
+  }
+  fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+  channel = pair[0];
+  successor = int(pid);
+  current = state::waiting;
+  return true;
+}
+
+ListenerHandoff::state ListenerHandoff::check()
+{
+  if (current != state::waiting) {
+	return current;
+  }
+  char byte;
+  ssize_t got = read(channel, &byte, 1);
+  if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+	return current;
+  }
+  close(channel);
+  channel = -1;
+  if (got == 1) {
+	current = state::ready;
+  } else {
+	// The successor closed its end without acknowledging, so it is exiting
+	waitpid(successor, nullptr, 0);
+	current = state::failed;
+  }
+  return current;
+}
+
+#else
+
+ListenerHandoff::~ListenerHandoff()
+{
+}
+
+std::vector<int> ListenerHandoff::inherited_listeners()
+{
+  return std::vector<int>();
+}
+
+bool ListenerHandoff::receive(std::vector<int>&)
+{
+  return false;
+}
+
+void ListenerHandoff::acknowledge()
+{
+}
+
+bool ListenerHandoff::start_successor(const std::vector<std::string>&, const std::vector<int>&)
+{
+  return false;
+}
+
+ListenerHandoff::state ListenerHandoff::check()
+{
+  return current;
+}
+
+#endif // _WIN32
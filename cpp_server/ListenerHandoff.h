@@ -0,0 +1,57 @@
+#ifndef LISTENER_HANDOFF_H
+#define LISTENER_HANDOFF_H
+
+#include <string>
+#include <vector>
+
+// Passing listening sockets between processes, so a new build can take over
+// without refusing a single connection (POSIX only; elsewhere nothing is ever
+// inherited and starting a successor fails).
+//
+// Hot upgrade: the running process starts a new copy of the program with one end
+// of a Unix socket pair and sends its listening sockets over it (SCM_RIGHTS). The
+// successor adopts them and acknowledges once it accepts connections; only then
+// does the old process stop accepting and drain. If the successor dies first, the
+// old process simply keeps serving.
+//
+// Socket activation: listening sockets passed by a service manager the systemd
+// way (LISTEN_PID/LISTEN_FDS, starting at descriptor 3) are adopted as well.
+class ListenerHandoff {
+public:
+  enum class state { idle, waiting, ready, failed };
+private:
+  // Our end of the socket pair with the other process
+  int channel = -1;
+  int successor = -1;
+  state current = state::idle;
+public:
+  // Names the descriptor of the successor's end in its environment
+  static const char channel_variable[];
+
+  ListenerHandoff() {}
+  ListenerHandoff(const ListenerHandoff&) = delete;
+  ListenerHandoff& operator=(const ListenerHandoff&) = delete;
+  ~ListenerHandoff();
+
+  // Listening sockets from a service manager; the variables are cleared so they
+  // do not leak into processes we start
+  static std::vector<int> inherited_listeners();
+
+  // Successor side: the sockets sent by the process that started us, or false if
+  // we were not started for an upgrade
+  bool receive(std::vector<int>& listeners);
+  // Successor side: tells the old process we are accepting connections
+  void acknowledge();
+
+  // Old process side: starts command (argv[0] is looked up in PATH) and sends it
+  // the listening sockets. Progress is then picked up with check().
+  bool start_successor(const std::vector<std::string>& command, const std::vector<int>& listeners);
+  // Descriptor to poll for readability while waiting, -1 otherwise
+  int wait_handle() const { return current == state::waiting ? channel : -1; }
+  // Reads the successor's answer once wait_handle() is readable
+  state check();
+  state status() const { return current; }
+  int successor_pid() const { return successor; }
+};
+
+#endif // LISTENER_HANDOFF_H
@@ -0,0 +1,58 @@
+#include "MappedFile.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const char> map_file(const std::string& path, uint64_t& size, std::string& error)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+	error = "cannot open " + path;
+	return nullptr;
+  }
+  LARGE_INTEGER file_size;
+  size = GetFileSizeEx(file, &file_size) ? uint64_t(file_size.QuadPart) : 0;
+  HANDLE view = size != 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+  const char* base = view ? static_cast<const char*>(MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+  if (view) {
+	CloseHandle(view);
+  }
+  CloseHandle(file);
+  if (!base) {
+	error = size != 0 ? "cannot map " + path : path + " is empty";
+	return nullptr;
+  }
+  return std::shared_ptr<const char>(base, [](const char* p) { UnmapViewOfFile(p); });
+#else
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+	error = "cannot open " + path + ": " + strerror(errno);
+	if (fd != -1) {
+	  close(fd);
+	}
+	return nullptr;
+  }
+  size = uint64_t(st.st_size);
+  void* base = size != 0 ? mmap(nullptr, size_t(size), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  int mmap_errno = errno;
+  close(fd);
+  if (base == MAP_FAILED) {
+	error = size != 0 ? "cannot map " + path + ": " + strerror(mmap_errno) : path + " is empty";
+	return nullptr;
+  }
+  size_t length = size_t(size);
+  return std::shared_ptr<const char>(static_cast<const char*>(base), [length](const char* p) {
+	munmap(const_cast<char*>(p), length);
+  });
+#endif
+}
@@ -0,0 +1,13 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Maps the whole file at path read-only and sets size. The mapping lasts as long
+// as the returned pointer or any pointer sharing its ownership, such as a body
+// aliasing into it. Returns null with a message on failure.
+std::shared_ptr<const char> map_file(const std::string& path, uint64_t& size, std::string& error);
+
+#endif // MAPPED_FILE_H
@@ -2,45 +2,65 @@
 
 using namespace std;
 
-string extractExtension(const string& path) {
+static string_view extensionOf(string_view path) {
 	size_t lastDot = path.find_last_of('.');
-	if (lastDot == string::npos) {
-		return "";
+	if (lastDot == string_view::npos) {
+		return string_view();
 	}
 	size_t lastSeparatorIndex = path.find_last_of('/');
-	if (lastDot <= lastSeparatorIndex && lastSeparatorIndex != string::npos) {
-		return "";
+	if (lastDot <= lastSeparatorIndex && lastSeparatorIndex != string_view::npos) {
+		return string_view();
 	}
 	if (lastDot + 1 == path.length()) {
-		return "";
+		return string_view();
 	}
 	size_t nameStart = path.find_first_not_of('.', lastSeparatorIndex + 1);
 	if (lastDot != 0 && nameStart == lastDot + 1) {
-		return "";
+		return string_view();
 	}
 	return path.substr(lastDot + 1);
 }
 
+string extractExtension(const string& path) {
+	return string(extensionOf(path));
+}
+
 MimeMapper::MimeMapper(
 	unordered_map<string, string>&& extensionToMimeMap,
 	unordered_map<string, string>&& mimeToExtensionMap
-) : extensionToMimeMap(extensionToMimeMap), mimeToExtensionMap(mimeToExtensionMap) {}
+) : extensionToMimeMap(extensionToMimeMap), mimeToExtensionMap(mimeToExtensionMap) {
+	indexExtensions();
+}
 
 MimeMapper::MimeMapper(
 	const unordered_map<string, string>& extensionToMimeMap,
 	const unordered_map<string, string>& mimeToExtensionMap
-) : extensionToMimeMap(extensionToMimeMap), mimeToExtensionMap(mimeToExtensionMap) {}
+) : extensionToMimeMap(extensionToMimeMap), mimeToExtensionMap(mimeToExtensionMap) {
+	indexExtensions();
+}
 
 MimeMapper::MimeMapper() {
 }
 
 MimeMapper::MimeMapper(const MimeMapper &src) : 
 	extensionToMimeMap(src.extensionToMimeMap), 
-	mimeToExtensionMap(src.mimeToExtensionMap) {}
+	mimeToExtensionMap(src.mimeToExtensionMap) {
+	indexExtensions();
+}
 
+// The nodes move with the map, so the views of the index stay valid
 MimeMapper::MimeMapper(MimeMapper &&src) noexcept :
 	extensionToMimeMap(move(src.extensionToMimeMap)), 
-	mimeToExtensionMap(move(src.mimeToExtensionMap)) {}
+	mimeToExtensionMap(move(src.mimeToExtensionMap)),
+	extensionIndex(move(src.extensionIndex)) {}
+
+void MimeMapper::indexExtensions() {
+	extensionIndex.clear();
+	extensionIndex.reserve(extensionToMimeMap.size());
+	for (const auto& mapping : extensionToMimeMap) {
+		extensionIndex.emplace(mapping.first, &mapping.second);
+	}
+}
 
 string MimeMapper::getMime(const string& path) const {
 	string ext = extractExtension(path);
@@ -56,6 +76,20 @@ string MimeMapper::getMime(const string& path) const {
 	}
 }
 
+string_view MimeMapper::findMime(string_view path) const {
+	string_view ext = extensionOf(path);
+	if (ext.empty()) {
+		return string_view();
+	}
+	auto it = extensionIndex.find(ext);
+	if (it != extensionIndex.end()) {
+		return *it->second;
+	}
+	else {
+		return string_view();
+	}
+}
+
 string MimeMapper::getExtension(const string& mime) const {
 	if (mime.empty()) {
 		return mime;
@@ -100,6 +134,40 @@ bool MimeMapper::addMappingExtensionToMime(const string& extension, const string
 			return false;
 		}
 	}
-	extensionToMimeMap[extension] = mime;
+	auto mapping = extensionToMimeMap.insert_or_assign(extension, mime).first;
+	extensionIndex[mapping->first] = &mapping->second;
 	return true;
 }
+
+ConcurrentMimeMapper::ConcurrentMimeMapper(MimeMapper* mapper) : snapshot(mapper) {}
+
+ConcurrentMimeMapper* ConcurrentMimeMapper::createDefault() {
+	return new ConcurrentMimeMapper(MimeMapper::createDefault());
+}
+
+string ConcurrentMimeMapper::getMime(const string& path) const {
+	return snapshot->MimeMapper::getMime(path);
+}
+
+string_view ConcurrentMimeMapper::findMime(string_view path) const {
+	return snapshot->MimeMapper::findMime(path);
+}
+
+string ConcurrentMimeMapper::getExtension(const string& mime) const {
+	return snapshot->MimeMapper::getExtension(mime);
+}
+
+bool ConcurrentMimeMapper::addMapping(const string& path, const string& mime, ForceUpdate forceUpdate) {
+	bool added = false;
+	update([&](IMimeMapper& mapper) {
+		added = mapper.addMapping(path, mime, forceUpdate);
+	});
+	return added;
+}
+
+void ConcurrentMimeMapper::update(const function<void(IMimeMapper&)>& edit) {
+	lock_guard<mutex> guard(writerLock);
+	MimeMapper* next = new MimeMapper(*snapshot);
+	edit(*next);
+	snapshot.publish(next);
+}
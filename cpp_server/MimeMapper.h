@@ -1,8 +1,12 @@
 #ifndef MIMEMAPPER_H
 #define MIMEMAPPER_H
 
+#include <functional>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include "Rcu.h"
 
 class ExtensionToMimeMapper {
 public:
@@ -35,6 +39,8 @@ class MimeMapper : public IMimeMapper {
 private:
 	std::unordered_map<std::string, std::string> extensionToMimeMap;
 	std::unordered_map<std::string, std::string> mimeToExtensionMap;
+	// extensionToMimeMap keyed by views of its own keys, for lookups without a string
+	std::unordered_map<std::string_view, const std::string*> extensionIndex;
 protected:
 	MimeMapper(std::unordered_map<std::string, std::string>&& extensionToMimeMap,
 		std::unordered_map<std::string, std::string>&& mimeToExtensionMap);
@@ -44,13 +50,39 @@ public:
 	MimeMapper();
 	MimeMapper(const MimeMapper &src);
 	MimeMapper(MimeMapper &&src) noexcept;
+	// The index would view the other mapper's keys
+	MimeMapper& operator=(const MimeMapper&) = delete;
 	static MimeMapper* createDefault();
 	std::string getMime(const std::string& path) const override;
+	// Like getMime, without a copy or an allocation; valid as long as the mapper
+	std::string_view findMime(std::string_view path) const;
 	std::string getExtension(const std::string& mime) const override;
 	bool addMapping(const std::string& path, const std::string& mime, ForceUpdate forceUpdate = ForceUpdate::Both) override;
 private:
 	bool addMappingMimeToExtension(const std::string& extension, const std::string& mime, ForceUpdate forceUpdate);
 	bool addMappingExtensionToMime(const std::string& extension, const std::string& mime, ForceUpdate forceUpdate);
+	void indexExtensions();
+};
+
+// MimeMapper that may be changed while other threads look types up. Lookups read
+// an immutable snapshot through an RcuPointer, without locks or atomic
+// read-modify-write; changes copy the current snapshot and publish the copy.
+class ConcurrentMimeMapper final : public IMimeMapper {
+private:
+	RcuPointer<const MimeMapper> snapshot;
+	std::mutex writerLock;
+public:
+	// Takes ownership of mapper
+	explicit ConcurrentMimeMapper(MimeMapper* mapper);
+	static ConcurrentMimeMapper* createDefault();
+	std::string getMime(const std::string& path) const override;
+	// Like getMime, without a copy or an allocation; valid until the reader next
+	// reports a quiescent state
+	std::string_view findMime(std::string_view path) const;
+	std::string getExtension(const std::string& mime) const override;
+	bool addMapping(const std::string& path, const std::string& mime, ForceUpdate forceUpdate = ForceUpdate::Both) override;
+	// Applies several changes as a single new snapshot
+	void update(const std::function<void(IMimeMapper&)>& edit);
 };
 
 #endif // MIMEMAPPER_H
@@ -0,0 +1,74 @@
+#include "PipePool.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void PipePool::pipe::reset()
+{
+  if (!owner) {
+	return;
+  }
+  if (held == 0) {
+	owner->free_pipes.emplace_back(ends[0], ends[1]);
+  } else {
+#ifdef __linux__
+	close(ends[0]);
+	close(ends[1]);
+#endif
+	owner->created--;
+  }
+  owner = nullptr;
+  ends[0] = ends[1] = -1;
+  held = 0;
+}
+
+PipePool::~PipePool()
+{
+#ifdef __linux__
+  for (const std::pair<int, int>& fds : free_pipes) {
+	close(fds.first);
+	close(fds.second);
+  }
+#endif
+}
+
+bool PipePool::create()
+{
+#ifdef __linux__
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+	return false;
+  }
+  // Past the per-user limit of pipe memory the kernel keeps its default size
+  int granted = fcntl(fds[1], F_SETPIPE_SZ, int(pipe_size));
+  if (granted <= 0) {
+	granted = fcntl(fds[1], F_GETPIPE_SZ);
+  }
+  if (created == 0 && granted > 0) {
+	pipe_size = size_t(granted);
+  }
+  free_pipes.emplace_back(fds[0], fds[1]);
+  created++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PipePool::reserve(size_t count)
+{
+  while (free_pipes.size() < count && create()) {
+  }
+}
+
+PipePool::pipe PipePool::acquire()
+{
+  if (free_pipes.empty() && !create()) {
+	return pipe();
+  }
+  std::pair<int, int> fds = free_pipes.back();
+  free_pipes.pop_back();
+  return pipe(this, fds);
+}
@@ -0,0 +1,76 @@
+#ifndef PIPE_POOL_H
+#define PIPE_POOL_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Pipes that bodies are spliced through on their way from a file descriptor to a
+// socket, so that their pages are moved rather than copied (Linux only; elsewhere
+// no pipe is ever lent).
+//
+// Pipes are made ahead of need and resized with F_SETPIPE_SZ. A pipe is lent to a
+// connection only while it holds bytes of the body being sent: once drained it
+// goes back on the free list and is lent again, so a pool settles at the number
+// of connections stalled with bytes in flight. A pipe given back with bytes still
+// in it is closed instead. Not thread-safe: each event loop has its own.
+class PipePool {
+public:
+  // A pipe on loan, given back when reset, reassigned or destroyed. The pool must
+  // outlive it.
+  class pipe {
+	friend PipePool;
+	PipePool* owner = nullptr;
+	int ends[2] = { -1, -1 };
+	pipe(PipePool* owner, std::pair<int, int> fds) : owner(owner), ends{ fds.first, fds.second } {}
+  public:
+	// Spliced in and not out yet
+	size_t held = 0;
+	pipe() {}
+	pipe(pipe&& other) noexcept : owner(other.owner), ends{ other.ends[0], other.ends[1] }, held(other.held) {
+	  other.owner = nullptr;
+	  other.ends[0] = other.ends[1] = -1;
+	  other.held = 0;
+	}
+	pipe& operator=(pipe&& other) noexcept {
+	  if (this != &other) {
+		reset();
+		owner = other.owner;
+		ends[0] = other.ends[0];
+		ends[1] = other.ends[1];
+		held = other.held;
+		other.owner = nullptr;
+		other.ends[0] = other.ends[1] = -1;
+		other.held = 0;
+	  }
+	  return *this;
+	}
+	~pipe() { reset(); }
+	void reset();
+	int read_end() const { return ends[0]; }
+	int write_end() const { return ends[1]; }
+	explicit operator bool() const { return owner != nullptr; }
+  };
+private:
+  size_t pipe_size;
+  size_t created = 0;
+  std::vector<std::pair<int, int>> free_pipes;
+
+  bool create();
+public:
+  // Pipes are asked to hold size bytes each
+  explicit PipePool(size_t size = 256 << 10) : pipe_size(size) {}
+  PipePool(const PipePool&) = delete;
+  PipePool& operator=(const PipePool&) = delete;
+  ~PipePool();
+  // Makes pipes until count are free
+  void reserve(size_t count);
+  // An empty pipe, or none if it cannot be made
+  pipe acquire();
+  // What a pipe holds, as the kernel granted it
+  size_t capacity() const { return pipe_size; }
+  size_t allocated() const { return created; }
+  size_t in_use() const { return created - free_pipes.size(); }
+};
+
+#endif // PIPE_POOL_H
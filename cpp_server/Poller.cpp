@@ -0,0 +1,140 @@
+#include "Poller.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#endif
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+// Ready sockets taken from the kernel per wait; the rest are reported by the next
+static const size_t MAX_EVENTS = 1024;
+
+#ifdef __linux__
+Poller::~Poller()
+{
+  if (epoll != -1) {
+	close(epoll);
+  }
+}
+
+bool Poller::open()
+{
+  if (epoll == -1) {
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	received.resize(MAX_EVENTS);
+  }
+  return epoll != -1;
+}
+
+bool Poller::watch(SOCKET socket, unsigned before, unsigned after)
+{
+  if (before == after) {
+	return true;
+  }
+  epoll_event e = {};
+  e.events = ((after & readable) ? uint32_t(EPOLLIN) : 0) | ((after & writable) ? uint32_t(EPOLLOUT) : 0);
+  e.data.fd = socket;
+  int op = before == 0 ? EPOLL_CTL_ADD : after == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  return epoll_ctl(epoll, op, socket, &e) == 0;
+}
+
+int Poller::wait(std::vector<event>& ready, int timeout)
+{
+  ready.clear();
+  int count = epoll_wait(epoll, received.data(), int(received.size()), timeout);
+  if (count < 0) {
+	return SOCKET_ERROR;
+  }
+  for (int i = 0; i != count; i++) {
+	uint32_t events = received[i].events;
+	unsigned which = (events & EPOLLOUT) ? writable : 0;
+	if (events & ~uint32_t(EPOLLOUT)) {
+	  which |= readable;
+	}
+	ready.push_back(event{ received[i].data.fd, which });
+  }
+  return count;
+}
+
+#ifdef EPIOCSPARAMS
+bool Poller::busy_poll(unsigned usecs)
+{
+  epoll_params params = {};
+  params.busy_poll_usecs = usecs;
+  // The most packets a spin may take without CAP_NET_ADMIN
+  params.busy_poll_budget = 64;
+  return ioctl(epoll, EPIOCSPARAMS, &params) == 0;
+}
+#else
+bool Poller::busy_poll(unsigned)
+{
+  return false;
+}
+#endif
+#else
+Poller::~Poller()
+{
+}
+
+bool Poller::open()
+{
+  return true;
+}
+
+bool Poller::watch(SOCKET socket, unsigned before, unsigned after)
+{
+  if (before == after) {
+	return true;
+  }
+  short events = short(((after & readable) ? POLLIN : 0) | ((after & writable) ? POLLOUT : 0));
+  if (before == 0) {
+	positions[socket] = fds.size();
+	fds.push_back(pollfd{ socket, events, 0 });
+	return true;
+  }
+  auto it = positions.find(socket);
+  if (it == positions.end()) {
+	return false;
+  }
+  size_t position = it->second;
+  if (after != 0) {
+	fds[position].events = events;
+	return true;
+  }
+  // The last socket takes the place of the one removed
+  fds[position] = fds.back();
+  positions[fds[position].fd] = position;
+  fds.pop_back();
+  positions.erase(it);
+  return true;
+}
+
+int Poller::wait(std::vector<event>& ready, int timeout)
+{
+  ready.clear();
+  if (poll(fds.data(), (unsigned long)fds.size(), timeout) == SOCKET_ERROR) {
+	return SOCKET_ERROR;
+  }
+  for (const pollfd& fd : fds) {
+	if (fd.revents == 0) {
+	  continue;
+	}
+	unsigned which = (fd.revents & POLLOUT) ? writable : 0;
+	if (fd.revents & ~POLLOUT) {
+	  which |= readable;
+	}
+	ready.push_back(event{ fd.fd, which });
+	if (ready.size() == MAX_EVENTS) {
+	  break;
+	}
+  }
+  return int(ready.size());
+}
+
+bool Poller::busy_poll(unsigned)
+{
+  return false;
+}
+#endif
@@ -0,0 +1,62 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <cstddef>
+#include <vector>
+#include "ServerPolicies.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <unordered_map>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#endif
+
+// Waits for sockets to become readable or writable.
+//
+// Sockets are registered with what they are watched for and stay registered
+// across waits, so a wait costs as much as the sockets that are ready, not as
+// much as the sockets there are: an idle connection costs nothing until it
+// speaks. A socket watched for nothing is not registered at all, so errors and
+// hangups on it are not reported either. Uses epoll on Linux and poll elsewhere,
+// where a wait still passes every registered socket to the kernel. Not
+// thread-safe: each event loop has its own.
+class Poller {
+public:
+  static const unsigned readable = 1;
+  static const unsigned writable = 2;
+  struct event {
+	SOCKET socket;
+	// writable, readable; errors and hangups count as readable
+	unsigned ready;
+  };
+private:
+#ifdef __linux__
+  int epoll = -1;
+  std::vector<epoll_event> received;
+#else
+  std::vector<pollfd> fds;
+  // Index of each registered socket in fds
+  std::unordered_map<SOCKET, size_t> positions;
+#endif
+public:
+  Poller() {}
+  Poller(const Poller&) = delete;
+  Poller& operator=(const Poller&) = delete;
+  ~Poller();
+  // Must succeed before anything is watched; errno tells why it did not
+  bool open();
+  // Changes what socket is watched for from before (0 if it is not registered) to
+  // after (0 to stop watching it); the socket must still be open
+  bool watch(SOCKET socket, unsigned before, unsigned after);
+  // Waits up to timeout milliseconds (-1 for ever) and replaces the contents of
+  // ready with the sockets that are. Returns SOCKET_ERROR on failure.
+  int wait(std::vector<event>& ready, int timeout);
+  // Waits spin for up to usecs microseconds on the device queues of the watched
+  // sockets before sleeping (epoll of Linux 6.9 on); false where not supported
+  bool busy_poll(unsigned usecs);
+};
+
+#endif // POLLER_H
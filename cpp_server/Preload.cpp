@@ -0,0 +1,88 @@
+#include "Preload.h"
+#include <filesystem>
+#include <fstream>
+#include "CanonicalPath.h"
+
+bool Preload::matches(std::string_view pattern, std::string_view path)
+{
+  // Backtracks to the last '*' only, which is enough without character classes
+  size_t p = 0, s = 0;
+  size_t star = std::string_view::npos, resume = 0;
+  while (s != path.size()) {
+	if (p != pattern.size() && (pattern[p] == '?' || pattern[p] == path[s])) {
+	  p++;
+	  s++;
+	} else if (p != pattern.size() && pattern[p] == '*') {
+	  star = p++;
+	  resume = s;
+	} else if (star != std::string_view::npos) {
+	  p = star + 1;
+	  s = ++resume;
+	} else {
+	  return false;
+	}
+  }
+  while (p != pattern.size() && pattern[p] == '*') {
+	p++;
+  }
+  return p == pattern.size();
+}
+
+bool Preload::select(const std::string& root, const config& cfg, std::vector<std::string>& paths, std::string& error)
+{
+  namespace fs = std::filesystem;
+  auto wanted = [&cfg](const std::string& path) {
+	if (cfg.patterns.empty()) {
+	  return true;
+	}
+	for (const std::string& pattern : cfg.patterns) {
+	  if (matches(pattern, path)) {
+		return true;
+	  }
+	}
+	return false;
+  };
+
+  if (!cfg.list_path.empty()) {
+	std::ifstream list(cfg.list_path);
+	if (!list) {
+	  error = "cannot read " + cfg.list_path;
+	  return false;
+	}
+	// Listed paths are requests; they go through the same checks
+	CanonicalPath canonical_path;
+	std::string line;
+	while (std::getline(list, line) && (cfg.top == 0 || paths.size() < cfg.top)) {
+	  if (!line.empty() && line.back() == '\r') {
+		line.pop_back();
+	  }
+	  if (canonical_path.assign(line) != CanonicalPath::status::ok) {
+		continue;
+	  }
+	  std::string path(canonical_path.view());
+	  if (canonical_path.is_directory()) {
+		path += "index.html";
+	  }
+	  if (wanted(path)) {
+		paths.push_back(std::move(path));
+	  }
+	}
+	return true;
+  }
+
+  std::error_code ec;
+  fs::recursive_directory_iterator it(root, ec);
+  for (fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+	if (it->is_regular_file(ec)) {
+	  std::string path = "/" + it->path().lexically_relative(root).generic_string();
+	  if (wanted(path)) {
+		paths.push_back(std::move(path));
+	  }
+	}
+  }
+  if (ec) {
+	error = "cannot read " + root + ": " + ec.message();
+	return false;
+  }
+  return true;
+}
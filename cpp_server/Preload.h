@@ -0,0 +1,33 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Chooses the files read in at startup, before any connection is accepted, so
+// that the first requests after a restart find them in memory.
+class Preload {
+public:
+  struct config {
+	bool enabled = false;
+	// Request paths to read, such as "*.html" or "/assets/*"; all when empty
+	std::vector<std::string> patterns;
+	// A file of request paths, one per line and most requested first (such as a
+	// summary of a previous run's traffic), read instead of walking the root
+	std::string list_path;
+	// Only the first paths of the list; 0 takes all
+	size_t top = 0;
+	// 0 means one per CPU
+	unsigned threads = 0;
+	// Lock cached contents into memory
+	bool lock_memory = false;
+  };
+  // Request paths under root, in the order they should be read
+  static bool select(const std::string& root, const config& cfg, std::vector<std::string>& paths, std::string& error);
+  // '*' matches any run of characters, '/' included, and '?' any one character
+  static bool matches(std::string_view pattern, std::string_view path);
+};
+
+#endif // PRELOAD_H
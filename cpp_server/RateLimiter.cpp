@@ -0,0 +1,206 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+namespace {
+  uint64_t mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+  }
+
+  unsigned round_down_pow2(size_t value) {
+	unsigned bits = 0;
+	while ((size_t(2) << bits) <= value) {
+	  bits++;
+	}
+	return bits;
+  }
+
+  class line_guard {
+	std::atomic_flag& lock;
+  public:
+	explicit line_guard(std::atomic_flag& lock) : lock(lock) {
+	  while (lock.test_and_set(std::memory_order_acquire)) {
+	  }
+	}
+	~line_guard() { lock.clear(std::memory_order_release); }
+  };
+}
+
+RateLimiter::RateLimiter(const config& cfg) : cfg(cfg), epoch(std::chrono::steady_clock::now())
+{
+  set_rates(cfg);
+  unsigned shard_bits = round_down_pow2(std::max(this->cfg.shards, 1u));
+  size_t shard_count = size_t(1) << shard_bits;
+  size_t lines_per_shard = std::max<size_t>(this->cfg.memory_limit / sizeof(line) / shard_count, 1);
+  unsigned line_bits = round_down_pow2(lines_per_shard);
+  shard_shift = 64 - shard_bits;
+  line_mask = (uint64_t(1) << line_bits) - 1;
+  for (size_t i = 0; i != shard_count; i++) {
+	shards.emplace_back(new line[line_mask + 1]());
+  }
+  std::random_device rd;
+  seed = (uint64_t(rd()) << 32) ^ rd();
+}
+
+uint32_t RateLimiter::now() const
+{
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch);
+  // 0 is reserved for empty slots
+  return uint32_t(elapsed.count()) | 1;
+}
+
+uint64_t RateLimiter::hash(const uint8_t (&address)[16]) const
+{
+  uint64_t high, low;
+  std::memcpy(&high, address, 8);
+  std::memcpy(&low, address + 8, 8);
+  return mix(high ^ seed) ^ mix(low + seed * 0x9e3779b97f4a7c15ULL);
+}
+
+RateLimiter::line& RateLimiter::find_line(const uint8_t (&address)[16]) const
+{
+  uint64_t h = hash(address);
+  size_t shard = shard_shift == 64 ? 0 : size_t(h >> shard_shift);
+  return shards[shard][h & line_mask];
+}
+
+RateLimiter::slot& RateLimiter::find_slot(line& l, const uint8_t (&address)[16], uint32_t stamp) const
+{
+  for (slot& s : l.ways) {
+	if (s.stamp != 0 && std::memcmp(s.address, address, sizeof(s.address)) == 0) {
+	  return s;
+	}
+  }
+  // Miss: take the way touched longest ago; a bucket that has refilled completely
+  // carries no state, so evicting it loses nothing.
+  slot* victim = &l.ways[0];
+  for (slot& s : l.ways) {
+	if (s.stamp == 0 || uint32_t(stamp - s.stamp) > uint32_t(stamp - victim->stamp)) {
+	  victim = &s;
+	  if (s.stamp == 0) {
+		break;
+	  }
+	}
+  }
+  std::memcpy(victim->address, address, sizeof(victim->address));
+  victim->stamp = stamp;
+  victim->requests = float(request_burst.load(std::memory_order_relaxed));
+  victim->bytes = float(byte_burst.load(std::memory_order_relaxed));
+  return *victim;
+}
+
+void RateLimiter::refill(slot& s, uint32_t stamp) const
+{
+  double elapsed = uint32_t(stamp - s.stamp) / 1000.0;
+  s.requests = float(std::min(request_burst.load(std::memory_order_relaxed),
+	s.requests + elapsed * requests_per_second.load(std::memory_order_relaxed)));
+  s.bytes = float(std::min(byte_burst.load(std::memory_order_relaxed),
+	s.bytes + elapsed * bytes_per_second.load(std::memory_order_relaxed)));
+  s.stamp = stamp;
+}
+
+bool RateLimiter::make_key(const sockaddr* addr, uint8_t (&address)[16])
+{
+  std::memset(address, 0, sizeof(address));
+  if (addr == nullptr) {
+	return false;
+  }
+  if (addr->sa_family == AF_INET) {
+	const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(addr);
+	address[10] = 0xff;
+	address[11] = 0xff;
+	std::memcpy(address + 12, &in->sin_addr, 4);
+	return true;
+  }
+  if (addr->sa_family == AF_INET6) {
+	const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(addr);
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&in6->sin6_addr);
+	static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	// v4-mapped addresses keep all bits, everything else is limited per /64
+	std::memcpy(address, bytes, std::memcmp(bytes, v4_mapped, sizeof(v4_mapped)) == 0 ? 16 : 8);
+	return true;
+  }
+  return false;
+}
+
+unsigned RateLimiter::acquire_request(const sockaddr* addr)
+{
+  uint8_t address[16];
+  if (!make_key(addr, address)) {
+	return 0;
+  }
+  uint32_t stamp = now();
+  line& l = find_line(address);
+  line_guard guard(l.lock);
+  slot& s = find_slot(l, address, stamp);
+  refill(s, stamp);
+  double request_rate = requests_per_second.load(std::memory_order_relaxed);
+  double byte_rate = bytes_per_second.load(std::memory_order_relaxed);
+  double wait = 0;
+  if (request_rate > 0 && s.requests < 1) {
+	wait = (1 - s.requests) / request_rate;
+  }
+  if (byte_rate > 0 && s.bytes < 0) {
+	wait = std::max(wait, -s.bytes / byte_rate);
+  }
+  if (wait > 0) {
+	return unsigned(std::ceil(wait));
+  }
+  if (request_rate > 0) {
+	s.requests -= 1;
+  }
+  return 0;
+}
+
+void RateLimiter::charge_bytes(const sockaddr* addr, size_t bytes)
+{
+  uint8_t address[16];
+  if (bytes_per_second.load(std::memory_order_relaxed) <= 0 || !make_key(addr, address)) {
+	return;
+  }
+  uint32_t stamp = now();
+  line& l = find_line(address);
+  line_guard guard(l.lock);
+  slot& s = find_slot(l, address, stamp);
+  refill(s, stamp);
+  s.bytes -= float(bytes);
+}
+
+size_t RateLimiter::capacity() const
+{
+  return shards.size() * (line_mask + 1) * 2;
+}
+
+void RateLimiter::set_rates(const config& rates)
+{
+  requests_per_second.store(rates.requests_per_second);
+  bytes_per_second.store(rates.bytes_per_second);
+  request_burst.store(rates.request_burst < rates.requests_per_second ?
+	std::max(rates.requests_per_second, 1.0) : rates.request_burst);
+  byte_burst.store(std::max(rates.byte_burst, rates.bytes_per_second));
+}
+
+RateLimiter::config RateLimiter::settings() const
+{
+  config current = cfg;
+  current.requests_per_second = requests_per_second.load();
+  current.request_burst = request_burst.load();
+  current.bytes_per_second = bytes_per_second.load();
+  current.byte_burst = byte_burst.load();
+  return current;
+}
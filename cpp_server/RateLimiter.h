@@ -0,0 +1,81 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct sockaddr;
+
+// Per-client-address token buckets for requests/sec and bytes/sec.
+//
+// Buckets live in a fixed-size, sharded, set-associative open-addressing table:
+// an address hashes to exactly one 64-byte line holding a spin lock and two slots,
+// so a check touches a single cache line. Tokens are refilled lazily when a slot
+// is touched, and a miss evicts the least recently touched slot of the line
+// (approximate LRU), which keeps memory bounded no matter how many addresses we see.
+// IPv4 clients are keyed by address, IPv6 clients by their /64 prefix.
+class RateLimiter {
+public:
+  struct config {
+	// 0 disables the corresponding bucket
+	double requests_per_second = 0;
+	double request_burst = 0;
+	double bytes_per_second = 0;
+	double byte_burst = 0;
+	// upper bound for the whole table, rounded down to a power of two number of lines per shard
+	size_t memory_limit = 16 << 20;
+	unsigned shards = 16;
+  };
+private:
+  struct slot {
+	uint8_t address[16];
+	// milliseconds since construction, 0 marks an empty slot
+	uint32_t stamp;
+	float requests;
+	float bytes;
+  };
+  struct alignas(64) line {
+	std::atomic_flag lock = ATOMIC_FLAG_INIT;
+	slot ways[2];
+  };
+  static_assert(sizeof(line) == 64, "a rate limiter line must fit one cache line");
+
+  config cfg;
+  // Rates can change while addresses are checked
+  std::atomic<double> requests_per_second;
+  std::atomic<double> request_burst;
+  std::atomic<double> bytes_per_second;
+  std::atomic<double> byte_burst;
+  std::vector<std::unique_ptr<line[]>> shards;
+  unsigned shard_shift;
+  uint64_t line_mask;
+  uint64_t seed;
+  std::chrono::steady_clock::time_point epoch;
+
+  uint32_t now() const;
+  uint64_t hash(const uint8_t (&address)[16]) const;
+  line& find_line(const uint8_t (&address)[16]) const;
+  slot& find_slot(line& l, const uint8_t (&address)[16], uint32_t stamp) const;
+  void refill(slot& s, uint32_t stamp) const;
+  static bool make_key(const sockaddr* addr, uint8_t (&address)[16]);
+public:
+  explicit RateLimiter(const config& cfg);
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+  // Takes one request token. Returns 0 if the request may proceed,
+  // otherwise the number of seconds after which a retry can succeed.
+  unsigned acquire_request(const sockaddr* addr);
+  // Debits bytes sent to the client. The byte bucket may go into debt;
+  // requests are refused until it has been paid back.
+  void charge_bytes(const sockaddr* addr, size_t bytes);
+  size_t capacity() const;
+  // Changes the rates and bursts; the table keeps its size
+  void set_rates(const config& rates);
+  config settings() const;
+};
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,89 @@
+#include "Rcu.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+  struct retired_object {
+	// Readers that have not seen this epoch may still hold the object
+	uint64_t epoch;
+	void* object;
+	void (*destroy)(void*);
+  };
+
+  // One domain for the process; constructed on first use
+  struct domain {
+	std::atomic<uint64_t> epoch{ 1 };
+	std::atomic<bool> retiring{ false };
+	std::mutex lock;
+	std::vector<Rcu::reader*> readers;
+	std::vector<retired_object> retired;
+  };
+
+  domain& global() {
+	static domain instance;
+	return instance;
+  }
+}
+
+Rcu::reader::reader()
+{
+  domain& d = global();
+  std::lock_guard<std::mutex> guard(d.lock);
+  seen.store(d.epoch.load());
+  d.readers.push_back(this);
+}
+
+Rcu::reader::~reader()
+{
+  domain& d = global();
+  std::lock_guard<std::mutex> guard(d.lock);
+  d.readers.erase(std::find(d.readers.begin(), d.readers.end(), this));
+  reclaim();
+}
+
+void Rcu::reader::quiescent()
+{
+  domain& d = global();
+  // Seeing the new epoch means seeing the pointers published before it was advanced
+  seen.store(d.epoch.load(std::memory_order_acquire), std::memory_order_release);
+  if (d.retiring.load(std::memory_order_relaxed)) {
+	// Never waits on a writer; whoever holds the lock reclaims later
+	std::unique_lock<std::mutex> guard(d.lock, std::try_to_lock);
+	if (guard.owns_lock()) {
+	  reclaim();
+	}
+  }
+}
+
+void Rcu::retire(void* object, void (*destroy)(void*))
+{
+  if (object == nullptr) {
+	return;
+  }
+  domain& d = global();
+  std::lock_guard<std::mutex> guard(d.lock);
+  // The object was unpublished before the epoch advances past it
+  uint64_t epoch = d.epoch.fetch_add(1) + 1;
+  d.retired.push_back(retired_object{ epoch, object, destroy });
+  d.retiring.store(true);
+  reclaim();
+}
+
+void Rcu::reclaim()
+{
+  domain& d = global();
+  uint64_t oldest = UINT64_MAX;
+  for (reader* r : d.readers) {
+	oldest = std::min(oldest, r->seen.load(std::memory_order_acquire));
+  }
+  auto kept = std::partition(d.retired.begin(), d.retired.end(), [oldest](const retired_object& r) {
+	return r.epoch > oldest;
+  });
+  std::vector<retired_object> freed(kept, d.retired.end());
+  d.retired.erase(kept, d.retired.end());
+  d.retiring.store(!d.retired.empty());
+  for (const retired_object& r : freed) {
+	r.destroy(r.object);
+  }
+}
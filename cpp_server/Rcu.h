@@ -0,0 +1,58 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Read-copy-update with quiescent states, shared by everything the request path
+// reads while it may be replaced (the configuration, the MIME registry).
+//
+// A reader dereferences an RcuPointer with one atomic load, without any
+// read-modify-write, and may use what it got until it next reports a quiescent
+// state; an event loop does that between two iterations. A writer publishes a new
+// object and retires the old one, which is deleted once every registered reader
+// has been quiescent since. Threads that never register must not read while
+// others write.
+class Rcu {
+public:
+  class reader {
+	friend Rcu;
+	// Epoch of the last quiescent state
+	std::atomic<uint64_t> seen;
+  public:
+	reader();
+	reader(const reader&) = delete;
+	reader& operator=(const reader&) = delete;
+	~reader();
+	// The thread keeps no reference to protected objects across this call
+	void quiescent();
+  };
+
+  // Deletes object once no reader can still see it
+  template<class T>
+  static void retire(T* object) {
+	retire(const_cast<void*>(static_cast<const void*>(object)), [](void* p) { delete static_cast<T*>(p); });
+  }
+private:
+  static void retire(void* object, void (*destroy)(void*));
+  // Frees what no reader can still see; the lock must be held
+  static void reclaim();
+};
+
+// A pointer readers follow without locks while writers replace the object
+template<class T>
+class RcuPointer {
+  std::atomic<T*> current;
+public:
+  explicit RcuPointer(T* initial) : current(initial) {}
+  RcuPointer(const RcuPointer&) = delete;
+  RcuPointer& operator=(const RcuPointer&) = delete;
+  ~RcuPointer() { delete current.load(); }
+  T& operator*() const { return *current.load(std::memory_order_acquire); }
+  T* operator->() const { return current.load(std::memory_order_acquire); }
+  // Takes ownership of next; concurrent writers must be serialized by the caller
+  void publish(T* next) { Rcu::retire(current.exchange(next)); }
+};
+
+#endif // RCU_H
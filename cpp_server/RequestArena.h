@@ -0,0 +1,29 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+// Memory for what a request needs only while it is being handled, such as its
+// path on disk and the type and ETag of what it resolves to.
+//
+// Allocating bumps a pointer through a fixed block, and through blocks from the
+// heap should that run out. Nothing is freed on its own; reset() takes it all
+// back at once, so a request that fits the block never reaches the heap. Not
+// thread-safe: each event loop has its own.
+class RequestArena {
+public:
+  static const size_t block_size = 8 << 10;
+private:
+  alignas(std::max_align_t) char block[block_size];
+  std::pmr::monotonic_buffer_resource memory;
+public:
+  RequestArena() : memory(block, sizeof(block), std::pmr::new_delete_resource()) {}
+  RequestArena(const RequestArena&) = delete;
+  RequestArena& operator=(const RequestArena&) = delete;
+  std::pmr::memory_resource* resource() { return &memory; }
+  // Nothing allocated since the last reset may be in use any more
+  void reset() { memory.release(); }
+};
+
+#endif // REQUEST_ARENA_H
@@ -0,0 +1,169 @@
+#ifndef RESOURCE_H
+#define RESOURCE_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+class BodyStream;
+
+// What a request asks for, independent of the protocol it arrived on. The fields
+// view the request as received, which outlives its handling.
+struct ResourceRequest {
+  std::string_view method;
+  std::string_view target;
+  // Accept-Encoding admits gzip
+  bool gzip = false;
+  std::string_view if_none_match;
+  // Handled again after waiting for its file to be loaded; the rate limiter has
+  // counted it already
+  bool resumed = false;
+
+  // Whether an Accept-Encoding value admits gzip with a non-zero q. An explicit gzip
+  // or x-gzip item wins over *, whatever their order.
+  static bool accepts_gzip(std::string_view accept_encoding) {
+	int gzip = -1;
+	int any = -1;
+	int other = -1;
+	while (!accept_encoding.empty()) {
+	  size_t comma = accept_encoding.find(',');
+	  std::string_view item = accept_encoding.substr(0, comma);
+	  accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+	  size_t semicolon = item.find(';');
+	  std::string_view coding = trimmed(item.substr(0, semicolon));
+	  int& q = equal_nocase(coding, "gzip") || equal_nocase(coding, "x-gzip") ? gzip : coding == "*" ? any : other;
+	  q = std::max(q, semicolon == std::string_view::npos ? 1000 : qvalue(item.substr(semicolon + 1)));
+	}
+	return gzip >= 0 ? gzip > 0 : any > 0;
+  }
+
+  // Whether If-None-Match lists etag or is "*", so the client has the representation;
+  // weak comparison, as for a GET
+  bool already_has(std::string_view etag) const {
+	std::string_view list = if_none_match;
+	auto unprefixed = [](std::string_view tag) {
+	  return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+	};
+	while (!list.empty()) {
+	  size_t comma = list.find(',');
+	  std::string_view item = list.substr(0, comma);
+	  list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+	  size_t first = item.find_first_not_of(" \t");
+	  if (first == std::string_view::npos) {
+		continue;
+	  }
+	  item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+	  if (item == "*" || unprefixed(item) == unprefixed(etag)) {
+		return true;
+	  }
+	}
+	return false;
+  }
+
+private:
+  static std::string_view trimmed(std::string_view text) {
+	size_t first = text.find_first_not_of(" \t");
+	if (first == std::string_view::npos) {
+	  return std::string_view();
+	}
+	return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+  }
+
+  static bool equal_nocase(std::string_view text, std::string_view lower) {
+	if (text.size() != lower.size()) {
+	  return false;
+	}
+	for (size_t i = 0; i != text.size(); i++) {
+	  if (std::tolower((unsigned char)text[i]) != lower[i]) {
+		return false;
+	  }
+	}
+	return true;
+  }
+
+  // The q parameter among the parameters of an item, in thousandths; 1000 if absent
+  // and 0 if malformed
+  static int qvalue(std::string_view parameters) {
+	while (!parameters.empty()) {
+	  size_t semicolon = parameters.find(';');
+	  std::string_view parameter = parameters.substr(0, semicolon);
+	  parameters = semicolon == std::string_view::npos ? std::string_view() : parameters.substr(semicolon + 1);
+	  size_t equals = parameter.find('=');
+	  if (equals == std::string_view::npos || !equal_nocase(trimmed(parameter.substr(0, equals)), "q")) {
+		continue;
+	  }
+	  // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+	  std::string_view value = trimmed(parameter.substr(equals + 1));
+	  if (value.empty() || (value[0] != '0' && value[0] != '1') || value.size() > 5 ||
+		(value.size() > 1 && value[1] != '.')) {
+		return 0;
+	  }
+	  int thousandths = (value[0] - '0') * 1000;
+	  for (size_t i = 2, scale = 100; i < value.size(); i++, scale /= 10) {
+		if (value[i] < '0' || value[i] > '9') {
+		  return 0;
+		}
+		thousandths += (value[i] - '0') * int(scale);
+	  }
+	  return std::min(thousandths, 1000);
+	}
+	return 1000;
+  }
+};
+
+// What a request resolves to, independent of the protocol it arrived on. A 200
+// carries a type, a size and either an open file, which the holder must release,
+// or contents in memory owned by a cache or a bundle; a 304 carries only the
+// ETag. Its strings come from the memory resource it is made with, such as the
+// arena of the request being handled.
+struct Resource {
+  int status = 500;
+  std::pmr::string content_type;
+  int file = -1;
+  std::shared_ptr<const char> data;
+  uint64_t size = 0;
+  // How the body is read or made while it is sent, if it is streamed
+  std::shared_ptr<BodyStream> stream;
+  // Optional fields of the representation
+  std::pmr::string etag;
+  std::pmr::string content_encoding;
+  // The representation depends on Accept-Encoding
+  bool varies = false;
+  // The fields above and Content-Length serialized for HTTP/1.1, when precomputed;
+  // valid as long as the body
+  std::string_view header_fields;
+  // seconds, for 429
+  unsigned retry_after = 0;
+  // The file is being loaded for another request; this one is to be handled again
+  // once it is
+  bool pending = false;
+
+  Resource() = default;
+  explicit Resource(std::pmr::memory_resource* memory) :
+	content_type(memory), etag(memory), content_encoding(memory) {}
+
+  void release() {
+	if (file != -1) {
+#ifdef _WIN32
+	  _close(file);
+#else
+	  close(file);
+#endif
+	  file = -1;
+	}
+	data.reset();
+	stream.reset();
+  }
+};
+
+#endif // RESOURCE_H
@@ -0,0 +1,202 @@
+#include "SendScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std::chrono;
+
+namespace {
+  double burst(double rate, size_t quantum) {
+	return std::max(rate / 10, double(quantum));
+  }
+
+  // smallest useful grant: 10ms worth of the rate, at most one quantum
+  double min_grant(double rate, size_t quantum) {
+	return std::max(1.0, std::min(double(quantum), rate / 100));
+  }
+
+  int wait_ms(double tokens, double rate, size_t quantum) {
+	double missing = min_grant(rate, quantum) - tokens;
+	return std::max(1, int(std::ceil(missing * 1000 / rate)));
+  }
+}
+
+SendScheduler::SendScheduler(const config& cfg) : cfg(cfg), global_stamp(steady_clock::now())
+{
+  if (this->cfg.quantum == 0) {
+	this->cfg.quantum = 64 << 10;
+  }
+  global_tokens = burst(this->cfg.global_rate, this->cfg.quantum);
+}
+
+void SendScheduler::reconfigure(const config& cfg)
+{
+  steady_clock::time_point now = steady_clock::now();
+  refill_global(now);
+  bool was_limited = this->cfg.global_rate > 0;
+  this->cfg = cfg;
+  if (this->cfg.quantum == 0) {
+	this->cfg.quantum = 64 << 10;
+  }
+  // A budget saved up under the old rate must not exceed the new burst
+  double limit = burst(this->cfg.global_rate, this->cfg.quantum);
+  global_tokens = was_limited ? std::min(global_tokens, limit) : limit;
+  global_stamp = now;
+}
+
+void SendScheduler::refill_global(steady_clock::time_point now)
+{
+  if (cfg.global_rate <= 0) {
+	return;
+  }
+  double elapsed = duration<double>(now - global_stamp).count();
+  global_tokens = std::min(burst(cfg.global_rate, cfg.quantum), global_tokens + elapsed * cfg.global_rate);
+  global_stamp = now;
+}
+
+void SendScheduler::refill_connection(transfer& t, steady_clock::time_point now) const
+{
+  double elapsed = duration<double>(now - t.stamp).count();
+  t.tokens = std::min(burst(cfg.connection_rate, cfg.quantum), t.tokens + elapsed * cfg.connection_rate);
+  t.stamp = now;
+}
+
+void SendScheduler::add(transfer* t)
+{
+  if (t->queued) {
+	// More was queued behind what made it small; a bulk transfer stays bulk
+	if (t->small && t->backlog() > cfg.small_response_limit) {
+	  small.erase(t->position);
+	  t->small = false;
+	  t->position = bulk.insert(bulk.end(), t);
+	}
+	return;
+  }
+  t->queued = true;
+  t->writable = true;
+  t->deficit = 0;
+  t->small = t->backlog() <= cfg.small_response_limit;
+  // The bucket refills over the time spent out of the queue; a transfer that left
+  // only because flow control held it back gets no new burst
+  refill_connection(*t, steady_clock::now());
+  std::pmr::list<transfer*>& queue = t->small ? small : bulk;
+  t->position = queue.insert(queue.end(), t);
+}
+
+void SendScheduler::remove(transfer* t)
+{
+  if (!t->queued) {
+	return;
+  }
+  (t->small ? small : bulk).erase(t->position);
+  t->queued = false;
+}
+
+void SendScheduler::finish(transfer* t, std::vector<transfer*>& done)
+{
+  remove(t);
+  done.push_back(t);
+}
+
+int SendScheduler::run(std::vector<transfer*>& done)
+{
+  auto now = steady_clock::now();
+  refill_global(now);
+
+  // Small responses first, in arrival order and without any cap
+  for (auto it = small.begin(); it != small.end();) {
+	transfer* t = *it++;
+	if (!t->writable) {
+	  continue;
+	}
+	uint64_t wanted = t->remaining();
+	long long sent = t->write_some(size_t(wanted));
+	if (sent < 0) {
+	  finish(t, done);
+	  continue;
+	}
+	if (cfg.global_rate > 0) {
+	  global_tokens -= double(sent);
+	}
+	if (t->remaining() == 0) {
+	  finish(t, done);
+	} else if (uint64_t(sent) < wanted) {
+	  t->writable = false;
+	}
+  }
+
+  // One deficit round-robin round over bulk transfers
+  int wait = -1;
+  bool progress = false;
+  auto resume = bulk.end();
+  for (auto it = bulk.begin(); it != bulk.end();) {
+	auto current = it++;
+	transfer* t = *current;
+	if (!t->writable) {
+	  continue;
+	}
+	double allowance = t->deficit + cfg.quantum;
+	bool capped = false;
+	if (cfg.global_rate > 0 && global_tokens < allowance) {
+	  if (global_tokens < min_grant(cfg.global_rate, cfg.quantum)) {
+		// Out of global budget: the next round starts with this transfer
+		if (resume == bulk.end()) {
+		  resume = current;
+		}
+		int ms = wait_ms(global_tokens, cfg.global_rate, cfg.quantum);
+		wait = wait < 0 ? ms : std::min(wait, ms);
+		continue;
+	  }
+	  allowance = global_tokens;
+	  capped = true;
+	}
+	if (cfg.connection_rate > 0) {
+	  refill_connection(*t, now);
+	  if (t->tokens < min_grant(cfg.connection_rate, cfg.quantum)) {
+		int ms = wait_ms(t->tokens, cfg.connection_rate, cfg.quantum);
+		wait = wait < 0 ? ms : std::min(wait, ms);
+		continue;
+	  }
+	  if (t->tokens < allowance) {
+		allowance = t->tokens;
+		capped = true;
+	  }
+	}
+	t->deficit += cfg.quantum;
+	uint64_t limit = std::min<uint64_t>(uint64_t(allowance), t->remaining());
+	long long sent = t->write_some(size_t(limit));
+	if (sent < 0) {
+	  finish(t, done);
+	  continue;
+	}
+	t->deficit = std::min(t->deficit - double(sent), double(cfg.quantum));
+	if (cfg.global_rate > 0) {
+	  global_tokens -= double(sent);
+	}
+	if (cfg.connection_rate > 0) {
+	  t->tokens -= double(sent);
+	}
+	if (t->remaining() == 0) {
+	  finish(t, done);
+	} else if (uint64_t(sent) < limit) {
+	  t->writable = false;
+	} else if (!capped) {
+	  progress = true;
+	} else {
+	  int ms = 1;
+	  if (cfg.global_rate > 0 && global_tokens < min_grant(cfg.global_rate, cfg.quantum)) {
+		ms = std::max(ms, wait_ms(global_tokens, cfg.global_rate, cfg.quantum));
+	  }
+	  if (cfg.connection_rate > 0 && t->tokens < min_grant(cfg.connection_rate, cfg.quantum)) {
+		ms = std::max(ms, wait_ms(t->tokens, cfg.connection_rate, cfg.quantum));
+	  }
+	  wait = wait < 0 ? ms : std::min(wait, ms);
+	}
+  }
+  if (resume != bulk.end() && resume != bulk.begin()) {
+	bulk.splice(bulk.end(), bulk, bulk.begin(), resume);
+  }
+  if (progress) {
+	return 0;
+  }
+  return wait;
+}
@@ -0,0 +1,86 @@
+#ifndef SEND_SCHEDULER_H
+#define SEND_SCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory_resource>
+#include <vector>
+
+// Decides which pending responses get to write and how much.
+//
+// Responses up to small_response_limit bytes are served first and are never held
+// back by rate caps; they may run the global budget into debt, which then delays
+// bulk traffic instead. A transfer is classed by its whole backlog, again each time
+// more is queued on it, so a small response does not carry a large one queued
+// behind it past the caps. Larger responses share what is left in deficit round-robin
+// with a fixed quantum per round, each additionally capped by its own token bucket,
+// which it keeps from one time in the queue to the next.
+class SendScheduler {
+public:
+  struct config {
+	size_t small_response_limit = 64 << 10;
+	size_t quantum = 64 << 10;
+	// bytes per second, 0 means unlimited
+	double connection_rate = 0;
+	double global_rate = 0;
+  };
+  class transfer {
+	friend SendScheduler;
+	std::pmr::list<transfer*>::iterator position;
+	bool queued = false;
+	bool small = false;
+	bool writable = true;
+	double deficit = 0;
+	double tokens = 0;
+	std::chrono::steady_clock::time_point stamp;
+  public:
+	virtual ~transfer() {}
+	// Writes at most limit bytes. Returns the number of bytes written,
+	// 0 if the socket would block, -1 on error.
+	virtual long long write_some(size_t limit) = 0;
+	virtual uint64_t remaining() const = 0;
+	// Everything still to be sent, including what cannot be written yet; what decides
+	// whether the transfer is small
+	virtual uint64_t backlog() const { return remaining(); }
+	// true while the transfer waits for the socket to become writable
+	bool blocked() const { return queued && !writable; }
+	bool scheduled() const { return queued; }
+  };
+private:
+  config cfg;
+  // Queue nodes are recycled, so queueing a transfer does not reach the heap
+  std::pmr::unsynchronized_pool_resource nodes;
+  std::pmr::list<transfer*> small{ &nodes };
+  std::pmr::list<transfer*> bulk{ &nodes };
+  double global_tokens;
+  std::chrono::steady_clock::time_point global_stamp;
+
+  void refill_global(std::chrono::steady_clock::time_point now);
+  void refill_connection(transfer& t, std::chrono::steady_clock::time_point now) const;
+  void finish(transfer* t, std::vector<transfer*>& done);
+public:
+  explicit SendScheduler(const config& cfg);
+  const config& settings() const { return cfg; }
+  // Takes effect for the transfers already queued from the next round on
+  void reconfigure(const config& cfg);
+  void add(transfer* t);
+  void remove(transfer* t);
+  // Appends every queued transfer to out
+  void list(std::vector<transfer*>& out) const {
+	out.insert(out.end(), small.begin(), small.end());
+	out.insert(out.end(), bulk.begin(), bulk.end());
+  }
+  // Forgets every transfer, as when they are all going away
+  void clear() { small.clear(); bulk.clear(); }
+  // Called when poll reports the socket of a blocked transfer writable
+  void set_writable(transfer* t) { t->writable = true; }
+  // Runs one scheduling round. Completed and failed transfers are appended to done.
+  // Returns how many milliseconds to wait before the next round can make progress,
+  // 0 if it can run immediately, -1 if it only waits for sockets.
+  int run(std::vector<transfer*>& done);
+  bool empty() const { return small.empty() && bulk.empty(); }
+};
+
+#endif // SEND_SCHEDULER_H
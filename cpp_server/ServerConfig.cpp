@@ -0,0 +1,157 @@
+#include "ServerConfig.h"
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+static std::string trim(const std::string& value) {
+  size_t first = value.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+	return "";
+  }
+  size_t last = value.find_last_not_of(" \t\r");
+  return value.substr(first, last - first + 1);
+}
+
+// A non-negative number, such as a rate in units per second
+static bool read_number(const std::string& value, double& number, std::string& error) {
+  char* end;
+  errno = 0;
+  double parsed = strtod(value.c_str(), &end);
+  if (value.empty() || *end != '\0' || errno != 0 || !std::isfinite(parsed) || parsed < 0) {
+	error = "expected a non-negative number, got \"" + value + "\"";
+	return false;
+  }
+  number = parsed;
+  return true;
+}
+
+static bool read_count(const std::string& value, uint64_t min, uint64_t max, uint64_t& count, std::string& error) {
+  char* end;
+  errno = 0;
+  unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+  if (value.empty() || value[0] == '-' || *end != '\0' || errno != 0 || parsed < min || parsed > max) {
+	error = "expected a whole number from " + std::to_string(min) + " to " + std::to_string(max) + ", got \"" + value + "\"";
+	return false;
+  }
+  count = parsed;
+  return true;
+}
+
+bool ServerConfig::set(const std::string& key, const std::string& value, std::string& error)
+{
+  uint64_t count;
+  if (key.compare(0, 5, "mime.") == 0 && key.size() > 5) {
+	if (value.empty()) {
+	  error = "empty Content-Type";
+	  return false;
+	}
+	mime_types["." + key.substr(5)] = value;
+  } else if (key == "root") {
+	if (value.empty()) {
+	  error = "empty root directory";
+	  return false;
+	}
+	root = value;
+  } else if (key == "rate_limit_rps") {
+	return read_number(value, rate_limits.requests_per_second, error);
+  } else if (key == "rate_limit_burst") {
+	return read_number(value, rate_limits.request_burst, error);
+  } else if (key == "rate_limit_bps") {
+	return read_number(value, rate_limits.bytes_per_second, error);
+  } else if (key == "rate_limit_byte_burst") {
+	return read_number(value, rate_limits.byte_burst, error);
+  } else if (key == "small_response_limit") {
+	if (!read_count(value, 0, SIZE_MAX, count, error)) {
+	  return false;
+	}
+	send.small_response_limit = size_t(count);
+  } else if (key == "send_quantum") {
+	if (!read_count(value, 1, SIZE_MAX, count, error)) {
+	  return false;
+	}
+	send.quantum = size_t(count);
+  } else if (key == "connection_rate") {
+	return read_number(value, send.connection_rate, error);
+  } else if (key == "egress_rate") {
+	return read_number(value, send.global_rate, error);
+  } else if (key == "h2_max_streams") {
+	if (!read_count(value, 1, UINT32_MAX, count, error)) {
+	  return false;
+	}
+	http2.max_concurrent_streams = uint32_t(count);
+  } else if (key == "h2_initial_window") {
+	// RFC 7540 6.5.2
+	if (!read_count(value, 0, 0x7fffffff, count, error)) {
+	  return false;
+	}
+	http2.initial_window_size = uint32_t(count);
+  } else if (key == "cache_size") {
+	if (!read_count(value, 0, SIZE_MAX, count, error)) {
+	  return false;
+	}
+	cache_size = size_t(count);
+  } else if (key == "cache_max_file") {
+	if (!read_count(value, 0, SIZE_MAX, count, error)) {
+	  return false;
+	}
+	cache_max_file = size_t(count);
+  } else if (key == "pipeline_depth") {
+	if (!read_count(value, 1, SIZE_MAX, count, error)) {
+	  return false;
+	}
+	pipeline_depth = size_t(count);
+  } else if (key == "drain_timeout") {
+	if (!read_count(value, 0, UINT32_MAX, count, error)) {
+	  return false;
+	}
+	drain_timeout = unsigned(count);
+  } else if (key == "idle_timeout") {
+	if (!read_count(value, 0, UINT32_MAX, count, error)) {
+	  return false;
+	}
+	idle_timeout = unsigned(count);
+  } else if (key == "admin_path") {
+	if (!value.empty() && value[0] != '/') {
+	  error = "admin_path must start with '/'";
+	  return false;
+	}
+	admin_path = value;
+  } else {
+	error = "unknown setting \"" + key + "\"";
+	return false;
+  }
+  return true;
+}
+
+bool ServerConfig::load(const std::string& path, std::string& error)
+{
+  std::ifstream file(path);
+  if (!file) {
+	error = "cannot open " + path;
+	return false;
+  }
+  std::string line;
+  unsigned number = 0;
+  while (std::getline(file, line)) {
+	number++;
+	line = trim(line);
+	if (line.empty() || line[0] == '#') {
+	  continue;
+	}
+	size_t equals = line.find('=');
+	std::string problem;
+	if (equals == std::string::npos) {
+	  problem = "expected key = value";
+	} else if (set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)), problem)) {
+	  continue;
+	}
+	error = path + ":" + std::to_string(number) + ": " + problem;
+	return false;
+  }
+  if (file.bad()) {
+	error = "error reading " + path;
+	return false;
+  }
+  return true;
+}
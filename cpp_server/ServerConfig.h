@@ -0,0 +1,53 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "Http2Session.h"
+#include "RateLimiter.h"
+#include "SendScheduler.h"
+#include "ZipArchive.h"
+
+// Settings that can change while the server runs; the server publishes them
+// through an RcuPointer.
+//
+// A configuration file holds one "key = value" per line; empty lines and lines
+// starting with '#' are skipped. Keys are named like the command line options
+// (root, rate_limit_rps, send_quantum, pipeline_depth, ...); "mime.<extension>"
+// sets the Content-Type for files ending in .<extension>.
+struct ServerConfig {
+  // A directory, or a ZIP archive to serve the entries of
+  std::string root = ".";
+  // Loaded from root when it is a file
+  std::shared_ptr<const ZipArchive> archive;
+  // Only the rates are applied to a running limiter; its table size stays
+  RateLimiter::config rate_limits;
+  SendScheduler::config send;
+  // For sessions started afterwards
+  Http2Session::settings http2;
+  size_t pipeline_depth = 16;
+  // bytes of file contents kept in memory, and the largest file kept
+  size_t cache_size = 64 << 20;
+  size_t cache_max_file = 1 << 20;
+  // seconds
+  unsigned drain_timeout = 30;
+  // seconds a connection may go without traffic, 0 keeps it open
+  unsigned idle_timeout = 0;
+  // extension (with the dot) to Content-Type, ahead of the MIME mapper; looked up
+  // by string_view
+  std::map<std::string, std::string, std::less<>> mime_types;
+  // From a loopback address, a POST to this path reloads the configuration and a GET
+  // returns counters; empty disables it
+  std::string admin_path;
+
+  // Reads the file over the current values. Returns false with a message naming
+  // the first bad line; the values are then partly updated.
+  bool load(const std::string& path, std::string& error);
+private:
+  bool set(const std::string& key, const std::string& value, std::string& error);
+};
+
+#endif // SERVER_CONFIG_H
@@ -0,0 +1,209 @@
+#include "ServerPolicies.h"
+#include <algorithm>
+#include "ContentHasher.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#endif
+#endif
+
+const size_t FILE_CHUNK_SIZE = 64 << 10;
+
+long long SocketIo::send(SOCKET sock, const char* data, size_t size, bool more)
+{
+  int flags = 0;
+#ifdef MSG_MORE
+  if (more) {
+	flags = MSG_MORE;
+  }
+#endif
+  return ::send(sock, data, int(size), flags);
+}
+
+#ifdef _WIN32
+long long SocketIo::send_buffers(SOCKET sock, buffer* buffers, size_t count, bool more)
+{
+  DWORD sent;
+  if (WSASend(sock, buffers, DWORD(count), &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+	return SOCKET_ERROR;
+  }
+  return sent;
+}
+#else
+long long SocketIo::send_buffers(SOCKET sock, buffer* buffers, size_t count, bool more)
+{
+  msghdr message = {};
+  message.msg_iov = buffers;
+  message.msg_iovlen = count;
+  int flags = 0;
+#ifdef MSG_MORE
+  if (more) {
+	flags = MSG_MORE;
+  }
+#endif
+  return sendmsg(sock, &message, flags);
+}
+#endif
+
+long long SocketIo::send_file(SOCKET sock, int fd, uint64_t& offset, size_t count)
+{
+#ifdef __linux__
+  off_t off = off_t(offset);
+  ssize_t sent = sendfile(sock, fd, &off, count);
+  if (sent > 0) {
+	offset = uint64_t(off);
+  }
+  return sent;
+#else
+  char buf[FILE_CHUNK_SIZE];
+  count = std::min(count, sizeof(buf));
+#ifdef _WIN32
+  if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+	return SOCKET_ERROR;
+  }
+  int got = _read(fd, buf, unsigned(count));
+#else
+  ssize_t got = pread(fd, buf, count, off_t(offset));
+#endif
+  if (got <= 0) {
+	return SOCKET_ERROR;
+  }
+  int sent = ::send(sock, buf, int(got), 0);
+  if (sent > 0) {
+	offset += sent;
+  }
+  return sent;
+#endif
+}
+
+#ifdef __linux__
+long long SocketIo::splice_in(int pipe, int fd, uint64_t offset, size_t count)
+{
+  loff_t off = loff_t(offset);
+  return splice(fd, &off, pipe, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+long long SocketIo::splice_out(SOCKET sock, int pipe, size_t count, bool more)
+{
+  return splice(pipe, nullptr, sock, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (more ? SPLICE_F_MORE : 0));
+}
+#else
+long long SocketIo::splice_in(int, int, uint64_t, size_t)
+{
+  return SOCKET_ERROR;
+}
+
+long long SocketIo::splice_out(SOCKET, int, size_t, bool)
+{
+  return SOCKET_ERROR;
+}
+#endif
+
+#if defined(__linux__) && defined(TCP_CORK)
+void SocketIo::cork(SOCKET sock, bool on)
+{
+  int corked = on ? 1 : 0;
+  setsockopt(sock, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+}
+#else
+void SocketIo::cork(SOCKET, bool)
+{
+}
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+bool SocketIo::enable_zerocopy(SOCKET sock)
+{
+  int enabled = 1;
+  return setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &enabled, sizeof(enabled)) == 0;
+}
+
+long long SocketIo::send_zerocopy(SOCKET sock, const char* data, size_t size, bool more)
+{
+  return ::send(sock, data, size, MSG_ZEROCOPY | (more ? MSG_MORE : 0));
+}
+
+bool SocketIo::zerocopy_completion(SOCKET sock, uint32_t& first, uint32_t& last, bool& copied)
+{
+  char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage))];
+  msghdr message = {};
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  while (recvmsg(sock, &message, MSG_ERRQUEUE) != -1) {
+	for (cmsghdr* c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+	  if (!(c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) &&
+		!(c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+		continue;
+	  }
+	  const sock_extended_err* e = (const sock_extended_err*)CMSG_DATA(c);
+	  if (e->ee_errno == 0 && e->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+		first = e->ee_info;
+		last = e->ee_data;
+		copied = (e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+		return true;
+	  }
+	}
+	// Not a zerocopy report
+	message.msg_controllen = sizeof(control);
+  }
+  return false;
+}
+#else
+bool SocketIo::enable_zerocopy(SOCKET)
+{
+  return false;
+}
+
+long long SocketIo::send_zerocopy(SOCKET sock, const char* data, size_t size, bool more)
+{
+  return send(sock, data, size, more);
+}
+
+bool SocketIo::zerocopy_completion(SOCKET, uint32_t&, uint32_t&, bool&)
+{
+  return false;
+}
+#endif
+
+bool NoCache::open(const std::pmr::string& path, Resource& resource) const
+{
+#ifdef _WIN32
+  int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+  struct _stat64 st;
+  if (fd != -1 && (_fstat64(fd, &st) != 0 || (st.st_mode & _S_IFMT) != _S_IFREG)) {
+	_close(fd);
+	fd = -1;
+  }
+#else
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd != -1 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+	close(fd);
+	fd = -1;
+  }
+#endif
+  if (fd == -1) {
+	return false;
+  }
+  resource.file = fd;
+  resource.size = uint64_t(st.st_size);
+  char etag[ContentHasher::metadata_etag_size];
+#ifdef _WIN32
+  resource.etag = ContentHasher::metadata_etag(0, resource.size, int64_t(st.st_mtime), etag);
+#elif defined(__linux__)
+  resource.etag = ContentHasher::metadata_etag(uint64_t(st.st_ino), resource.size,
+	int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, etag);
+#else
+  resource.etag = ContentHasher::metadata_etag(uint64_t(st.st_ino), resource.size, int64_t(st.st_mtime), etag);
+#endif
+  return true;
+}
@@ -0,0 +1,105 @@
+#ifndef SERVER_POLICIES_H
+#define SERVER_POLICIES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include "Resource.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define SHUT_WR SD_SEND
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <cstring>
+#define closesocket close
+#define SOCKET_ERROR -1
+#define INVALID_SOCKET -1
+typedef int SOCKET;
+#endif
+
+// The policies BasicFileServer is specialized with. They are plain classes
+// resolved at compile time, so their calls bind statically and can be inlined.
+
+// IoEngine: how bytes move between sockets, files and buffers. Each call returns
+// the number of bytes moved or SOCKET_ERROR, leaving the reason in errno
+// (WSAGetLastError() on Windows).
+struct SocketIo {
+#ifdef _WIN32
+  typedef WSABUF buffer;
+  static buffer make_buffer(const char* data, size_t size) {
+	buffer b;
+	b.buf = (CHAR*)data;
+	b.len = ULONG(size);
+	return b;
+  }
+#else
+  typedef iovec buffer;
+  static buffer make_buffer(const char* data, size_t size) {
+	return iovec{ const_cast<char*>(data), size };
+  }
+#endif
+  static long long receive(SOCKET sock, char* buf, size_t size) {
+	return recv(sock, buf, int(size), 0);
+  }
+  // more: further data follows right away, so the kernel may hold a partial segment for it
+  static long long send(SOCKET sock, const char* data, size_t size, bool more);
+  static long long send_buffers(SOCKET sock, buffer* buffers, size_t count, bool more);
+  // Sends up to count bytes of the file starting at offset, advancing it
+  static long long send_file(SOCKET sock, int fd, uint64_t& offset, size_t count);
+  // Move up to count bytes of the file starting at offset into a pipe, and from a
+  // pipe into the socket, by reference to their pages (Linux only)
+  static long long splice_in(int pipe, int fd, uint64_t offset, size_t count);
+  static long long splice_out(SOCKET sock, int pipe, size_t count, bool more);
+  // While corked, the socket sends full segments only; uncorking sends what it holds
+  // (Linux only)
+  static void cork(SOCKET sock, bool on);
+  // MSG_ZEROCOPY (Linux only): the socket takes the pages of what is sent instead of
+  // a copy, so they must not change until it reports on its error queue that it is
+  // done with them
+  static bool enable_zerocopy(SOCKET sock);
+  static long long send_zerocopy(SOCKET sock, const char* data, size_t size, bool more);
+  // Takes a report off the error queue, if there is one: the zerocopy sends first to
+  // last, numbered from 0 in the order they were made, are done with, and copied
+  // tells whether the kernel copied them after all
+  static bool zerocopy_completion(SOCKET sock, uint32_t& first, uint32_t& last, bool& copied);
+};
+
+// CachePolicy: where the body of a resource comes from
+struct NoCache {
+  // Opens path if it is a regular file, setting the file, size and metadata ETag of the resource
+  bool open(const std::pmr::string& path, Resource& resource) const;
+  // Like open, for a cache that may have other requests wait for a file it is
+  // loading; nothing is ever pending here
+  bool try_open(const std::pmr::string& path, Resource& resource, bool& pending, const std::function<void()>&) const {
+	pending = false;
+	return open(path, resource);
+  }
+  // Limits in bytes
+  void configure(size_t, size_t) {}
+  // Keeps cached contents from being paged out
+  void lock_memory(bool) {}
+  // Where cached contents are allocated
+  void set_memory(std::pmr::memory_resource*) {}
+  // Counters as "name value" lines
+  void report(std::ostream&) const {}
+};
+
+// Logger: streams for progress and for errors
+struct StreamLogger {
+  static std::ostream& info() { return std::cout; }
+  static std::ostream& error() { return std::cerr; }
+};
+
+#endif // SERVER_POLICIES_H
@@ -0,0 +1,54 @@
+#include "SocketOptions.h"
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+static bool set_option(SOCKET sock, int level, int name, int value)
+{
+  return setsockopt(sock, level, name, (const char*)&value, sizeof(value)) == 0;
+}
+
+static bool is_tcp(int family)
+{
+  return family == AF_INET || family == AF_INET6;
+}
+
+const char* SocketOptions::apply_to_listener(SOCKET sock, int family) const
+{
+  const char* failed = nullptr;
+  // Buffers must be sized before listen() for the window scale of the handshake to allow them
+  if (send_buffer > 0 && !set_option(sock, SOL_SOCKET, SO_SNDBUF, send_buffer)) {
+	failed = "SO_SNDBUF";
+  }
+  if (receive_buffer > 0 && !set_option(sock, SOL_SOCKET, SO_RCVBUF, receive_buffer)) {
+	failed = "SO_RCVBUF";
+  }
+  if (!is_tcp(family)) {
+	return failed;
+  }
+#ifdef SO_BUSY_POLL
+  if (busy_poll > 0 && !set_option(sock, SOL_SOCKET, SO_BUSY_POLL, busy_poll)) {
+	failed = "SO_BUSY_POLL";
+  }
+#endif
+#if defined(__linux__) && defined(TCP_DEFER_ACCEPT)
+  if (defer_accept > 0 && !set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept)) {
+	failed = "TCP_DEFER_ACCEPT";
+  }
+#endif
+#if defined(__linux__) && defined(TCP_FASTOPEN)
+  if (fastopen_queue > 0 && !set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, fastopen_queue)) {
+	failed = "TCP_FASTOPEN";
+  }
+#endif
+  return failed;
+}
+
+const char* SocketOptions::apply_to_connection(SOCKET sock, int family) const
+{
+  if (nodelay && is_tcp(family) && !set_option(sock, IPPROTO_TCP, TCP_NODELAY, 1)) {
+	return "TCP_NODELAY";
+  }
+  return nullptr;
+}
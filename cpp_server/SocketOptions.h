@@ -0,0 +1,43 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include "ServerPolicies.h"
+
+// How the TCP sockets of the server are tuned for latency.
+//
+// Most options are set on the listening sockets, whose connections inherit them,
+// so an accepted connection costs no more system calls than it did; only Nagle is
+// switched off on each. Options the platform lacks are ignored (the TCP ones are
+// Linux only), as are those of TCP on Unix sockets, and one the kernel refuses is
+// reported by name and skipped, the others still being set.
+struct SocketOptions {
+  // Connections are only accepted once their request arrives, for up to this many
+  // seconds after the handshake; 0 accepts them on the handshake
+  int defer_accept = 0;
+  // TCP Fast Open: requests may come in the SYN of clients that have a cookie, up to
+  // this many handshakes pending at once; 0 disables
+  int fastopen_queue = 0;
+  // Small writes go out at once rather than waiting for the ACK of the last. Writes
+  // are batched already (gathered pipelined responses, HTTP/2 frames), so Nagle
+  // would only hold the last small segment of a batch back until the peer's ACK
+  bool nodelay = true;
+  // Partial segments are held back while a connection writes, and go out when it
+  // has written all it could, rather than after each response head or frame that
+  // is not followed by more data right away
+  bool cork = false;
+  // Microseconds a read or a wait spins on the device queue of a connection before
+  // sleeping; 0 disables. Needs CAP_NET_ADMIN to raise past net.core.busy_read.
+  int busy_poll = 0;
+  // Kernel buffer sizes in bytes; 0 leaves them to autotuning, which a size set here
+  // turns off
+  int send_buffer = 0;
+  int receive_buffer = 0;
+
+  // Sets what concerns a listening socket between bind and listen; returns the name
+  // of the last option refused, with errno telling why, or null
+  const char* apply_to_listener(SOCKET sock, int family) const;
+  // Sets what concerns an accepted socket; as above
+  const char* apply_to_connection(SOCKET sock, int family) const;
+};
+
+#endif // SOCKET_OPTIONS_H
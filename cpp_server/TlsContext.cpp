@@ -0,0 +1,262 @@
+#include "TlsContext.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef WITH_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+const size_t TLS_CHUNK_SIZE = 16 << 10;
+
+TlsContext::error::error(const std::string& message) : std::runtime_error("TLS: " + message)
+{
+}
+
+#ifdef WITH_OPENSSL
+
+static std::string openssl_error() {
+  char buf[256];
+  unsigned long code = ERR_get_error();
+  if (code == 0) {
+	return "unknown error";
+  }
+  ERR_error_string_n(code, buf, sizeof(buf));
+  ERR_clear_error();
+  return buf;
+}
+
+static long long read_file_at(int fd, char* buf, size_t count, uint64_t offset) {
+#ifdef _WIN32
+  if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+	return -1;
+  }
+  return _read(fd, buf, unsigned(count));
+#else
+  return pread(fd, buf, count, off_t(offset));
+#endif
+}
+
+TlsContext::TlsContext(const std::string& certificate_file, const std::string& key_file, bool enable_ktls)
+{
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == nullptr) {
+	throw error("cannot create context: " + openssl_error());
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+  uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION;
+#ifdef SSL_OP_ENABLE_KTLS
+  if (enable_ktls) {
+	options |= SSL_OP_ENABLE_KTLS;
+  }
+#endif
+  SSL_CTX_set_options(ctx, options);
+
+  // Resumption: stateless tickets (encrypted with a key generated per context) for
+  // TLS 1.3 and 1.2, plus the server-side session cache for clients without tickets.
+  static const unsigned char session_id_context[] = "cpp_server";
+  SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_set_num_tickets(ctx, 2);
+
+  SSL_CTX_set_alpn_select_cb(ctx, select_protocol, this);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, certificate_file.c_str()) != 1) {
+	std::string message = openssl_error();
+	SSL_CTX_free(ctx);
+	throw error("cannot load certificate " + certificate_file + ": " + message);
+  }
+  if (SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+	std::string message = openssl_error();
+	SSL_CTX_free(ctx);
+	throw error("cannot load private key " + key_file + ": " + message);
+  }
+}
+
+TlsContext::~TlsContext()
+{
+  SSL_CTX_free(ctx);
+}
+
+int TlsContext::select_protocol(SSL*, const unsigned char** out, unsigned char* out_length,
+  const unsigned char* in, unsigned int in_length, void* arg)
+{
+  // Our preference wins over the client's order
+  static const unsigned char h2[] = "\x02h2";
+  static const unsigned char http11[] = "\x08http/1.1";
+  const TlsContext* context = static_cast<const TlsContext*>(arg);
+  unsigned char* selected;
+  if (context->http2 && SSL_select_next_proto(&selected, out_length, h2, sizeof(h2) - 1, in, in_length) == OPENSSL_NPN_NEGOTIATED) {
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+  }
+  if (SSL_select_next_proto(&selected, out_length, http11, sizeof(http11) - 1, in, in_length) == OPENSSL_NPN_NEGOTIATED) {
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+  }
+  return SSL_TLSEXT_ERR_NOACK;
+}
+
+TlsSession* TlsContext::create_session(intptr_t socket) const
+{
+  SSL* ssl = SSL_new(ctx);
+  if (ssl == nullptr) {
+	return nullptr;
+  }
+  if (SSL_set_fd(ssl, int(socket)) != 1) {
+	SSL_free(ssl);
+	return nullptr;
+  }
+  SSL_set_accept_state(ssl);
+  return new TlsSession(ssl);
+}
+
+TlsSession::~TlsSession()
+{
+  if (SSL_is_init_finished(ssl)) {
+	// Best effort close_notify; the socket is non-blocking and about to be closed
+	SSL_shutdown(ssl);
+  }
+  SSL_free(ssl);
+}
+
+long long TlsSession::result(int ret)
+{
+  if (ret > 0) {
+	want_write = false;
+	return ret;
+  }
+  switch (SSL_get_error(ssl, ret)) {
+  case SSL_ERROR_WANT_READ:
+	want_write = false;
+	return 0;
+  case SSL_ERROR_WANT_WRITE:
+	want_write = true;
+	return 0;
+  default:
+	ERR_clear_error();
+	return -1;
+  }
+}
+
+int TlsSession::handshake()
+{
+  int ret = SSL_do_handshake(ssl);
+  if (ret == 1) {
+	want_write = false;
+#ifndef OPENSSL_NO_KTLS
+	ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+#endif
+	return 1;
+  }
+  return result(ret) < 0 ? -1 : 0;
+}
+
+long long TlsSession::read(char* buf, size_t size)
+{
+  return result(SSL_read(ssl, buf, int(std::min<size_t>(size, INT32_MAX))));
+}
+
+long long TlsSession::write(const char* buf, size_t size)
+{
+  if (retry_length != 0) {
+	size = retry_length;
+  }
+  long long written = result(SSL_write(ssl, buf, int(std::min<size_t>(size, INT32_MAX))));
+  retry_length = written == 0 ? size : 0;
+  return written;
+}
+
+long long TlsSession::send_file(int fd, uint64_t offset, size_t count)
+{
+#ifndef OPENSSL_NO_KTLS
+  if (ktls_send) {
+	ossl_ssize_t sent = SSL_sendfile(ssl, fd, off_t(offset), count, 0);
+	return sent >= 0 ? sent : result(int(sent));
+  }
+#endif
+  // Userspace encryption: keep the chunk until SSL_write has taken it
+  if (retry_length == 0) {
+	chunk.resize(TLS_CHUNK_SIZE);
+	long long got = read_file_at(fd, chunk.data(), std::min(count, chunk.size()), offset);
+	if (got <= 0) {
+	  return -1;
+	}
+	count = size_t(got);
+  }
+  return write(chunk.data(), count);
+}
+
+std::string TlsSession::protocol() const
+{
+  return SSL_get_version(ssl);
+}
+
+std::string TlsSession::alpn() const
+{
+  const unsigned char* data;
+  unsigned int length;
+  SSL_get0_alpn_selected(ssl, &data, &length);
+  if (data == nullptr) {
+	return "";
+  }
+  return std::string(reinterpret_cast<const char*>(data), length);
+}
+
+#else
+
+TlsContext::TlsContext(const std::string&, const std::string&, bool)
+{
+  throw error("this build has no TLS support, rebuild with WITH_OPENSSL");
+}
+
+TlsContext::~TlsContext()
+{
+}
+
+TlsSession* TlsContext::create_session(intptr_t) const
+{
+  return nullptr;
+}
+
+TlsSession::~TlsSession()
+{
+}
+
+int TlsSession::handshake()
+{
+  return -1;
+}
+
+long long TlsSession::read(char*, size_t)
+{
+  return -1;
+}
+
+long long TlsSession::write(const char*, size_t)
+{
+  return -1;
+}
+
+long long TlsSession::send_file(int, uint64_t, size_t)
+{
+  return -1;
+}
+
+std::string TlsSession::protocol() const
+{
+  return "";
+}
+
+std::string TlsSession::alpn() const
+{
+  return "";
+}
+
+#endif // WITH_OPENSSL
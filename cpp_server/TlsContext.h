@@ -0,0 +1,76 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// TLS termination on top of OpenSSL. Build with WITH_OPENSSL defined and link
+// libssl/libcrypto; without it, creating a TlsContext throws.
+//
+// When the kernel and OpenSSL support it, kernel TLS is switched on after the
+// handshake, so file bodies keep going out with sendfile and are encrypted by the
+// kernel. Otherwise records are encrypted in userspace from a per-session buffer.
+//
+// ALPN offers h2 ahead of http/1.1 unless HTTP/2 is switched off.
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+class TlsSession;
+
+class TlsContext {
+private:
+  SSL_CTX* ctx = nullptr;
+  bool http2 = true;
+#ifdef WITH_OPENSSL
+  static int select_protocol(SSL* ssl, const unsigned char** out, unsigned char* out_length,
+	const unsigned char* in, unsigned int in_length, void* arg);
+#endif
+public:
+  class error : public std::runtime_error {
+  public:
+	explicit error(const std::string& message);
+  };
+  TlsContext(const std::string& certificate_file, const std::string& key_file, bool enable_ktls = true);
+  TlsContext(const TlsContext&) = delete;
+  TlsContext& operator=(const TlsContext&) = delete;
+  ~TlsContext();
+  // Starts a server-side session on a connected, non-blocking socket
+  TlsSession* create_session(intptr_t socket) const;
+  void set_http2(bool enabled) { http2 = enabled; }
+};
+
+class TlsSession {
+private:
+  friend TlsContext;
+  SSL* ssl;
+  bool want_write = false;
+  bool ktls_send = false;
+  // SSL_write must be retried with the same data after it would block
+  size_t retry_length = 0;
+  std::vector<char> chunk;
+  explicit TlsSession(SSL* ssl) : ssl(ssl) {}
+  long long result(int ret);
+public:
+  TlsSession(const TlsSession&) = delete;
+  TlsSession& operator=(const TlsSession&) = delete;
+  ~TlsSession();
+  // Returns 1 once the handshake is complete, 0 while it needs more I/O, -1 on failure
+  int handshake();
+  // The following return the number of bytes transferred, 0 if the operation
+  // would block (see wants_write) and -1 on error or close.
+  long long read(char* buf, size_t size);
+  long long write(const char* buf, size_t size);
+  long long send_file(int fd, uint64_t offset, size_t count);
+  // Whether the last operation that would block waits for the socket to become writable
+  bool wants_write() const { return want_write; }
+  bool kernel_tls() const { return ktls_send; }
+  std::string protocol() const;
+  // Protocol picked by ALPN, empty if the client sent none
+  std::string alpn() const;
+};
+
+#endif // TLS_CONTEXT_H
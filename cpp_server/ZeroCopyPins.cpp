@@ -0,0 +1,34 @@
+#include "ZeroCopyPins.h"
+
+void ZeroCopyPins::sent(const std::shared_ptr<const char>& body)
+{
+  // Consecutive sends of a body share its pin
+  if (!pins.empty() && pins.back().body.get() == body.get()) {
+	pins.back().last = next;
+  } else {
+	pins.push_back(pin{ body, next });
+  }
+  next++;
+}
+
+void ZeroCopyPins::complete(uint32_t first, uint32_t last)
+{
+  early.emplace_back(first, last);
+  for (size_t i = 0; i != early.size();) {
+	if (early[i].first != completed) {
+	  i++;
+	  continue;
+	}
+	// Extends what is complete, which may bring ranges looked at before into line
+	completed = early[i].second + 1;
+	early[i] = early.back();
+	early.pop_back();
+	i = 0;
+  }
+  // Numbers wrap around
+  size_t released = 0;
+  while (released != pins.size() && int32_t(pins[released].last - completed) < 0) {
+	released++;
+  }
+  pins.erase(pins.begin(), pins.begin() + released);
+}
@@ -0,0 +1,40 @@
+#ifndef ZERO_COPY_PINS_H
+#define ZERO_COPY_PINS_H
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Keeps the bodies that a socket's MSG_ZEROCOPY sends were made from alive until the
+// kernel is done with them: it sends straight from their pages, so they must be
+// neither freed nor reused, as a cache evicting them would, before it says so.
+//
+// Sends are numbered from 0 in the order they are made, as the kernel numbers
+// them, and a body is held until every send up to its last one is reported
+// complete. Reports are ranges of sends that usually come in order; one that does
+// not is kept until the gap before it is filled. Not thread-safe.
+class ZeroCopyPins {
+private:
+  struct pin {
+	std::shared_ptr<const char> body;
+	// Number of its last send
+	uint32_t last;
+  };
+  // Oldest first; few, since the sends of a body share a pin. Allocates nothing while empty.
+  std::vector<pin> pins;
+  uint32_t next = 0;
+  // Every send numbered below this is complete
+  uint32_t completed = 0;
+  // Completed ranges past a gap
+  std::vector<std::pair<uint32_t, uint32_t>> early;
+public:
+  // A send of part of body was made
+  void sent(const std::shared_ptr<const char>& body);
+  // Sends first to last are complete
+  void complete(uint32_t first, uint32_t last);
+  // Every send is complete, so no body is held
+  bool empty() const { return pins.empty(); }
+};
+
+#endif // ZERO_COPY_PINS_H
@@ -0,0 +1,305 @@
+#include "ZipArchive.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include "FileStream.h"
+#include "MappedFile.h"
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+static const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t END_SIGNATURE = 0x06054b50;
+static const uint32_t ZIP64_END_SIGNATURE = 0x06064b50;
+static const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+static const size_t LOCAL_HEADER_SIZE = 30;
+static const size_t CENTRAL_HEADER_SIZE = 46;
+static const size_t END_SIZE = 22;
+static const size_t ZIP64_END_SIZE = 56;
+static const size_t ZIP64_LOCATOR_SIZE = 20;
+static const uint16_t ZIP64_EXTRA_ID = 0x0001;
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATED = 8;
+static const uint16_t FLAG_ENCRYPTED = 1;
+static const size_t GZIP_HEADER_SIZE = 10;
+// Bytes of the body inflated at a time
+static const size_t INFLATE_WINDOW_SIZE = 64 << 10;
+
+// ZIP fields are little-endian whatever the host
+static uint64_t read_le(const char* p, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = bytes; i-- != 0;) {
+	value = value << 8 | uint8_t(p[i]);
+  }
+  return value;
+}
+
+static void write_le32(char* out, uint32_t value) {
+  for (int i = 0; i != 4; i++) {
+	out[i] = char(value >> (8 * i));
+  }
+}
+
+// The bytes at offset of a piece of size bytes, up to count; null past its end,
+// with offset then made relative to what follows
+static const char* piece(const char* data, uint64_t size, uint64_t& offset, size_t& count) {
+  if (offset >= size) {
+	offset -= size;
+	return nullptr;
+  }
+  count = size_t(std::min<uint64_t>(count, size - offset));
+  return data + offset;
+}
+
+// A deflate stream between a 10-byte header and a trailer holding the CRC-32 and
+// size of the contents
+class GzipMember : public BodyStream {
+private:
+  static const char header[GZIP_HEADER_SIZE];
+  std::shared_ptr<const char> mapping;
+  const char* deflated;
+  uint64_t deflated_size;
+  char trailer[8];
+public:
+  GzipMember(std::shared_ptr<const char> mapping, const char* deflated, uint64_t deflated_size, uint32_t crc, uint64_t size) :
+	mapping(std::move(mapping)), deflated(deflated), deflated_size(deflated_size) {
+	write_le32(trailer, crc);
+	write_le32(trailer + 4, uint32_t(size));
+  }
+  bool direct() const override { return true; }
+  const char* read(uint64_t offset, size_t& count) override {
+	const char* data = piece(header, sizeof(header), offset, count);
+	if (!data) {
+	  data = piece(deflated, deflated_size, offset, count);
+	}
+	if (!data) {
+	  data = piece(trailer, sizeof(trailer), offset, count);
+	}
+	return data;
+  }
+  void sent(uint64_t) override {}
+};
+
+const char GzipMember::header[GZIP_HEADER_SIZE] = { '\x1f', '\x8b', '\x08', 0, 0, 0, 0, 0, 0, '\xff' };
+
+#ifdef WITH_ZLIB
+// The contents of a deflated entry, inflated a window at a time as they are sent
+class InflatedEntry : public BodyStream {
+private:
+  std::shared_ptr<const char> mapping;
+  z_stream stream = {};
+  bool started = false;
+  bool ended = false;
+  uint64_t in_left;
+  uint64_t size;
+  std::unique_ptr<char[]> window;
+  // The body from start is in the window, for length bytes
+  uint64_t start = 0;
+  size_t length = 0;
+
+  // Replaces the window with what follows it; false if nothing does
+  bool inflate_window() {
+	start += length;
+	length = 0;
+	while (length != INFLATE_WINDOW_SIZE && !ended) {
+	  // zlib counts in uInt, so large entries go through in steps
+	  uInt in_step = uInt(std::min<uint64_t>(in_left, 1u << 30));
+	  stream.avail_in = in_step;
+	  stream.next_out = reinterpret_cast<Bytef*>(window.get() + length);
+	  stream.avail_out = uInt(INFLATE_WINDOW_SIZE - length);
+	  int result = inflate(&stream, Z_NO_FLUSH);
+	  in_left -= in_step - stream.avail_in;
+	  length = INFLATE_WINDOW_SIZE - stream.avail_out;
+	  if (result == Z_STREAM_END) {
+		ended = true;
+	  } else if (result != Z_OK) {
+		break;
+	  }
+	}
+	return length != 0;
+  }
+public:
+  InflatedEntry(std::shared_ptr<const char> mapping, const char* deflated, uint64_t deflated_size, uint64_t size) :
+	mapping(std::move(mapping)), in_left(deflated_size), size(size) {
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(deflated));
+  }
+  ~InflatedEntry() {
+	if (started) {
+	  inflateEnd(&stream);
+	}
+  }
+  // false if zlib cannot start
+  bool begin() {
+	// Negative window bits: raw deflate, without a zlib header
+	started = inflateInit2(&stream, -MAX_WBITS) == Z_OK;
+	if (started) {
+	  window.reset(new char[INFLATE_WINDOW_SIZE]);
+	}
+	return started;
+  }
+  bool direct() const override { return true; }
+  // Offsets only go forward, from within the window or right after it
+  const char* read(uint64_t offset, size_t& count) override {
+	if (offset < start || offset >= size || (offset >= start + length && (offset != start + length || !inflate_window()))) {
+	  return nullptr;
+	}
+	count = size_t(std::min<uint64_t>({ uint64_t(count), start + length - offset, size - offset }));
+	return window.get() + (offset - start);
+  }
+  void sent(uint64_t) override {}
+};
+#endif
+
+static bool within(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+bool ZipArchive::load(const std::string& path, std::string& error)
+{
+  uint64_t size;
+  std::shared_ptr<const char> mapped = map_file(path, size, error);
+  if (!mapped) {
+	return false;
+  }
+  const char* base = mapped.get();
+
+  // The end of central directory record is last, followed by a comment of up to 64 KiB
+  uint64_t end = size;
+  for (uint64_t i = size >= END_SIZE ? size - END_SIZE + 1 : 0; i-- != 0 && size - i <= END_SIZE + 0xffff;) {
+	if (read_le(base + i, 4) == END_SIGNATURE) {
+	  end = i;
+	  break;
+	}
+  }
+  if (end == size) {
+	error = path + " is not a ZIP archive";
+	return false;
+  }
+  uint64_t count = read_le(base + end + 10, 2);
+  uint64_t directory_size = read_le(base + end + 12, 4);
+  uint64_t directory_offset = read_le(base + end + 16, 4);
+  if (end >= ZIP64_LOCATOR_SIZE && read_le(base + end - ZIP64_LOCATOR_SIZE, 4) == ZIP64_LOCATOR_SIGNATURE) {
+	uint64_t zip64_end = read_le(base + end - ZIP64_LOCATOR_SIZE + 8, 8);
+	if (!within(zip64_end, ZIP64_END_SIZE, size) || read_le(base + zip64_end, 4) != ZIP64_END_SIGNATURE) {
+	  error = path + " has a damaged ZIP64 end record";
+	  return false;
+	}
+	count = read_le(base + zip64_end + 32, 8);
+	directory_size = read_le(base + zip64_end + 40, 8);
+	directory_offset = read_le(base + zip64_end + 48, 8);
+  }
+  if (!within(directory_offset, directory_size, size) || count > directory_size / CENTRAL_HEADER_SIZE) {
+	error = path + " has a damaged central directory";
+	return false;
+  }
+
+  std::unordered_map<std::pmr::string, entry> index;
+  index.reserve(size_t(count));
+  const char* p = base + directory_offset;
+  const char* directory_end = p + directory_size;
+  for (uint64_t i = 0; i != count; i++) {
+	if (directory_end - p < ptrdiff_t(CENTRAL_HEADER_SIZE) || read_le(p, 4) != CENTRAL_HEADER_SIGNATURE) {
+	  error = path + " has a damaged central directory";
+	  return false;
+	}
+	uint16_t flags = uint16_t(read_le(p + 8, 2));
+	uint16_t method = uint16_t(read_le(p + 10, 2));
+	entry e;
+	e.crc = uint32_t(read_le(p + 16, 4));
+	e.compressed_size = read_le(p + 20, 4);
+	e.size = read_le(p + 24, 4);
+	size_t name_size = size_t(read_le(p + 28, 2));
+	size_t extra_size = size_t(read_le(p + 30, 2));
+	size_t comment_size = size_t(read_le(p + 32, 2));
+	uint64_t local_offset = read_le(p + 42, 4);
+	const char* name = p + CENTRAL_HEADER_SIZE;
+	const char* next = name + name_size + extra_size + comment_size;
+	if (next > directory_end) {
+	  error = path + " has a damaged central directory";
+	  return false;
+	}
+	// Fields that overflow 32 bits are in the ZIP64 extra field, in this order
+	for (const char* extra = name + name_size; extra + 4 <= name + name_size + extra_size;) {
+	  size_t field_size = size_t(read_le(extra + 2, 2));
+	  const char* field = extra + 4;
+	  const char* field_end = field + field_size;
+	  if (read_le(extra, 2) == ZIP64_EXTRA_ID && field_end <= name + name_size + extra_size) {
+		for (uint64_t* value : { &e.size, &e.compressed_size, &local_offset }) {
+		  if (*value == 0xffffffff && field + 8 <= field_end) {
+			*value = read_le(field, 8);
+			field += 8;
+		  }
+		}
+	  }
+	  extra = field_end;
+	}
+	p = next;
+
+	bool directory = name_size != 0 && name[name_size - 1] == '/';
+	bool supported = (method == METHOD_STORED && e.compressed_size == e.size) || method == METHOD_DEFLATED;
+	if (directory || !supported || (flags & FLAG_ENCRYPTED)) {
+	  continue;
+	}
+	if (!within(local_offset, LOCAL_HEADER_SIZE, size) || read_le(base + local_offset, 4) != LOCAL_HEADER_SIGNATURE) {
+	  error = path + " has a damaged entry " + std::string(name, name_size);
+	  return false;
+	}
+	// The local header repeats the name, but its extra field may differ from the central one
+	e.offset = local_offset + LOCAL_HEADER_SIZE + read_le(base + local_offset + 26, 2) + read_le(base + local_offset + 28, 2);
+	if (!within(e.offset, e.compressed_size, size)) {
+	  error = path + " has a damaged entry " + std::string(name, name_size);
+	  return false;
+	}
+	e.deflated = method == METHOD_DEFLATED;
+	if (e.deflated) {
+	  e.member = std::make_shared<GzipMember>(mapped, base + e.offset, e.compressed_size, e.crc, e.size);
+	}
+	std::pmr::string key("/");
+	key.append(name, name_size);
+	index[std::move(key)] = e;
+  }
+  mapping = std::move(mapped);
+  entries = std::move(index);
+  return true;
+}
+
+int ZipArchive::open(const std::pmr::string& path, bool gzip, Resource& resource) const
+{
+  auto it = entries.find(path);
+  if (it == entries.end()) {
+	return 404;
+  }
+  const entry& e = it->second;
+  const char* data = mapping.get() + e.offset;
+  char etag[40];
+  snprintf(etag, sizeof(etag), "\"%08x-%llx\"", unsigned(e.crc), (unsigned long long)e.size);
+  resource.etag = etag;
+  if (!e.deflated) {
+	resource.data = std::shared_ptr<const char>(mapping, data);
+	resource.size = e.size;
+	return 200;
+  }
+
+  resource.varies = true;
+  if (gzip) {
+	resource.stream = e.member;
+	resource.size = GZIP_HEADER_SIZE + e.compressed_size + 8;
+	resource.content_encoding = "gzip";
+	snprintf(etag, sizeof(etag), "\"%08x-%llx-gz\"", unsigned(e.crc), (unsigned long long)e.size);
+	resource.etag = etag;
+	return 200;
+  }
+#ifdef WITH_ZLIB
+  auto inflated = std::make_shared<InflatedEntry>(mapping, data, e.compressed_size, e.size);
+  if (!inflated->begin()) {
+	return 500;
+  }
+  resource.stream = std::move(inflated);
+  resource.size = e.size;
+  return 200;
+#else
+  return 406;
+#endif
+}
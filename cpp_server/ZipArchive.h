@@ -0,0 +1,46 @@
+#ifndef ZIP_ARCHIVE_H
+#define ZIP_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include "Resource.h"
+
+// A ZIP archive served in place of a root directory.
+//
+// The archive is mapped whole and its central directory (ZIP64 included) read
+// into a hash table of "/name" -> entry, so a request costs one lookup. Stored
+// entries are served straight from the mapping. A deflated entry is sent to
+// clients accepting gzip as a gzip member: a header, its deflate stream from the
+// mapping and a trailer with the CRC-32 and size the archive records, sent as
+// they are, so nothing is recompressed or copied. Other clients get it inflated a
+// window at a time as it is sent when built with WITH_ZLIB defined (link zlib),
+// and a 406 otherwise. Directories, encrypted entries and other methods are left
+// out.
+class ZipArchive {
+private:
+  struct entry {
+	// of the entry's data in the archive
+	uint64_t offset;
+	uint64_t compressed_size;
+	uint64_t size;
+	uint32_t crc;
+	bool deflated;
+	// The gzip member of a deflated entry; it keeps no state, so it serves every response
+	std::shared_ptr<BodyStream> member;
+  };
+  std::shared_ptr<const char> mapping;
+  // Keyed like the paths requests come with, so that lookups need no conversion
+  std::unordered_map<std::pmr::string, entry> entries;
+public:
+  bool load(const std::string& path, std::string& error);
+  size_t size() const { return entries.size(); }
+  // 200 with the representation of the entry at path, such as "/dir/index.html",
+  // or the status to answer with instead: 404, 406, or 500 if it does not inflate
+  int open(const std::pmr::string& path, bool gzip, Resource& resource) const;
+};
+
+#endif // ZIP_ARCHIVE_H
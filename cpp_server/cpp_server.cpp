@@ -1,6 +1,7 @@
 #include "FileServer.h"
 #include "MimeMapper.h"
 #include "ArgParser.h"
+#include <algorithm>
 
 using namespace std;
 int main(int argc, char** argv) {
@@ -13,22 +14,221 @@ int main(int argc, char** argv) {
   }
 #endif
   int port = 3000;
+  vector<string> listen;
   string dir = ".";
+  int rate_limit_rps = 0;
+  int rate_limit_burst = 0;
+  int rate_limit_bps = 0;
+  int rate_limit_memory_mb = 16;
+  SendScheduler::config send_config;
+  int small_response_limit = int(send_config.small_response_limit);
+  int send_quantum = int(send_config.quantum);
+  int connection_rate = 0;
+  int egress_rate = 0;
+  string tls_cert;
+  string tls_key;
+  bool ktls = true;
+  bool http2 = true;
+  Http2Session::settings http2_settings;
+  int h2_max_streams = int(http2_settings.max_concurrent_streams);
+  int pipeline_depth = 16;
+  int cache_size_mb = 64;
+  int cache_max_file_kb = 1024;
+  int drain_timeout = 30;
+  string config_file;
+  string pack_output;
+  string bundle_file;
+  string etag_index;
+  int etag_threads = 1;
+  Preload::config preload;
+  int preload_top = 0;
+  int preload_threads = 0;
+  string huge_pages = "transparent";
+  int workers = 1;
+  bool pin_workers = false;
+  bool cache_per_node = false;
+  FileStream::config streaming;
+  int stream_threshold_mb = int(streaming.threshold >> 20);
+  int readahead_kb = int(streaming.window >> 10);
+  bool splice = false;
+  bool zerocopy = false;
+  int zerocopy_min_kb = 32;
+  SocketOptions socket_options;
+  int sndbuf_kb = 0;
+  int rcvbuf_kb = 0;
   try {
 	ArgParser arg_parser;
 	arg_parser.assign("-p", port);
 	arg_parser.assign("--port", port);
+	arg_parser.assign("--listen", listen);
 	arg_parser.assign("-d", dir);
 	arg_parser.assign("--dir", dir);
+	arg_parser.assign("--rate-limit-rps", rate_limit_rps);
+	arg_parser.assign("--rate-limit-burst", rate_limit_burst);
+	arg_parser.assign("--rate-limit-bps", rate_limit_bps);
+	arg_parser.assign("--rate-limit-memory-mb", rate_limit_memory_mb);
+	arg_parser.assign("--small-response-limit", small_response_limit);
+	arg_parser.assign("--send-quantum", send_quantum);
+	arg_parser.assign("--connection-rate", connection_rate);
+	arg_parser.assign("--egress-rate", egress_rate);
+	arg_parser.assign("--tls-cert", tls_cert);
+	arg_parser.assign("--tls-key", tls_key);
+	arg_parser.assignFlagDisabler("--no-ktls", ktls);
+	arg_parser.assignFlagDisabler("--no-http2", http2);
+	arg_parser.assign("--h2-max-streams", h2_max_streams);
+	arg_parser.assign("--pipeline-depth", pipeline_depth);
+	arg_parser.assign("--cache-size-mb", cache_size_mb);
+	arg_parser.assign("--cache-max-file-kb", cache_max_file_kb);
+	arg_parser.assign("--drain-timeout", drain_timeout);
+	arg_parser.assign("--config", config_file);
+	arg_parser.assign("--pack", pack_output);
+	arg_parser.assign("--bundle", bundle_file);
+	arg_parser.assign("--etag-index", etag_index);
+	arg_parser.assign("--etag-threads", etag_threads);
+	arg_parser.assign("--preload", preload.enabled);
+	arg_parser.assign("--preload-glob", preload.patterns);
+	arg_parser.assign("--preload-list", preload.list_path);
+	arg_parser.assign("--preload-top", preload_top);
+	arg_parser.assign("--preload-threads", preload_threads);
+	arg_parser.assign("--preload-mlock", preload.lock_memory);
+	arg_parser.assign("--huge-pages", huge_pages);
+	arg_parser.assign("--workers", workers);
+	arg_parser.assign("--pin-workers", pin_workers);
+	arg_parser.assign("--cache-per-node", cache_per_node);
+	arg_parser.assign("--stream-threshold-mb", stream_threshold_mb);
+	arg_parser.assign("--readahead-kb", readahead_kb);
+	arg_parser.assign("--direct-io", streaming.direct);
+	arg_parser.assign("--splice", splice);
+	arg_parser.assign("--zerocopy", zerocopy);
+	arg_parser.assign("--zerocopy-min-kb", zerocopy_min_kb);
+	arg_parser.assign("--defer-accept", socket_options.defer_accept);
+	arg_parser.assign("--fastopen", socket_options.fastopen_queue);
+	arg_parser.assignFlagDisabler("--no-nodelay", socket_options.nodelay);
+	arg_parser.assign("--cork", socket_options.cork);
+	arg_parser.assign("--busy-poll-us", socket_options.busy_poll);
+	arg_parser.assign("--sndbuf-kb", sndbuf_kb);
+	arg_parser.assign("--rcvbuf-kb", rcvbuf_kb);
 	arg_parser.parse(argc, argv);
 
-	cout << "port: " << port << "; dir: " << dir << endl;
+	// The listen addresses replace the port
+	if (listen.empty()) {
+	  cout << "port: " << port;
+	} else {
+	  cout << "listen:";
+	  for (const string& spec : listen) {
+		cout << ' ' << spec;
+	  }
+	}
+	cout << "; dir: " << dir << endl;
   }
   catch (ArgParser::parse_error e) {
 	cerr << e.what() << endl;
 	return 1;
   }
+  if (huge_pages == "off") {
+	HugePageHeap::configure(HugePageHeap::off);
+  } else if (huge_pages == "explicit") {
+	HugePageHeap::configure(HugePageHeap::explicit_pages);
+  } else if (huge_pages != "transparent") {
+	cerr << "--huge-pages must be off, transparent or explicit" << endl;
+	return 1;
+  }
+  if (!pack_output.empty()) {
+	// Pack mode: write the bundle of --dir and exit
+	std::unique_ptr<MimeMapper> mime_mapper(MimeMapper::createDefault());
+	string error;
+	if (!AssetBundle::pack(dir, pack_output, *mime_mapper, error)) {
+	  cerr << error << endl;
+	  return 1;
+	}
+	cout << "bundle written to " << pack_output << endl;
+	return 0;
+  }
   FileServer server(port, dir);
+  if (!listen.empty()) {
+	// Replace the port: [::]:80, 127.0.0.1:8080, unix:/run/fs.sock
+	vector<ListenAddress> addresses;
+	for (const string& spec : listen) {
+	  ListenAddress address;
+	  string error;
+	  if (!ListenAddress::parse(spec, address, error)) {
+		cerr << error << endl;
+		return 1;
+	  }
+	  addresses.push_back(address);
+	}
+	server.set_listen_addresses(addresses);
+  }
+  if (!bundle_file.empty()) {
+	AssetBundle* bundle = new AssetBundle();
+	string error;
+	if (!bundle->load(bundle_file, error)) {
+	  delete bundle;
+	  cerr << error << endl;
+	  return 1;
+	}
+	cout << "serving " << bundle->size() << " files from " << bundle_file << endl;
+	server.set_bundle(bundle);
+  }
+  send_config.small_response_limit = size_t(std::max(small_response_limit, 0));
+  send_config.quantum = size_t(std::max(send_quantum, 1));
+  send_config.connection_rate = connection_rate;
+  send_config.global_rate = egress_rate;
+  server.set_send_config(send_config);
+  http2_settings.max_concurrent_streams = uint32_t(std::max(h2_max_streams, 1));
+  server.set_http2(http2, http2_settings);
+  server.set_pipeline_depth(size_t(std::max(pipeline_depth, 1)));
+  server.set_workers(unsigned(std::max(workers, 1)), pin_workers, pin_workers && cache_per_node);
+  server.set_cache(size_t(std::max(cache_size_mb, 0)) << 20, size_t(std::max(cache_max_file_kb, 0)) << 10);
+  streaming.threshold = uint64_t(std::max(stream_threshold_mb, 0)) << 20;
+  streaming.window = size_t(std::max(readahead_kb, 0)) << 10;
+  server.set_streaming(streaming);
+  server.set_splice(splice);
+  if (zerocopy) {
+	server.set_zerocopy(size_t(std::max(zerocopy_min_kb, 1)) << 10);
+  }
+  socket_options.send_buffer = std::max(sndbuf_kb, 0) << 10;
+  socket_options.receive_buffer = std::max(rcvbuf_kb, 0) << 10;
+  server.set_socket_options(socket_options);
+  // A hot upgrade starts the program again with the same arguments
+  server.set_hot_upgrade(vector<string>(argv, argv + argc), unsigned(std::max(drain_timeout, 0)));
+  if (!config_file.empty()) {
+	server.set_config_file(config_file);
+	cout << "config: " << config_file << endl;
+  }
+  if (preload.enabled) {
+	preload.top = size_t(std::max(preload_top, 0));
+	preload.threads = unsigned(std::max(preload_threads, 0));
+	server.set_preload(preload);
+  }
+  if (!etag_index.empty()) {
+	// Content hashes become the ETags of files, kept in the index across restarts
+	ContentHasher* hasher = new ContentHasher(etag_index, unsigned(std::max(etag_threads, 1)));
+	cout << "content ETags: " << hasher->size() << " files in " << etag_index << endl;
+	server.set_content_hasher(hasher);
+  }
+  if (!tls_cert.empty() || !tls_key.empty()) {
+	try {
+	  TlsContext* context = new TlsContext(tls_cert, tls_key.empty() ? tls_cert : tls_key, ktls);
+	  context->set_http2(http2);
+	  server.set_tls_context(context);
+	}
+	catch (const TlsContext::error& e) {
+	  cerr << e.what() << endl;
+	  return 1;
+	}
+	cout << "TLS enabled" << (ktls ? ", kernel TLS when available" : "") << endl;
+  }
+  if (rate_limit_rps > 0 || rate_limit_bps > 0) {
+	RateLimiter::config limits;
+	limits.requests_per_second = rate_limit_rps;
+	limits.request_burst = rate_limit_burst;
+	limits.bytes_per_second = rate_limit_bps;
+	limits.memory_limit = size_t(rate_limit_memory_mb) << 20;
+	RateLimiter* limiter = new RateLimiter(limits);
+	cout << "rate limiting " << limiter->capacity() << " client addresses" << endl;
+	server.set_rate_limiter(limiter);
+  }
   server.run();
 #ifdef _WIN32
   WSACleanup();
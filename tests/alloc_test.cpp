@@ -0,0 +1,188 @@
+// Checks that warm GETs do not touch the global allocator: operator new is
+// replaced by one that counts, the server runs on a thread of this process, and
+// after a few requests have warmed the cache, the content ETags and the pools, a
+// run of keep-alive GETs must not allocate at all.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o alloc_test tests/alloc_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp)
+//   ./alloc_test [requests] [port]
+// Exits with 0 when no request allocated.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include "FileServer.h"
+
+static std::atomic<unsigned long long> allocations(0);
+
+// GCC takes the free() of the replacement delete for one of memory from new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+	return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+static const char* const FILES[][2] = {
+  { "index.html", "<!doctype html><title>alloc test</title>\n" },
+  { "style.css", "body { margin: 0 }\n" },
+  { "app.js", "console.log('alloc test');\n" },
+};
+static const size_t FILE_COUNT = sizeof(FILES) / sizeof(FILES[0]);
+// Targets requested in turn; the last is not found
+static const char* const TARGETS[] = { "/", "/style.css", "/app.js", "/missing.txt" };
+static const size_t TARGET_COUNT = sizeof(TARGETS) / sizeof(TARGETS[0]);
+
+static char response[1 << 16];
+
+// Sends a GET for target and reads its response; returns the status, or -1
+static int get(SOCKET sock, const char* target)
+{
+  char request[256];
+  int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n\r\n", target);
+  if (send(sock, request, length, 0) != length) {
+	return -1;
+  }
+  size_t received = 0;
+  const char* end = nullptr;
+  while (!end) {
+	ssize_t got = recv(sock, response + received, sizeof(response) - 1 - received, 0);
+	if (got <= 0) {
+	  return -1;
+	}
+	received += size_t(got);
+	response[received] = '\0';
+	end = strstr(response, "\r\n\r\n");
+  }
+  const char* field = strstr(response, "Content-Length: ");
+  size_t body = field ? size_t(strtoul(field + 16, nullptr, 10)) : 0;
+  size_t total = size_t(end + 4 - response) + body;
+  while (received < total) {
+	ssize_t got = recv(sock, response + received, std::min(sizeof(response) - 1, total) - received, 0);
+	if (got <= 0) {
+	  return -1;
+	}
+	received += size_t(got);
+  }
+  return atoi(response + 9);
+}
+
+int main(int argc, char** argv)
+{
+  int requests = argc > 1 ? atoi(argv[1]) : 10000;
+  int port = argc > 2 ? atoi(argv[2]) : 18444;
+
+  char root[] = "/tmp/alloc_test.XXXXXX";
+  if (!mkdtemp(root)) {
+	perror("mkdtemp");
+	return 1;
+  }
+  char path[256];
+  for (size_t i = 0; i != FILE_COUNT; i++) {
+	snprintf(path, sizeof(path), "%s/%s", root, FILES[i][0]);
+	FILE* file = fopen(path, "w");
+	fputs(FILES[i][1], file);
+	fclose(file);
+  }
+  snprintf(path, sizeof(path), "%s/etags", root);
+  ContentHasher* hasher = new ContentHasher(path, 1);
+
+  // The server thread outlives main; the process ends with _Exit
+  FileServer* server = new FileServer(port, std::string(root) + "/");
+  server->set_content_hasher(hasher);
+  std::thread([server] { server->run(); }).detach();
+
+  SOCKET sock = INVALID_SOCKET;
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int tries = 0; sock == INVALID_SOCKET && tries != 50; tries++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+	  closesocket(sock);
+	  sock = INVALID_SOCKET;
+	}
+  }
+  if (sock == INVALID_SOCKET) {
+	fprintf(stderr, "FAIL: cannot connect to port %d\n", port);
+	std::_Exit(1);
+  }
+
+  // Warm up until the files are cached and their contents hashed
+  for (int round = 0; round != 50 && hasher->size() < FILE_COUNT; round++) {
+	for (size_t i = 0; i != TARGET_COUNT; i++) {
+	  get(sock, TARGETS[i]);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  for (size_t i = 0; i != TARGET_COUNT; i++) {
+	get(sock, TARGETS[i]);
+  }
+
+  unsigned long long before = allocations.load();
+  int failed = 0;
+  for (int i = 0; i != requests; i++) {
+	const char* target = TARGETS[size_t(i) % TARGET_COUNT];
+	int status = get(sock, target);
+	if (status != (size_t(i) % TARGET_COUNT == TARGET_COUNT - 1 ? 404 : 200)) {
+	  fprintf(stderr, "FAIL: %s answered %d\n", target, status);
+	  failed = 1;
+	  break;
+	}
+  }
+  unsigned long long allocated = allocations.load() - before;
+
+  for (size_t i = 0; i != FILE_COUNT; i++) {
+	snprintf(path, sizeof(path), "%s/%s", root, FILES[i][0]);
+	remove(path);
+  }
+  snprintf(path, sizeof(path), "%s/etags", root);
+  remove(path);
+  rmdir(root);
+
+  if (!failed && allocated != 0) {
+	fprintf(stderr, "FAIL: %llu allocations in %d requests\n", allocated, requests);
+	failed = 1;
+  } else if (!failed) {
+	printf("ok: no allocations in %d requests\n", requests);
+  }
+  fflush(stdout);
+  std::_Exit(failed);
+}
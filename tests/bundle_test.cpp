@@ -0,0 +1,128 @@
+// Asset bundles: a directory is packed, the bundle loaded back, and every file
+// looked up by its path, with a sibling X.gz as the gzip representation of X and
+// files without an extension left out. The bundle is then served, and damaged
+// bundles are refused.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o bundle_test tests/bundle_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp)
+//   ./bundle_test [port]
+// Exits with 0 when every check held.
+
+#include <fstream>
+#include <iterator>
+#include "AssetBundle.h"
+#include "FileServer.h"
+#include "test_support.h"
+
+static const int NUMBERED_FILES = 300;
+
+static std::string read_file(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char** argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 18459;
+  test::scratch files;
+  files.write("index.html", "<p>home</p>\n");
+  files.write("style/site.css", "p { color: red }\n");
+  files.write("app.js", "console.log('plain');\n");
+  // Stands in for the gzip of app.js; the bundle takes it as it is
+  std::string compressed = test::pattern(300, 2);
+  files.write("app.js.gz", compressed);
+  std::string large = test::pattern(5000, 3);
+  files.write("large.bin", large);
+  files.write("README", "no extension\n");
+  for (int i = 0; i != NUMBERED_FILES; i++) {
+	files.write("n/" + std::to_string(i) + ".txt", "file " + std::to_string(i) + "\n");
+  }
+  test::scratch output;
+  std::string bundle_path = output.reserve("site.bundle");
+
+  std::unique_ptr<MimeMapper> mime_mapper(MimeMapper::createDefault());
+  std::string error;
+  bool packed = AssetBundle::pack(files.path(), bundle_path, *mime_mapper, error);
+  test::check(packed, "the directory is packed" + (packed ? std::string() : ": " + error));
+  AssetBundle* bundle = new AssetBundle();
+  bool loaded = bundle->load(bundle_path, error);
+  test::check(loaded, "the bundle loads" + (loaded ? std::string() : ": " + error));
+  // README is left out; app.js.gz is also a file of its own
+  test::check(bundle->size() == size_t(NUMBERED_FILES + 5), "every file with an extension is in the index (" +
+	std::to_string(bundle->size()) + ")");
+
+  // Lookups
+  {
+	bool all = true;
+	for (int i = 0; i != NUMBERED_FILES; i++) {
+	  Resource r;
+	  all = all && bundle->open("/n/" + std::to_string(i) + ".txt", false, r) &&
+		std::string(r.data.get(), r.size) == "file " + std::to_string(i) + "\n" && r.content_type == "text/plain";
+	}
+	test::check(all, "each file is found by its path, with its body and type");
+	Resource r;
+	test::check(!bundle->open("/n/1", false, r) && !bundle->open("/n/1.txt2", false, r) &&
+	  !bundle->open("/README", false, r) && !bundle->open("/zzz.txt", false, r) && !bundle->open("/", false, r),
+	  "prefixes, missing paths and files without an extension are not found");
+	Resource big;
+	test::check(bundle->open("/large.bin", false, big) && std::string(big.data.get(), big.size) == large &&
+	  reinterpret_cast<uintptr_t>(big.data.get()) % 4096 == 0, "a body of 4 KiB or more starts on a page");
+	Resource plain, gzip;
+	test::check(bundle->open("/app.js", false, plain) && bundle->open("/app.js", true, gzip) &&
+	  std::string(plain.data.get(), plain.size) == "console.log('plain');\n" && plain.content_encoding.empty() &&
+	  std::string(gzip.data.get(), gzip.size) == compressed && gzip.content_encoding == "gzip" && plain.varies &&
+	  gzip.varies && plain.etag != gzip.etag, "a sibling X.gz is the gzip representation of X");
+  }
+
+  FileServer* server = new FileServer(port, files.path());
+  server->set_bundle(bundle);
+  std::thread([server] { server->run(); }).detach();
+
+  // Served
+  {
+	test::response home = test::get(port, "/");
+	test::check(home.status == 200 && home.body == "<p>home</p>\n" && home.field("Content-Type") == "text/html" &&
+	  !home.field("ETag").empty(), "the index of the root is served from the bundle");
+	test::response css = test::get(port, "/style/site.css");
+	test::check(css.status == 200 && css.body == "p { color: red }\n" && css.field("Content-Type") == "text/css",
+	  "files in subdirectories are served");
+	test::response big = test::get(port, "/large.bin");
+	test::check(big.status == 200 && big.body == large, "a large body is served whole");
+	test::response gzip = test::get(port, "/app.js", "Accept-Encoding: gzip\r\n");
+	test::response plain = test::get(port, "/app.js");
+	test::check(gzip.body == compressed && gzip.field("Content-Encoding") == "gzip" &&
+	  gzip.field("Vary") == "Accept-Encoding" && plain.body == "console.log('plain');\n" &&
+	  plain.field("Content-Encoding").empty() && plain.field("Vary") == "Accept-Encoding",
+	  "the representation follows Accept-Encoding");
+	test::response again = test::get(port, "/style/site.css", "If-None-Match: " + css.field("ETag") + "\r\n");
+	test::check(again.status == 304, "a matching If-None-Match gets 304");
+	test::check(test::get(port, "/README").status == 404 && test::get(port, "/missing.txt").status == 404,
+	  "what is not in the bundle is 404, even when it is in the directory");
+  }
+
+  // Damaged bundles
+  {
+	std::string contents = read_file(bundle_path);
+	std::string truncated_path = output.reserve("truncated.bundle");
+	std::ofstream(truncated_path, std::ios::binary) << contents.substr(0, contents.size() - 100);
+	std::string garbage_path = output.reserve("garbage.bundle");
+	std::ofstream(garbage_path, std::ios::binary) << test::pattern(contents.size(), 4);
+	std::string unsorted_path = output.reserve("unsorted.bundle");
+	// The first two index records swapped; the index offset follows the magic,
+	// version, byte order mark and count in the header
+	uint64_t index_offset;
+	memcpy(&index_offset, contents.data() + 24, sizeof(index_offset));
+	std::string unsorted = contents;
+	size_t record_size = size_t(contents.size() - index_offset) / (NUMBERED_FILES + 5);
+	std::swap_ranges(unsorted.begin() + long(index_offset), unsorted.begin() + long(index_offset + record_size),
+	  unsorted.begin() + long(index_offset + record_size));
+	std::ofstream(unsorted_path, std::ios::binary) << unsorted;
+	AssetBundle truncated, garbage, swapped, absent;
+	test::check(!truncated.load(truncated_path, error) && !garbage.load(garbage_path, error) &&
+	  !swapped.load(unsorted_path, error) && !absent.load(output.path() + "absent.bundle", error),
+	  "truncated, foreign, unsorted and missing bundles are refused");
+  }
+
+  return test::finish();
+}
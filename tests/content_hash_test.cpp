@@ -0,0 +1,101 @@
+// Content ETags: files looked up are hashed in the background and then known by
+// the XXH64 of their contents, checked against reference values. The sidecar
+// index carries the hashes over to the next run, which hashes nothing here, and
+// keeps only what that run looked up for the run after it. A changed file is known
+// by its metadata ETag again.
+//
+// Linux only, for the nanosecond modification times. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o content_hash_test tests/content_hash_test.cpp cpp_server/ContentHasher.cpp cpp_server/Rcu.cpp
+//   ./content_hash_test
+// Exits with 0 when every check held.
+
+#include <fstream>
+#include "ContentHasher.h"
+#include "test_support.h"
+
+// The metadata ETag of the file at path, as the server makes it
+static std::string metadata_of(const std::string& path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+	return "";
+  }
+  char etag[ContentHasher::metadata_etag_size];
+  return std::string(ContentHasher::metadata_etag(uint64_t(st.st_ino), uint64_t(st.st_size),
+	int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, etag));
+}
+
+// The ETag hasher gives for the file at path now
+static std::string lookup(ContentHasher& hasher, Rcu::reader& reader, const std::string& path)
+{
+  std::pmr::string etag(metadata_of(path));
+  hasher.lookup(path, etag);
+  reader.quiescent();
+  return std::string(etag);
+}
+
+// The ETag of path once hashed, or its metadata ETag if that takes over 5 seconds
+static std::string hashed(ContentHasher& hasher, Rcu::reader& reader, const std::string& path)
+{
+  std::string etag;
+  for (int tries = 0; tries != 500 && (etag = lookup(hasher, reader, path)) == metadata_of(path); tries++) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return etag;
+}
+
+static size_t lines_of(const std::string& path)
+{
+  std::ifstream in(path);
+  size_t lines = 0;
+  for (std::string line; std::getline(in, line);) {
+	lines++;
+  }
+  return lines;
+}
+
+int main()
+{
+  test::scratch files;
+  std::string empty = files.write("empty.txt", "");
+  std::string short_file = files.write("abc.txt", "abc");
+  std::string long_file = files.write("long.txt", "Nobody inspects the spammish repetition");
+  std::string large = files.write("large.bin", test::pattern(1 << 20));
+  std::string index = files.reserve("etags.idx");
+  Rcu::reader reader;
+
+  std::string large_etag;
+  {
+	ContentHasher hasher(index, 2);
+	test::check(lookup(hasher, reader, short_file) == metadata_of(short_file),
+	  "a file not hashed yet keeps its metadata ETag");
+	test::check(hashed(hasher, reader, empty) == "\"ef46db3751d8e999\"" &&
+	  hashed(hasher, reader, short_file) == "\"44bc2cf5ad770999\"" &&
+	  hashed(hasher, reader, long_file) == "\"fbcea83c8a378bf1\"", "content ETags are the XXH64 reference values");
+	large_etag = hashed(hasher, reader, large);
+	test::check(large_etag != metadata_of(large) && large_etag.size() == 18, "a file read in several chunks is hashed");
+	test::check(hasher.size() == 4, "every hash is kept");
+  }
+
+  // Without threads, only the index can give content ETags
+  {
+	ContentHasher hasher(index, 0);
+	test::check(hasher.size() == 4, "the index is read back");
+	test::check(lookup(hasher, reader, short_file) == "\"44bc2cf5ad770999\"" && lookup(hasher, reader, large) == large_etag,
+	  "unchanged files have their content ETags at once in the next run");
+	// A different size, so a different metadata ETag whatever the clock
+	files.write("abc.txt", "abcd");
+	test::check(lookup(hasher, reader, short_file) == metadata_of(short_file), "a changed file is known by its metadata ETag again");
+  }
+
+  // The last run looked up abc.txt, before it changed, and large.bin
+  {
+	ContentHasher hasher(index, 0);
+	test::check(hasher.size() == 2 && lookup(hasher, reader, large) == large_etag &&
+	  lookup(hasher, reader, empty) == metadata_of(empty), "the index keeps what the last run looked up");
+  }
+  // What was kept, a marker, and large.bin looked up again
+  test::check(lines_of(index) == 4, "the index is compacted at startup (" + std::to_string(lines_of(index)) + " lines)");
+
+  return test::finish();
+}
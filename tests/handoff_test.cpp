@@ -0,0 +1,109 @@
+// Listener handoff round trip: the test starts a copy of itself as the successor and
+// hands it a listening socket; the successor adopts it, acknowledges, and answers a
+// connection on it with what it found in its environment. Successors that exit
+// without acknowledging, or cannot be started at all, are reported as failed.
+//
+// Linux and other POSIX systems only. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o handoff_test tests/handoff_test.cpp cpp_server/ListenerHandoff.cpp
+//   ./handoff_test [port]
+// Exits with 0 when every check held.
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "ListenerHandoff.h"
+#include "test_support.h"
+
+static const char MARKER[] = "HANDOFF_TEST_MARKER";
+
+// The copy started by the test: reports whether the environment came through, with
+// the handoff variable taken out of it
+static int successor()
+{
+  ListenerHandoff handoff;
+  std::vector<int> listeners;
+  if (!handoff.receive(listeners) || listeners.size() != 1) {
+	return 1;
+  }
+  const char* marker = getenv(MARKER);
+  std::string reply = std::string(marker != nullptr ? marker : "missing") +
+	(getenv(ListenerHandoff::channel_variable) == nullptr ? " cleared\n" : " leaked\n");
+  handoff.acknowledge();
+  int client = accept(listeners[0], nullptr, nullptr);
+  test::send_all(client, reply);
+  close(client);
+  return 0;
+}
+
+// Waits for the successor to answer; its state then
+static ListenerHandoff::state settle(ListenerHandoff& handoff)
+{
+  while (handoff.status() == ListenerHandoff::state::waiting) {
+	pollfd ready = { handoff.wait_handle(), POLLIN, 0 };
+	if (poll(&ready, 1, 5000) != 1) {
+	  break;
+	}
+	handoff.check();
+  }
+  return handoff.status();
+}
+
+int main(int argc, char** argv)
+{
+  if (getenv(ListenerHandoff::channel_variable) != nullptr) {
+	return successor();
+  }
+  int port = argc > 1 ? atoi(argv[1]) : 18448;
+  // A successor that is gone already must not take the test with it
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+	printf("FAIL: cannot listen on port %d\n", port);
+	return 1;
+  }
+  setenv(MARKER, "kept", 1);
+
+  {
+	ListenerHandoff handoff;
+	bool started = handoff.start_successor({ argv[0] }, { listener });
+	test::check(started && settle(handoff) == ListenerHandoff::state::ready, "the successor acknowledges the handoff");
+	if (handoff.status() == ListenerHandoff::state::ready) {
+	  SOCKET sock = test::connect_to(port);
+	  std::string reply;
+	  char buf[256];
+	  ssize_t got;
+	  while ((got = recv(sock, buf, sizeof(buf), 0)) > 0) {
+		reply.append(buf, size_t(got));
+	  }
+	  closesocket(sock);
+	  test::check(reply == "kept cleared\n", "the successor accepts on the socket handed to it, with the environment "
+		"passed on and the handoff variable cleared (\"" + reply.substr(0, reply.find('\n')) + "\")");
+	  waitpid(handoff.successor_pid(), nullptr, 0);
+	}
+  }
+
+  // Looked up in PATH; exits at once
+  {
+	ListenerHandoff handoff;
+	bool started = handoff.start_successor({ "false" }, { listener });
+	test::check(!started || settle(handoff) == ListenerHandoff::state::failed,
+	  "a successor that exits without acknowledging is reported as failed");
+  }
+
+  {
+	ListenerHandoff handoff;
+	bool started = handoff.start_successor({ "/nonexistent/cpp_server" }, { listener });
+	test::check(!started || settle(handoff) == ListenerHandoff::state::failed,
+	  "a successor that cannot be started is reported as failed");
+  }
+
+  close(listener);
+  return test::finish();
+}
@@ -0,0 +1,282 @@
+// HTTP/2 with prior knowledge over plain TCP: responses are framed as HEADERS and
+// DATA within the peer's frame size, PING is answered, bodies stop at the flow-control
+// windows and go on once they are opened, and a large stream opened behind a small
+// one on the same session does not take it past the per-connection rate cap.
+// Clients that flood the session with PINGs without reading the answers, or that
+// reset streams as fast as they open them, get GOAWAY(ENHANCE_YOUR_CALM).
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o http2_test tests/http2_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp)
+//   ./http2_test [port]
+// Exits with 0 when every check held.
+
+#include <poll.h>
+#include "FileServer.h"
+#include "test_support.h"
+
+// bytes per second of each connection
+static const double CONNECTION_RATE = 1 << 20;
+static const size_t WINDOWED_SIZE = 200000;
+static const size_t LARGE_SIZE = 2 << 20;
+static const size_t FLOOD_SIZE = 64 << 20;
+
+enum frame_type : uint8_t { DATA = 0, HEADERS = 1, RST_STREAM = 3, SETTINGS = 4, PING = 6, GOAWAY = 7, WINDOW_UPDATE = 8 };
+enum frame_flag : uint8_t { ACK = 0x1, END_STREAM = 0x1, END_HEADERS = 0x4 };
+
+struct frame {
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  uint32_t stream = 0;
+  std::string payload;
+};
+
+static std::string serialize(uint8_t type, uint8_t flags, uint32_t stream, const std::string& payload = "")
+{
+  std::string out(9, '\0');
+  out[0] = char(payload.size() >> 16);
+  out[1] = char(payload.size() >> 8);
+  out[2] = char(payload.size());
+  out[3] = char(type);
+  out[4] = char(flags);
+  for (int i = 0; i != 4; i++) {
+	out[5 + i] = char(stream >> (24 - 8 * i));
+  }
+  return out + payload;
+}
+
+static std::string be32(uint32_t value)
+{
+  return { char(value >> 24), char(value >> 16), char(value >> 8), char(value) };
+}
+
+static uint32_t read32(const std::string& data, size_t at)
+{
+  return uint32_t(uint8_t(data[at])) << 24 | uint32_t(uint8_t(data[at + 1])) << 16 |
+	uint32_t(uint8_t(data[at + 2])) << 8 | uint8_t(data[at + 3]);
+}
+
+// GET of path: :method GET and :scheme http from the static table, :path and
+// :authority as literals with indexed names
+static std::string get_headers(uint32_t stream, const std::string& path)
+{
+  std::string block = "\x82\x86";
+  block += '\x04';
+  block += char(path.size());
+  block += path;
+  block += "\x01\x09localhost";
+  return serialize(HEADERS, END_STREAM | END_HEADERS, stream, block);
+}
+
+static std::string window_update(uint32_t stream, uint32_t increment)
+{
+  return serialize(WINDOW_UPDATE, 0, stream, be32(increment));
+}
+
+// Client side of one session: the preface and empty SETTINGS go out on connect, and
+// the server's SETTINGS are acknowledged as they are read
+class session {
+  SOCKET sock;
+  std::string buffered;
+  HpackDecoder decoder;
+public:
+  explicit session(int port) : sock(test::connect_to(port)) {
+	send(std::string(Http2Session::preface, Http2Session::preface_length) + serialize(SETTINGS, 0, 0));
+  }
+  ~session() { closesocket(sock); }
+  bool send(const std::string& data) { return test::send_all(sock, data); }
+  // Sends data over and over without reading, up to limit bytes or until the server
+  // has stopped taking it for a second; returns the bytes sent
+  size_t flood(const std::string& data, size_t limit) {
+	size_t sent = 0, offset = 0;
+	auto stalled = std::chrono::steady_clock::now();
+	while (sent < limit && std::chrono::steady_clock::now() - stalled < std::chrono::seconds(1)) {
+	  ssize_t got = ::send(sock, data.data() + offset, data.size() - offset, MSG_DONTWAIT);
+	  if (got <= 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		continue;
+	  }
+	  sent += size_t(got);
+	  offset = (offset + size_t(got)) % data.size();
+	  stalled = std::chrono::steady_clock::now();
+	}
+	return sent;
+  }
+  // Reads up to GOAWAY and returns its error code, or -1 if the connection ended first
+  long long goaway() {
+	frame f;
+	while (next(f)) {
+	  if (f.type == GOAWAY && f.payload.size() >= 8) {
+		return read32(f.payload, 4);
+	  }
+	}
+	return -1;
+  }
+  // The next frame, or false if none came within timeout_ms or the connection ended
+  bool next(frame& f, int timeout_ms = 5000) {
+	while (buffered.size() < 9 || buffered.size() < 9 + (size_t(uint8_t(buffered[0])) << 16 |
+	  size_t(uint8_t(buffered[1])) << 8 | uint8_t(buffered[2]))) {
+	  pollfd ready = { sock, POLLIN, 0 };
+	  char chunk[65536];
+	  if (poll(&ready, 1, timeout_ms) != 1) {
+		return false;
+	  }
+	  ssize_t got = recv(sock, chunk, sizeof(chunk), 0);
+	  if (got <= 0) {
+		return false;
+	  }
+	  buffered.append(chunk, size_t(got));
+	}
+	size_t length = size_t(uint8_t(buffered[0])) << 16 | size_t(uint8_t(buffered[1])) << 8 | uint8_t(buffered[2]);
+	f.type = uint8_t(buffered[3]);
+	f.flags = uint8_t(buffered[4]);
+	f.stream = read32(buffered, 5) & 0x7fffffff;
+	f.payload = buffered.substr(9, length);
+	buffered.erase(0, 9 + length);
+	if (f.type == SETTINGS && !(f.flags & ACK)) {
+	  send(serialize(SETTINGS, ACK, 0));
+	}
+	return true;
+  }
+  // :status of a HEADERS frame, or -1
+  int status(const frame& f) {
+	HpackDecoder::header_list headers;
+	if (!decoder.decode(reinterpret_cast<const uint8_t*>(f.payload.data()), f.payload.size(), headers)) {
+	  return -1;
+	}
+	for (const auto& field : headers) {
+	  if (field.first == ":status") {
+		return atoi(field.second.c_str());
+	  }
+	}
+	return -1;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 18447;
+  test::scratch files;
+  files.write("small.txt", "small\n");
+  std::string windowed = test::pattern(WINDOWED_SIZE, 2);
+  files.write("windowed.bin", windowed);
+  std::string large = test::pattern(LARGE_SIZE);
+  files.write("large.bin", large);
+
+  FileServer* server = new FileServer(port, files.path());
+  SendScheduler::config send;
+  send.connection_rate = CONNECTION_RATE;
+  server->set_send_config(send);
+  std::thread([server] { server->run(); }).detach();
+
+  {
+	session client(port);
+	client.send(get_headers(1, "/small.txt"));
+	int status = -1;
+	std::string body;
+	bool ended = false;
+	frame f;
+	while (!ended && client.next(f)) {
+	  if (f.type == HEADERS && f.stream == 1) {
+		status = client.status(f);
+	  } else if (f.type == DATA && f.stream == 1) {
+		body += f.payload;
+		ended = f.flags & END_STREAM;
+	  }
+	}
+	test::check(status == 200 && body == "small\n" && ended, "a GET is answered with HEADERS and DATA ending the stream");
+
+	client.send(serialize(PING, 0, 0, "12345678"));
+	bool answered = false;
+	while (!answered && client.next(f)) {
+	  answered = f.type == PING && (f.flags & ACK) && f.payload == "12345678";
+	}
+	test::check(answered, "PING is acknowledged with its payload");
+
+	// The connection window lost the six bytes of small.txt
+	client.send(get_headers(3, "/windowed.bin"));
+	body.clear();
+	size_t largest = 0;
+	while (client.next(f, 500)) {
+	  if (f.type == DATA && f.stream == 3) {
+		body += f.payload;
+		largest = std::max(largest, f.payload.size());
+	  }
+	}
+	test::check(body.size() == 65535 - 6, "DATA stops at the connection window (" + std::to_string(body.size()) + " bytes)");
+	test::check(largest <= 16384, "DATA frames stay within the default frame size");
+	client.send(window_update(0, WINDOWED_SIZE) + window_update(3, WINDOWED_SIZE));
+	ended = false;
+	while (!ended && client.next(f)) {
+	  if (f.type == DATA && f.stream == 3) {
+		body += f.payload;
+		ended = f.flags & END_STREAM;
+	  }
+	}
+	test::check(ended && body == windowed, "the rest of the body follows once the windows are opened");
+  }
+
+  // Default windows, opened again as DATA comes in, so that no more than 64 KiB is
+  // ever ready to send; the large stream still goes at the connection rate
+  {
+	session client(port);
+	auto start = std::chrono::steady_clock::now();
+	client.send(get_headers(1, "/small.txt") + get_headers(3, "/large.bin"));
+	std::string small_body, large_body;
+	bool ended = false;
+	frame f;
+	while (!ended && client.next(f)) {
+	  if (f.type != DATA) {
+		continue;
+	  }
+	  (f.stream == 1 ? small_body : large_body) += f.payload;
+	  ended = f.stream == 3 && (f.flags & END_STREAM);
+	  if (!f.payload.empty()) {
+		client.send(window_update(0, uint32_t(f.payload.size())) + window_update(f.stream, uint32_t(f.payload.size())));
+	  }
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	test::check(small_body == "small\n" && large_body == large, "small and large streams arrive whole");
+	// The first tenth of a second is a burst; the rest is paced
+	double expected = double(LARGE_SIZE) / CONNECTION_RATE - 0.1;
+	test::check(seconds >= expected * 0.8, "a large stream behind a small one is rate capped (" +
+	  std::to_string(seconds) + " s, at least " + std::to_string(expected * 0.8) + " s expected)");
+  }
+
+  {
+	session client(port);
+	std::string pings;
+	for (int i = 0; i != 1000; i++) {
+	  pings += serialize(PING, 0, 0, "flooding");
+	}
+	// More answers than the socket buffers and the session hold
+	size_t sent = client.flood(pings, FLOOD_SIZE);
+	long long code = client.goaway();
+	test::check(code == 0xb, "a PING flood that is not read gets GOAWAY(ENHANCE_YOUR_CALM) (" +
+	  std::to_string(sent >> 20) + " MiB taken, code " + std::to_string(code) + ")");
+  }
+
+  {
+	session client(port);
+	std::string resets;
+	for (uint32_t stream = 1; stream < 1000; stream += 2) {
+	  // CANCEL
+	  resets += get_headers(stream, "/large.bin") + serialize(RST_STREAM, 0, stream, be32(0x8));
+	}
+	client.send(resets);
+	long long code = client.goaway();
+	test::check(code == 0xb, "streams reset as fast as they are opened get GOAWAY(ENHANCE_YOUR_CALM) (code " +
+	  std::to_string(code) + ")");
+  }
+
+  {
+	session client(port);
+	client.send(get_headers(1, "/small.txt"));
+	std::string body;
+	frame f;
+	while (client.next(f) && !(f.type == DATA && (f.flags & END_STREAM))) {
+	}
+	test::check(f.type == DATA && f.payload == "small\n", "other sessions are still served");
+  }
+
+  return test::finish();
+}
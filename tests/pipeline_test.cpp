@@ -0,0 +1,84 @@
+// HTTP/1.1 pipelining: responses to pipelined requests come back in request order,
+// requests past the pipeline depth are held and then answered, and a small
+// response pipelined ahead of a large one does not take the large one past the
+// per-connection rate cap.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o pipeline_test tests/pipeline_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp)
+//   ./pipeline_test [port]
+// Exits with 0 when every check held.
+
+#include "FileServer.h"
+#include "test_support.h"
+
+// bytes per second of each connection
+static const double CONNECTION_RATE = 1 << 20;
+static const size_t LARGE_SIZE = 2 << 20;
+
+int main(int argc, char** argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 18446;
+  test::scratch files;
+  files.write("a.txt", "first\n");
+  files.write("b.txt", "second\n");
+  files.write("c.txt", "third\n");
+  files.write("small.txt", "small\n");
+  std::string large = test::pattern(LARGE_SIZE);
+  files.write("large.bin", large);
+
+  FileServer* server = new FileServer(port, files.path());
+  SendScheduler::config send;
+  send.connection_rate = CONNECTION_RATE;
+  server->set_send_config(send);
+  server->set_pipeline_depth(2);
+  std::thread([server] { server->run(); }).detach();
+
+  // Order, with a 404 among them
+  {
+	SOCKET sock = test::connect_to(port);
+	test::send_all(sock, test::get_request("/a.txt") + test::get_request("/missing") + test::get_request("/b.txt") +
+	  test::get_request("/c.txt"));
+	test::reader in(sock);
+	test::response a = in.next(), missing = in.next(), b = in.next(), c = in.next();
+	test::check(a.status == 200 && a.body == "first\n" && missing.status == 404 && b.status == 200 &&
+	  b.body == "second\n" && c.status == 200 && c.body == "third\n", "pipelined responses come in request order");
+	closesocket(sock);
+  }
+
+  // Five times the depth, in one segment
+  {
+	SOCKET sock = test::connect_to(port);
+	std::string requests;
+	const char* const targets[] = { "/a.txt", "/b.txt", "/c.txt" };
+	for (int i = 0; i != 10; i++) {
+	  requests += test::get_request(targets[i % 3]);
+	}
+	test::send_all(sock, requests);
+	test::reader in(sock);
+	bool ordered = true;
+	for (int i = 0; i != 10; i++) {
+	  test::response r = in.next();
+	  ordered = ordered && r.status == 200 && r.body == (i % 3 == 0 ? "first\n" : i % 3 == 1 ? "second\n" : "third\n");
+	}
+	test::check(ordered, "requests past the pipeline depth are held, then answered in order");
+	closesocket(sock);
+  }
+
+  // The large body, pipelined behind a small one, still goes at the connection rate
+  {
+	SOCKET sock = test::connect_to(port);
+	auto start = std::chrono::steady_clock::now();
+	test::send_all(sock, test::get_request("/small.txt") + test::get_request("/large.bin"));
+	test::reader in(sock);
+	test::response small = in.next();
+	test::response big = in.next();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	test::check(small.body == "small\n" && big.body == large, "small and large pipelined bodies arrive whole");
+	// The first tenth of a second is a burst; the rest is paced
+	double expected = double(LARGE_SIZE) / CONNECTION_RATE - 0.1;
+	test::check(seconds >= expected * 0.8, "a large response behind a small one is rate capped (" +
+	  std::to_string(seconds) + " s, at least " + std::to_string(expected * 0.8) + " s expected)");
+	closesocket(sock);
+  }
+  return test::finish();
+}
@@ -0,0 +1,82 @@
+// Preload selection: glob matching of request paths, the walk of the root, and a
+// list of request paths cut to its first entries, each filtered by the patterns.
+// Listed paths are canonicalized as requests are, so those that would leave the
+// root are dropped.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Icpp_server -o preload_test tests/preload_test.cpp cpp_server/Preload.cpp cpp_server/CanonicalPath.cpp
+//   ./preload_test
+// Exits with 0 when every check held.
+
+#include <algorithm>
+#include "Preload.h"
+#include "test_support.h"
+
+static std::string joined(std::vector<std::string> paths, bool sorted)
+{
+  if (sorted) {
+	std::sort(paths.begin(), paths.end());
+  }
+  std::string all;
+  for (const std::string& path : paths) {
+	all += (all.empty() ? "" : " ") + path;
+  }
+  return all;
+}
+
+// What select() chooses under root with cfg, walked paths sorted; "error" if it fails
+static std::string selected(const std::string& root, const Preload::config& cfg)
+{
+  std::vector<std::string> paths;
+  std::string error;
+  if (!Preload::select(root, cfg, paths, error)) {
+	return "error";
+  }
+  return joined(paths, cfg.list_path.empty());
+}
+
+int main()
+{
+  test::check(Preload::matches("*.html", "/index.html") && Preload::matches("*.html", "/docs/a/b.html") &&
+	!Preload::matches("*.html", "/index.htm") && !Preload::matches("*.html", "/index.html.gz"),
+	"'*' matches any run of characters, slashes included");
+  test::check(Preload::matches("/assets/*", "/assets/") && Preload::matches("/assets/*", "/assets/app/main.js") &&
+	!Preload::matches("/assets/*", "/static/assets/x.js"), "patterns are anchored at both ends");
+  test::check(Preload::matches("/img/??.png", "/img/ab.png") && !Preload::matches("/img/??.png", "/img/abc.png") &&
+	!Preload::matches("/img/??.png", "/img/a.png"), "'?' matches exactly one character");
+  test::check(Preload::matches("*a*b*c", "/xaxxbxcxaxbxc") && !Preload::matches("*a*b*c", "/xaxxbxcxaxbx") &&
+	Preload::matches("**", "") && Preload::matches("*", "/"), "several stars backtrack");
+
+  test::scratch files;
+  files.write("index.html", "");
+  files.write("style.css", "");
+  files.write("docs/index.html", "");
+  files.write("docs/guide.html", "");
+  files.write("assets/app.js", "");
+  files.write("assets/logo.png", "");
+  std::string list = files.write("top.txt", "/docs/guide.html\r\n/assets/app.js\n\n/../../etc/passwd\n/docs/\n"
+	"/index.html?v=2\n/style.css\n");
+
+  Preload::config cfg;
+  test::check(selected(files.path(), cfg) == "/assets/app.js /assets/logo.png /docs/guide.html /docs/index.html "
+	"/index.html /style.css /top.txt", "without a list, every file under the root is chosen");
+  cfg.patterns = { "*.html", "/assets/*.js" };
+  test::check(selected(files.path(), cfg) == "/assets/app.js /docs/guide.html /docs/index.html /index.html",
+	"the walk is filtered by the patterns");
+
+  cfg.patterns.clear();
+  cfg.list_path = list;
+  test::check(selected(files.path(), cfg) == "/docs/guide.html /assets/app.js /docs/index.html /index.html /style.css",
+	"a list is taken in its order, canonicalized, with directories resolved to their index and traversals dropped");
+  cfg.top = 3;
+  test::check(selected(files.path(), cfg) == "/docs/guide.html /assets/app.js /docs/index.html",
+	"only the first paths of the list are taken");
+  cfg.top = 2;
+  cfg.patterns = { "*.html" };
+  test::check(selected(files.path(), cfg) == "/docs/guide.html /docs/index.html",
+	"the list is filtered by the patterns before it is cut");
+  cfg.list_path = files.path() + "absent.txt";
+  test::check(selected(files.path(), cfg) == "error", "a missing list is an error");
+
+  return test::finish();
+}
@@ -0,0 +1,149 @@
+// Pooled receive buffers: the pool lends buffers out of slabs and lends returned
+// ones again first. Through the server, request heads larger than a small buffer
+// move to a large one, whether they arrive at once or in pieces; heads larger
+// than that end the connection; pipelined requests spanning buffers are all answered;
+// and idle keep-alive connections hold no buffer, as the admin counters show.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -o receive_buffer_test tests/receive_buffer_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp)
+//   ./receive_buffer_test [port]
+// Exits with 0 when every check held.
+
+#include <fstream>
+#include "BufferPool.h"
+#include "FileServer.h"
+#include "test_support.h"
+
+static const int IDLE_CONNECTIONS = 20;
+
+// A request for target with filler header fields, size bytes in all
+static std::string padded_request(const std::string& target, size_t size)
+{
+  std::string request = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n";
+  for (int i = 0; request.size() + 4 < size; i++) {
+	std::string field = "X-Filler-" + std::to_string(i) + ": ";
+	size_t room = size - request.size() - 4;
+	field += std::string(std::min<size_t>(room > field.size() + 2 ? room - field.size() - 2 : 0, 100), 'f');
+	request += field + "\r\n";
+  }
+  return request + "\r\n";
+}
+
+// The value of a counter in the admin report
+static long counter(const std::string& report, const std::string& name)
+{
+  size_t at = report.find(name + " ");
+  return at == std::string::npos ? -1 : atol(report.c_str() + at + name.size() + 1);
+}
+
+int main(int argc, char** argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 18461;
+
+  {
+	BufferPool pool(256, 4);
+	std::vector<BufferPool::buffer> lent;
+	for (int i = 0; i != 5; i++) {
+	  lent.push_back(pool.acquire());
+	}
+	test::check(pool.allocated() == 8 && pool.in_use() == 5 && lent[0].capacity() == 256,
+	  "buffers come from slabs of the given size");
+	char* returned = lent[2].data();
+	lent[2].reset();
+	BufferPool::buffer again = pool.acquire();
+	test::check(pool.in_use() == 5 && pool.allocated() == 8 && again.data() == returned,
+	  "a returned buffer is lent again before a new slab is taken");
+	BufferPool::buffer moved = std::move(again);
+	test::check(!again && moved.data() == returned && pool.in_use() == 5, "a buffer moves with its loan");
+	moved = std::move(lent[0]);
+	test::check(pool.in_use() == 4 && !lent[0], "assigning over a buffer gives it back");
+	lent.clear();
+	moved.reset();
+	test::check(pool.in_use() == 0 && pool.allocated() == 8, "pools keep their slabs");
+  }
+
+  test::scratch files;
+  files.write("a.txt", "first\n");
+  files.write("b.txt", "second\n");
+  std::string config = files.write("server.conf", "admin_path = /admin\n");
+  FileServer* server = new FileServer(port, files.path());
+  server->set_config_file(config);
+  server->set_workers(1, false, false);
+  std::thread([server] { server->run(); }).detach();
+
+  {
+	SOCKET sock = test::connect_to(port);
+	test::send_all(sock, padded_request("/a.txt", 6000));
+	test::response r = test::reader(sock).next();
+	test::check(r.status == 200 && r.body == "first\n", "a head over the small buffer is handled whole");
+	closesocket(sock);
+  }
+  {
+	SOCKET sock = test::connect_to(port);
+	std::string request = padded_request("/b.txt", 7000);
+	for (size_t at = 0; at < request.size(); at += 500) {
+	  test::send_all(sock, request.substr(at, 500));
+	  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	test::response r = test::reader(sock).next();
+	test::check(r.status == 200 && r.body == "second\n", "a large head arriving in pieces is handled whole");
+	closesocket(sock);
+  }
+  {
+	SOCKET sock = test::connect_to(port);
+	test::send_all(sock, padded_request("/a.txt", 9000));
+	test::reader in(sock);
+	test::response r = in.next();
+	// As the server always has, it answers what fits and goes no further
+	test::check(r.status != -1 && in.next().status == -1, "a head over the large buffer ends the connection");
+	closesocket(sock);
+  }
+  {
+	SOCKET sock = test::connect_to(port);
+	std::string requests;
+	for (int i = 0; i != 30; i++) {
+	  requests += padded_request(i % 2 == 0 ? "/a.txt" : "/b.txt", 300 + 10 * size_t(i));
+	}
+	test::send_all(sock, requests);
+	test::reader in(sock);
+	bool ordered = true;
+	for (int i = 0; i != 30; i++) {
+	  test::response r = in.next();
+	  ordered = ordered && r.status == 200 && r.body == (i % 2 == 0 ? "first\n" : "second\n");
+	}
+	test::check(ordered, "pipelined requests spanning several buffers are answered in order");
+	closesocket(sock);
+  }
+
+  // Idle connections, one with half a small head and one with half a large one
+  {
+	std::vector<SOCKET> idle;
+	for (int i = 0; i != IDLE_CONNECTIONS; i++) {
+	  idle.push_back(test::connect_to(port));
+	  test::send_all(idle.back(), test::get_request("/a.txt"));
+	  test::reader(idle.back()).next();
+	}
+	SOCKET partial = test::connect_to(port);
+	test::send_all(partial, "GET /a.txt HTTP/1.1\r\nHost: local");
+	SOCKET partial_large = test::connect_to(port);
+	std::string large = padded_request("/a.txt", 6000);
+	test::send_all(partial_large, large.substr(0, 5000));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	test::response report = test::get(port, "/admin");
+	// The admin request holds one small buffer while it is answered
+	test::check(report.status == 200 && counter(report.body, "receive_buffers_in_use") == 2 &&
+	  counter(report.body, "large_receive_buffers_in_use") == 1, "idle connections hold no receive buffer (" +
+	  std::to_string(counter(report.body, "receive_buffers_in_use")) + " small, " +
+	  std::to_string(counter(report.body, "large_receive_buffers_in_use")) + " large in use)");
+	test::send_all(partial_large, large.substr(5000));
+	test::response r = test::reader(partial_large).next();
+	test::check(r.status == 200 && r.body == "first\n", "the held large head is completed later");
+	for (SOCKET sock : idle) {
+	  closesocket(sock);
+	}
+	closesocket(partial);
+	closesocket(partial_large);
+  }
+
+  return test::finish();
+}
@@ -0,0 +1,217 @@
+// What the server tests share: a scratch directory of files to serve, a client
+// socket to a server started on a thread of the test, and HTTP/1.1 responses read
+// from it. Each test is one program that prints "ok: ..." lines and exits with 0
+// when everything held, or prints "FAIL: ..." and exits with 1.
+
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ServerPolicies.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/stat.h>
+#endif
+
+namespace test {
+
+inline int failures = 0;
+
+inline void check(bool condition, const std::string& what)
+{
+  if (condition) {
+	printf("ok: %s\n", what.c_str());
+  } else {
+	printf("FAIL: %s\n", what.c_str());
+	failures++;
+  }
+  fflush(stdout);
+}
+
+// A temporary directory, removed with what was written into it
+class scratch {
+  std::string root;
+  std::vector<std::string> made;
+public:
+  scratch() {
+	char name[] = "/tmp/server_test.XXXXXX";
+	if (!mkdtemp(name)) {
+	  perror("mkdtemp");
+	  std::exit(1);
+	}
+	root = name;
+  }
+  ~scratch() {
+	for (auto it = made.rbegin(); it != made.rend(); ++it) {
+	  remove(it->c_str());
+	}
+	rmdir(root.c_str());
+  }
+  // With a trailing slash, as the server takes it
+  std::string path() const { return root + "/"; }
+  std::string write(const std::string& name, const std::string& contents) {
+	std::string full = root + "/" + name;
+	// Directories on the way are made too
+	for (size_t slash = name.find('/'); slash != std::string::npos; slash = name.find('/', slash + 1)) {
+	  std::string directory = root + "/" + name.substr(0, slash);
+	  if (mkdir(directory.c_str(), 0755) == 0) {
+		made.push_back(directory);
+	  }
+	}
+	FILE* file = fopen(full.c_str(), "wb");
+	fwrite(contents.data(), 1, contents.size(), file);
+	fclose(file);
+	made.push_back(full);
+	return full;
+  }
+  // A name for a file the test makes itself, removed like the others
+  std::string reserve(const std::string& name) {
+	made.push_back(root + "/" + name);
+	return made.back();
+  }
+};
+
+// size bytes that differ from one offset to the next
+inline std::string pattern(size_t size, unsigned seed = 1)
+{
+  std::string data(size, '\0');
+  uint32_t x = seed * 2654435761u + 1;
+  for (size_t i = 0; i != size; i++) {
+	x = x * 1103515245u + 12345u;
+	data[i] = char(x >> 16);
+  }
+  return data;
+}
+
+// Connects to the server on port, waiting for it to come up; exits if it does not
+inline SOCKET connect_to(int port)
+{
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int tries = 0; tries != 50; tries++) {
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+	  return sock;
+	}
+	closesocket(sock);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  printf("FAIL: cannot connect to port %d\n", port);
+  std::exit(1);
+}
+
+inline bool send_all(SOCKET sock, const std::string& data)
+{
+  size_t done = 0;
+  while (done != data.size()) {
+	ssize_t sent = send(sock, data.data() + done, data.size() - done, 0);
+	if (sent <= 0) {
+	  return false;
+	}
+	done += size_t(sent);
+  }
+  return true;
+}
+
+struct response {
+  int status = -1;
+  std::string head;
+  std::string body;
+  // Value of the header field called name, as sent, or empty
+  std::string field(const std::string& name) const {
+	size_t at = head.find("\r\n" + name + ": ");
+	if (at == std::string::npos) {
+	  return "";
+	}
+	at += name.size() + 4;
+	return head.substr(at, head.find("\r\n", at) - at);
+  }
+};
+
+// Reads HTTP/1.1 responses off one connection; bytes of the next response that
+// arrive with one are kept for it
+class reader {
+  SOCKET sock;
+  std::string buffered;
+  bool fill() {
+	char chunk[65536];
+	ssize_t got = recv(sock, chunk, sizeof(chunk), 0);
+	if (got <= 0) {
+	  return false;
+	}
+	buffered.append(chunk, size_t(got));
+	return true;
+  }
+public:
+  explicit reader(SOCKET sock) : sock(sock) {}
+  // The next response; its status is -1 if the connection ended first. Bodies are
+  // delimited by Content-Length, or by the end of the connection without one.
+  response next(bool head_only = false) {
+	response r;
+	size_t end;
+	while ((end = buffered.find("\r\n\r\n")) == std::string::npos) {
+	  if (!fill()) {
+		return r;
+	  }
+	}
+	r.head = buffered.substr(0, end + 2);
+	buffered.erase(0, end + 4);
+	std::string length = r.field("Content-Length");
+	if (head_only || r.head.compare(9, 3, "304") == 0) {
+	  r.status = atoi(r.head.c_str() + 9);
+	  return r;
+	}
+	if (length.empty()) {
+	  while (fill()) {
+	  }
+	  r.body.swap(buffered);
+	} else {
+	  size_t size = size_t(strtoull(length.c_str(), nullptr, 10));
+	  while (buffered.size() < size) {
+		if (!fill()) {
+		  return r;
+		}
+	  }
+	  r.body = buffered.substr(0, size);
+	  buffered.erase(0, size);
+	}
+	r.status = atoi(r.head.c_str() + 9);
+	return r;
+  }
+};
+
+inline std::string get_request(const std::string& target, const std::string& fields = "")
+{
+  return "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n" + fields + "\r\n";
+}
+
+// One GET on a connection of its own
+inline response get(int port, const std::string& target, const std::string& fields = "")
+{
+  SOCKET sock = connect_to(port);
+  send_all(sock, get_request(target, fields));
+  response r = reader(sock).next();
+  closesocket(sock);
+  return r;
+}
+
+inline int finish()
+{
+  fflush(stdout);
+  // Server threads are still running; they go with the process
+  std::_Exit(failures == 0 ? 0 : 1);
+}
+
+}
+
+#endif // TEST_SUPPORT_H
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Serves a directory over TLS with a freshly generated self-signed certificate and
+# checks that HTTP/1.1 and HTTP/2 clients receive the files byte for byte.
+#
+# Usage: tests/tls_test.sh path/to/cpp_server [port]
+# The server must be built with WITH_OPENSSL; needs openssl and curl (with HTTP/2).
+
+server=${1:?usage: $0 path/to/cpp_server [port]}
+port=${2:-18443}
+work=$(mktemp -d)
+pid=
+cleanup() {
+  [ -n "$pid" ] && kill "$pid" 2>/dev/null && wait "$pid" 2>/dev/null
+  rm -rf "$work"
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost -days 1 \
+  -keyout "$work/key.pem" -out "$work/cert.pem" 2>/dev/null || { echo "FAIL: openssl req"; exit 1; }
+mkdir "$work/www"
+echo "small file" > "$work/www/small.txt"
+# Larger than a TLS record and than the kernel TLS send chunk
+head -c 3000000 /dev/urandom > "$work/www/large.bin"
+
+"$server" -p "$port" -d "$work/www" --tls-cert "$work/cert.pem" --tls-key "$work/key.pem" > "$work/server.log" 2>&1 &
+pid=$!
+tries=0
+until curl -sk -o /dev/null "https://127.0.0.1:$port/small.txt"; do
+  tries=$((tries + 1))
+  if [ $tries -gt 50 ] || ! kill -0 "$pid" 2>/dev/null; then
+    echo "FAIL: server did not start"
+    cat "$work/server.log"
+    exit 1
+  fi
+  sleep 0.1
+done
+
+failed=0
+for file in small.txt large.bin; do
+  for version in 1.1 2; do
+    got=$(curl -sk --http$version -o "$work/received" -w '%{http_version}' "https://127.0.0.1:$port/$file")
+    if [ "$got" != "$version" ]; then
+      echo "FAIL: $file spoke HTTP/$got instead of HTTP/$version"
+      failed=1
+    elif ! cmp -s "$work/received" "$work/www/$file"; then
+      echo "FAIL: $file over HTTP/$version differs"
+      failed=1
+    else
+      echo "ok: $file over HTTP/$version"
+    fi
+  done
+done
+exit $failed
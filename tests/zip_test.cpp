@@ -0,0 +1,281 @@
+// ZIP archives as the root: archives written by the test are loaded and their
+// entries looked up, stored ones served as they are and deflated ones as gzip
+// members, or inflated for clients without gzip when built with WITH_ZLIB (406
+// otherwise). An archive with more entries than the classic end record can count
+// takes the ZIP64 records. The first archive is then served.
+//
+// Build and run from the repository root, with zlib or without:
+//   g++ -std=c++17 -O2 -pthread -Icpp_server -DWITH_ZLIB -o zip_test tests/zip_test.cpp $(ls cpp_server/*.cpp | grep -v cpp_server/cpp_server.cpp) -lz
+//   ./zip_test [port]
+// Exits with 0 when every check held.
+
+#include <fstream>
+#include "FileServer.h"
+#include "FileStream.h"
+#include "ZipArchive.h"
+#include "test_support.h"
+
+static const int MANY_ENTRIES = 70000;
+static const uint16_t STORED = 0;
+static const uint16_t DEFLATED = 8;
+static const uint16_t BZIP2 = 12;
+
+static uint32_t crc32_of(const std::string& data)
+{
+  uint32_t crc = 0xffffffff;
+  for (unsigned char c : data) {
+	crc ^= c;
+	for (int bit = 0; bit != 8; bit++) {
+	  crc = crc >> 1 ^ (0xedb88320 & (0 - (crc & 1)));
+	}
+  }
+  return ~crc;
+}
+
+// A deflate stream of stored blocks, which any inflater reads back
+static std::string deflate_stored(const std::string& data)
+{
+  std::string out;
+  size_t at = 0;
+  do {
+	size_t length = std::min<size_t>(data.size() - at, 0xffff);
+	bool last = at + length == data.size();
+	out += char(last ? 1 : 0);
+	out += char(length);
+	out += char(length >> 8);
+	out += char(~length);
+	out += char(~length >> 8);
+	out.append(data, at, length);
+	at += length;
+  } while (at != data.size());
+  return out;
+}
+
+// Writes ZIP archives with the fields the server reads
+class zip_writer {
+  std::string out;
+  std::string directory;
+  uint64_t count = 0;
+  bool zip64;
+
+  void le(std::string& to, uint64_t value, int bytes) {
+	for (int i = 0; i != bytes; i++) {
+	  to += char(value >> (8 * i));
+	}
+  }
+public:
+  explicit zip_writer(bool zip64) : zip64(zip64) {}
+
+  void add(const std::string& name, const std::string& contents, uint16_t method = STORED, uint16_t flags = 0) {
+	std::string data = method == DEFLATED ? deflate_stored(contents) : contents;
+	uint32_t crc = crc32_of(contents);
+	uint64_t offset = out.size();
+	le(out, 0x04034b50, 4);
+	le(out, 20, 2);
+	le(out, flags, 2);
+	le(out, method, 2);
+	le(out, 0, 4);
+	le(out, crc, 4);
+	le(out, data.size(), 4);
+	le(out, contents.size(), 4);
+	le(out, name.size(), 2);
+	le(out, 0, 2);
+	out += name;
+	out += data;
+
+	// ZIP64 entries leave the sizes and offset to the extra field
+	uint64_t overflow = 0xffffffff;
+	le(directory, 0x02014b50, 4);
+	le(directory, 45, 2);
+	le(directory, zip64 ? 45 : 20, 2);
+	le(directory, flags, 2);
+	le(directory, method, 2);
+	le(directory, 0, 4);
+	le(directory, crc, 4);
+	le(directory, zip64 ? overflow : data.size(), 4);
+	le(directory, zip64 ? overflow : contents.size(), 4);
+	le(directory, name.size(), 2);
+	le(directory, zip64 ? 28 : 0, 2);
+	le(directory, 0, 2);
+	le(directory, 0, 2);
+	le(directory, 0, 2);
+	le(directory, 0, 4);
+	le(directory, zip64 ? overflow : offset, 4);
+	directory += name;
+	if (zip64) {
+	  le(directory, 0x0001, 2);
+	  le(directory, 24, 2);
+	  le(directory, contents.size(), 8);
+	  le(directory, data.size(), 8);
+	  le(directory, offset, 8);
+	}
+	count++;
+  }
+
+  std::string finish() {
+	uint64_t directory_offset = out.size();
+	out += directory;
+	if (zip64) {
+	  uint64_t end_offset = out.size();
+	  le(out, 0x06064b50, 4);
+	  le(out, 44, 8);
+	  le(out, 45, 2);
+	  le(out, 45, 2);
+	  le(out, 0, 4);
+	  le(out, 0, 4);
+	  le(out, count, 8);
+	  le(out, count, 8);
+	  le(out, directory.size(), 8);
+	  le(out, directory_offset, 8);
+	  le(out, 0x07064b50, 4);
+	  le(out, 0, 4);
+	  le(out, end_offset, 8);
+	  le(out, 1, 4);
+	}
+	le(out, 0x06054b50, 4);
+	le(out, 0, 2);
+	le(out, 0, 2);
+	le(out, zip64 ? 0xffff : count, 2);
+	le(out, zip64 ? 0xffff : count, 2);
+	le(out, zip64 ? 0xffffffff : directory.size(), 4);
+	le(out, zip64 ? 0xffffffff : directory_offset, 4);
+	le(out, 0, 2);
+	return out;
+  }
+};
+
+// The whole body of a resource, from memory or its stream
+static std::string body_of(const Resource& r)
+{
+  if (!r.stream) {
+	return std::string(r.data.get(), r.size);
+  }
+  std::string body;
+  while (body.size() < r.size) {
+	size_t count = size_t(r.size - body.size());
+	const char* data = r.stream->read(body.size(), count);
+	if (!data || count == 0) {
+	  break;
+	}
+	body.append(data, count);
+  }
+  return body;
+}
+
+// What a client accepting gzip is sent for contents deflated into data
+static std::string gzip_member(const std::string& contents)
+{
+  std::string member("\x1f\x8b\x08\0\0\0\0\0\0\xff", 10);
+  member += deflate_stored(contents);
+  uint32_t trailer[2] = { crc32_of(contents), uint32_t(contents.size()) };
+  for (uint32_t value : trailer) {
+	for (int i = 0; i != 4; i++) {
+	  member += char(value >> (8 * i));
+	}
+  }
+  return member;
+}
+
+int main(int argc, char** argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 18460;
+  test::scratch files;
+  std::string text = test::pattern(200 << 10, 5);
+  zip_writer site(false);
+  site.add("index.html", "<p>zipped</p>\n");
+  site.add("docs/", "");
+  site.add("docs/guide.txt", "stored guide\n");
+  // Spans several inflate windows
+  site.add("docs/big.txt", text, DEFLATED);
+  site.add("secret.txt", "encrypted", STORED, 1);
+  site.add("other.txt", "bzip2", BZIP2);
+  std::string site_zip = site.finish();
+  std::string site_path = files.write("site.zip", site_zip);
+
+  std::string error;
+  ZipArchive archive;
+  bool loaded = archive.load(site_path, error);
+  test::check(loaded, "an archive loads" + (loaded ? std::string() : ": " + error));
+  test::check(archive.size() == 3, "directories, encrypted entries and other methods are left out (" +
+	std::to_string(archive.size()) + " entries)");
+  {
+	Resource guide, missing, directory, secret;
+	test::check(archive.open(std::pmr::string("/docs/guide.txt"), false, guide) == 200 && !guide.stream &&
+	  body_of(guide) == "stored guide\n" && !guide.varies && !guide.etag.empty(),
+	  "a stored entry is served from the mapping");
+	test::check(archive.open(std::pmr::string("/missing.txt"), false, missing) == 404 &&
+	  archive.open(std::pmr::string("/docs/"), false, directory) == 404 &&
+	  archive.open(std::pmr::string("/secret.txt"), false, secret) == 404, "what is left out is 404");
+	Resource gzip;
+	test::check(archive.open(std::pmr::string("/docs/big.txt"), true, gzip) == 200 && gzip.content_encoding == "gzip" &&
+	  gzip.varies && gzip.size == gzip_member(text).size() && body_of(gzip) == gzip_member(text),
+	  "a deflated entry goes to gzip clients as a member around its deflate stream");
+	Resource plain;
+	int status = archive.open(std::pmr::string("/docs/big.txt"), false, plain);
+#ifdef WITH_ZLIB
+	test::check(status == 200 && plain.content_encoding.empty() && plain.varies && plain.etag != gzip.etag &&
+	  body_of(plain) == text, "a deflated entry is inflated for other clients");
+#else
+	test::check(status == 406, "a deflated entry is 406 for other clients without zlib");
+#endif
+  }
+
+  // More entries than 16 bits count, so only the ZIP64 records hold the count,
+  // and every size and offset in the ZIP64 extra field
+  {
+	zip_writer many(true);
+	for (int i = 0; i != MANY_ENTRIES; i++) {
+	  many.add("n/" + std::to_string(i) + ".txt", std::to_string(i), i % 2 == 0 ? STORED : DEFLATED);
+	}
+	std::string many_path = files.write("many.zip", many.finish());
+	ZipArchive large;
+	loaded = large.load(many_path, error);
+	test::check(loaded && large.size() == size_t(MANY_ENTRIES), "a ZIP64 archive of " + std::to_string(MANY_ENTRIES) +
+	  " entries loads whole" + (loaded ? std::string() : ": " + error));
+	bool all = true;
+	for (int i = 0; i != MANY_ENTRIES && all; i++) {
+	  Resource r;
+	  std::string name = std::to_string(i);
+	  all = large.open(std::pmr::string("/n/" + name + ".txt"), true, r) == 200 &&
+		body_of(r) == (i % 2 == 0 ? name : gzip_member(name));
+	}
+	test::check(all, "each entry of the ZIP64 archive is found with its contents");
+  }
+
+  // Damaged archives
+  {
+	std::string truncated_path = files.write("truncated.zip", site_zip.substr(0, site_zip.size() - 10));
+	// The central directory said to start past the end
+	std::string misplaced = site_zip;
+	misplaced[misplaced.size() - 3] = '\x7f';
+	std::string misplaced_path = files.write("misplaced.zip", misplaced);
+	std::string garbage_path = files.write("garbage.zip", test::pattern(4096, 6));
+	ZipArchive truncated, wrong, garbage;
+	test::check(!truncated.load(truncated_path, error) && !wrong.load(misplaced_path, error) &&
+	  !garbage.load(garbage_path, error), "truncated or damaged archives and other files are refused");
+  }
+
+  FileServer* server = new FileServer(port, site_path);
+  std::thread([server] { server->run(); }).detach();
+  {
+	test::response home = test::get(port, "/");
+	test::check(home.status == 200 && home.body == "<p>zipped</p>\n" && home.field("Content-Type") == "text/html",
+	  "the index of the root is served from the archive");
+	test::response gzip = test::get(port, "/docs/big.txt", "Accept-Encoding: gzip\r\n");
+	test::check(gzip.status == 200 && gzip.body == gzip_member(text) && gzip.field("Content-Encoding") == "gzip" &&
+	  gzip.field("Vary") == "Accept-Encoding", "a deflated entry is sent to gzip clients as a member");
+	test::response plain = test::get(port, "/docs/big.txt");
+#ifdef WITH_ZLIB
+	test::check(plain.status == 200 && plain.body == text && plain.field("Content-Encoding").empty(),
+	  "a deflated entry is sent inflated to other clients");
+#else
+	test::check(plain.status == 406, "a deflated entry is 406 for other clients");
+#endif
+	test::response again = test::get(port, "/docs/big.txt", "Accept-Encoding: gzip\r\nIf-None-Match: " +
+	  gzip.field("ETag") + "\r\n");
+	test::check(again.status == 304, "a matching If-None-Match gets 304");
+	test::check(test::get(port, "/secret.txt").status == 404, "entries left out are 404");
+  }
+
+  return test::finish();
+}